@@ -0,0 +1,36 @@
+project "benchmarks"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++20"
+    targetdir "bin/%{cfg.buildcfg}"
+    staticruntime "on"
+
+    files 
+    {
+        "premake5.lua",
+        "simperf_bench.cpp"
+    }
+
+    includedirs
+    {
+        ".",
+        "%{IncludeDir.spdlog}",
+    }
+
+    links
+    {
+        "simperf",
+    }
+
+    targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+    objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+    filter "configurations:Debug"
+        runtime "Debug"
+        symbols "On"
+
+    -- Numbers only mean something from an optimized build.
+    filter "configurations:Release"
+        runtime "Release"
+        optimize "Speed"
+        symbols "Off"
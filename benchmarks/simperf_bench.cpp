@@ -0,0 +1,295 @@
+// simperf-bench: what the profiler, assertion and logging hot paths cost under contention.
+//
+//   simperf-bench [--threads 8] [--ops 200000] [--format json|csv] [--case scope_empty ...]
+//
+// Every case runs at 1, 2, 4 ... threads up to --threads (default: the hardware concurrency, which
+// is also run itself when it is not a power of two). Threads time their operations in batches of
+// BATCH_SIZE. ns_per_op is the mean time per operation seen by one thread, p50/p99 are
+// percentiles of the per-batch means, and events_per_s is the rate at which all threads together
+// produced captured events (trace events for scope cases, operations otherwise). One JSON object
+// per line, or CSV with a header, so runs can be diffed and plotted.
+//
+// Scope cases record into a live trace session with the overhead governor off, so every scope is
+// timed and captured. No writer drains a ring as fast as a tight loop fills it, so the threads
+// stop together whenever their rings are full, the session is ended and a new one begun, and that
+// pause is left out of the timings. `captured` and `dropped` count the events; anything dropped
+// means the numbers include the ring-full path and should not be trusted. Loggers write to a null
+// sink: formatting is measured, output is not.
+#define SIMPERF_ENABLE
+#include "../include/simperf2.hpp"
+
+#include <spdlog/sinks/null_sink.h>
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr std::size_t BATCH_SIZE = 16;
+
+struct BenchResult {
+  std::string Case;
+  unsigned Threads;
+  std::uint64_t Ops;
+  double NsPerOp;
+  double WallSeconds; // with the pauses between rounds left out
+  double P50Ns;
+  double P99Ns;
+  std::uint64_t Captured = 0;
+  std::uint64_t Dropped = 0;
+  double EventsPerSecond = 0.0;
+};
+
+// Every Ops operations per thread the threads stop together and Between runs.
+struct Rounds {
+  std::size_t Ops = 0; // 0 runs without stopping
+  std::function<void()> Between;
+};
+
+struct BenchCase {
+  const char *Name;
+  unsigned EventsPerOp; // trace events each operation captures, 0 for untraced cases
+  std::function<BenchResult(unsigned, std::size_t, const Rounds &)> Run;
+};
+
+double percentile(std::vector<double> &samples, double fraction) {
+  if (samples.empty())
+    return 0.0;
+  auto at = static_cast<std::size_t>(fraction * static_cast<double>(samples.size() - 1));
+  std::nth_element(samples.begin(), samples.begin() + at, samples.end());
+  return samples[at];
+}
+
+// Runs `op(i)` `ops` times on each of `threads` threads, all released at once.
+template <typename Op>
+BenchResult run_threads(const char *name, unsigned threads, std::size_t ops,
+                        const Rounds &rounds, Op op) {
+  std::size_t batches = std::max<std::size_t>(ops / BATCH_SIZE, 1);
+  std::size_t round_batches = rounds.Ops / BATCH_SIZE;
+  std::vector<std::vector<double>> samples(threads, std::vector<double>(batches));
+  std::vector<double> busy_ns(threads, 0.0);
+  std::atomic<unsigned> ready{0};
+  std::atomic_bool go{false};
+
+  std::chrono::steady_clock::duration measured{};
+  std::chrono::steady_clock::time_point round_start;
+  auto between_rounds = [&]() noexcept {
+    measured += std::chrono::steady_clock::now() - round_start;
+    rounds.Between();
+    round_start = std::chrono::steady_clock::now();
+  };
+  std::barrier sync(static_cast<std::ptrdiff_t>(threads), between_rounds);
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      ::simperf::Instrumentor::Get().SetThreadName("bench " + std::to_string(t));
+      ready.fetch_add(1, std::memory_order_acq_rel);
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      auto &mine = samples[t];
+      std::size_t i = 0;
+      for (std::size_t b = 0; b < batches; ++b) {
+        if (round_batches != 0 && b != 0 && b % round_batches == 0)
+          sync.arrive_and_wait();
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t n = 0; n < BATCH_SIZE; ++n, ++i)
+          op(i);
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() -
+                                                                start);
+        mine[b] = elapsed.count() / BATCH_SIZE;
+        busy_ns[t] += elapsed.count();
+      }
+    });
+  }
+  while (ready.load(std::memory_order_acquire) != threads)
+    std::this_thread::yield();
+  round_start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto &worker : workers)
+    worker.join();
+  measured += std::chrono::steady_clock::now() - round_start;
+  auto wall = std::chrono::duration<double>(measured);
+
+  std::vector<double> all;
+  all.reserve(threads * batches);
+  double busy = 0.0;
+  for (unsigned t = 0; t < threads; ++t) {
+    all.insert(all.end(), samples[t].begin(), samples[t].end());
+    busy += busy_ns[t];
+  }
+  std::uint64_t total = static_cast<std::uint64_t>(threads) * batches * BATCH_SIZE;
+  return {name,
+          threads,
+          total,
+          busy / static_cast<double>(total),
+          wall.count(),
+          percentile(all, 0.50),
+          percentile(all, 0.99)};
+}
+
+std::vector<BenchCase> make_cases(void) {
+  static volatile int source = 0;
+  std::vector<BenchCase> cases;
+  cases.push_back({"scope_empty", 1, [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("scope_empty", threads, ops, rounds,
+                                        [](std::size_t) { SIMPERF_PROFILE_SCOPE("bench empty"); });
+                   }});
+  cases.push_back({"scope_nested_3", 3,
+                   [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("scope_nested_3", threads, ops, rounds, [](std::size_t) {
+                       SIMPERF_PROFILE_SCOPE("bench outer");
+                       {
+                         SIMPERF_PROFILE_SCOPE("bench middle");
+                         {
+                           SIMPERF_PROFILE_SCOPE("bench inner");
+                         }
+                       }
+                     });
+                   }});
+  cases.push_back({"scope_args", 1, [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("scope_args", threads, ops, rounds, [](std::size_t i) {
+                       SIMPERF_PROFILE_SCOPE("bench args", static_cast<int>(i), 0.5);
+                     });
+                   }});
+  cases.push_back({"assert_pass", 0, [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("assert_pass", threads, ops, rounds, [](std::size_t) {
+                       int x = source;
+                       int y = source;
+                       auto a = ::simperf::Assertion(x == y, x, y, "x == y");
+                       (void)a;
+                     });
+                   }});
+  // After its first few failures the site is rate limited, as it would be in production.
+  cases.push_back({"assert_fail", 0, [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("assert_fail", threads, ops, rounds, [](std::size_t) {
+                       int x = source;
+                       int y = source + 1;
+                       auto a = ::simperf::Assertion(x == y, x, y, "x == y");
+                       (void)a;
+                     });
+                   }});
+  cases.push_back({"log_info", 0, [](unsigned threads, std::size_t ops, const Rounds &rounds) {
+                     return run_threads("log_info", threads, ops, rounds, [](std::size_t i) {
+                       SIMPERF_INFO("bench", "op {0} of {1}", i, "log_info");
+                     });
+                   }});
+  return cases;
+}
+
+std::vector<unsigned> thread_counts(unsigned max_threads) {
+  std::vector<unsigned> counts;
+  for (unsigned n = 1; n <= max_threads; n *= 2)
+    counts.push_back(n);
+  if (counts.back() != max_threads)
+    counts.push_back(max_threads);
+  return counts;
+}
+
+void print(const BenchResult &result, bool csv) {
+  if (csv) {
+    std::cout << result.Case << ',' << result.Threads << ',' << result.Ops << ','
+              << result.NsPerOp << ',' << result.EventsPerSecond << ',' << result.P50Ns << ','
+              << result.P99Ns << ',' << result.Captured << ',' << result.Dropped << '\n';
+    return;
+  }
+  std::cout << "{\"case\":\"" << result.Case << "\",\"threads\":" << result.Threads
+            << ",\"ops\":" << result.Ops << ",\"ns_per_op\":" << result.NsPerOp
+            << ",\"events_per_s\":" << result.EventsPerSecond << ",\"p50_ns\":" << result.P50Ns
+            << ",\"p99_ns\":" << result.P99Ns << ",\"captured\":" << result.Captured
+            << ",\"dropped\":" << result.Dropped << "}\n";
+}
+
+// Sends a logger to a null sink. This also silences the trace drop warning, which is why every
+// result carries its own `dropped` count.
+void silence(const char *name) {
+  auto sink = std::make_shared<spdlog::sinks::null_sink_mt>();
+  auto logger = std::make_shared<spdlog::logger>(name, sink);
+  logger->set_level(spdlog::level::trace);
+  ::simperf::LoggerRegistry::Publish(logger);
+  if (std::string_view(name) == "simperf")
+    spdlog::set_default_logger(logger);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  unsigned max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  std::size_t ops = 200'000;
+  bool csv = false;
+  std::vector<std::string> only;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg(argv[i]);
+    if (arg == "--threads" && i + 1 < argc)
+      max_threads = std::max(static_cast<unsigned>(std::stoul(argv[++i])), 1u);
+    else if (arg == "--ops" && i + 1 < argc)
+      ops = std::stoull(argv[++i]);
+    else if (arg == "--format" && i + 1 < argc)
+      csv = std::string_view(argv[++i]) == "csv";
+    else if (arg == "--case" && i + 1 < argc)
+      only.emplace_back(argv[++i]);
+    else {
+      std::cerr << "usage: simperf-bench [--threads N] [--ops N] [--format json|csv] "
+                   "[--case name ...]\n";
+      return 2;
+    }
+  }
+
+  ::simperf::default_initialize();
+  silence("simperf");
+  silence("bench");
+  ::simperf::GovernorOptions governor;
+  governor.Enabled = false;
+  ::simperf::Governor::SetOptions(governor);
+
+  auto trace_path = (std::filesystem::temp_directory_path() / "simperf_bench.json").string();
+  if (csv)
+    std::cout << "case,threads,ops,ns_per_op,events_per_s,p50_ns,p99_ns,captured,dropped\n";
+  try {
+    for (const auto &bench : make_cases()) {
+      if (!only.empty() && std::find(only.begin(), only.end(), bench.Name) == only.end())
+        continue;
+      for (unsigned threads : thread_counts(max_threads)) {
+        auto &instrumentor = ::simperf::Instrumentor::Get();
+        auto &collector = ::simperf::trace::TraceCollector::Get();
+        std::uint64_t dropped = 0;
+        Rounds rounds;
+        if (bench.EventsPerOp != 0) {
+          // A round fills every thread's ring at most once; ending the session drains them all.
+          rounds.Ops = ::simperf::trace::TRACE_RING_CAPACITY / bench.EventsPerOp;
+          rounds.Between = [&] {
+            instrumentor.EndSession();
+            dropped += collector.LastSessionDropped();
+            instrumentor.BeginSession(bench.Name, trace_path);
+          };
+          instrumentor.BeginSession(bench.Name, trace_path);
+        }
+        auto result = bench.Run(threads, ops, rounds);
+        if (bench.EventsPerOp != 0) {
+          instrumentor.EndSession();
+          dropped += collector.LastSessionDropped();
+        }
+        auto produced = result.Ops * std::max(bench.EventsPerOp, 1u);
+        result.Dropped = dropped;
+        result.Captured = produced - std::min(dropped, produced);
+        result.EventsPerSecond = static_cast<double>(result.Captured) / result.WallSeconds;
+        print(result, csv);
+        std::cout.flush();
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << "simperf-bench: " << e.what() << std::endl;
+    return 1;
+  }
+  std::filesystem::remove(trace_path);
+  return 0;
+}
@@ -13,4 +13,6 @@ group ""
 group "core"
    include "include/"
    include "tests/"
+   include "tools/"
+   include "benchmarks/"
 group ""
\ No newline at end of file
@@ -1,3 +1,11 @@
+#if defined(_MSC_VER)
+#define SIMPERF_NOINLINE __declspec(noinline)
+#define SIMPERF_COLD
+#else
+#define SIMPERF_NOINLINE __attribute__((noinline))
+#define SIMPERF_COLD __attribute__((cold))
+#endif
+
 namespace simperf {
 #pragma region SmartString
 template <typename StringType = const char *> class SmartString {
@@ -42,6 +50,14 @@ namespace simperf {
 // Expression string, Provide source_location
 static constexpr std::string_view ASSERT_PREFIX("ASSERT: Expression \"{}\" failed at line {} in {}");
 static constexpr std::string_view ASSERT_FMTMSG("\n{}: {}\n{}: {}");
+// Scope name, Provide source_location
+static constexpr std::string_view
+    BUDGET_PREFIX("BUDGET: Scope \"{}\" exceeded its budget at line {} in {}");
+static constexpr std::string_view
+    ASSERT_SUMMARY_FMTMSG("ASSERT: suppressed {} failures of \"{}\" at {}:{} in last {}s, "
+                          "last {}/{}={}/{}");
+static constexpr std::string_view
+    ASSERT_SUMMARY_NOARGS_FMTMSG("ASSERT: suppressed {} failures at {}:{} in last {}s");
 
 enum class AssertionType { ValueCheck, ExplicitNoThrow, VariableThrow, Throw, Fatal };
 
@@ -104,13 +120,13 @@ typedef std::unordered_map<AssertionType, sp_log_level> AssertionLogLevelTargets
 
 typedef std::pair<ProfilingLogLevelTargets, AssertionLogLevelTargets> DefaultLogLevelTargets;
 
-ProfilingLogLevelTargets get_default_profiling_log_level_targets(void) {
+inline ProfilingLogLevelTargets get_default_profiling_log_level_targets(void) {
   return {{ProfilingLogSource::FunctionSignature, sp_log_level::trace},
           {ProfilingLogSource::ScopeValueTracking, sp_log_level::debug},
           {ProfilingLogSource::ScopeTiming, sp_log_level::debug}};
 }
 
-AssertionLogLevelTargets get_default_assertion_log_level_targets(void) {
+inline AssertionLogLevelTargets get_default_assertion_log_level_targets(void) {
   return {{AssertionType::ValueCheck, sp_log_level::info},
           {AssertionType::ExplicitNoThrow, sp_log_level::warn},
           {AssertionType::VariableThrow, sp_log_level::err},
@@ -118,11 +134,11 @@ AssertionLogLevelTargets get_default_assertion_log_level_targets(void) {
           {AssertionType::Fatal, sp_log_level::critical}};
   }
 
-DefaultLogLevelTargets get_default_log_level_targets(void) {
+inline DefaultLogLevelTargets get_default_log_level_targets(void) {
   return {get_default_profiling_log_level_targets(), get_default_assertion_log_level_targets()};
 }
 
-std::unordered_map<std::string, DefaultLogLevelTargets> s_LogLevelTargets{
+inline std::unordered_map<std::string, DefaultLogLevelTargets> s_LogLevelTargets{
     {"simperf", get_default_log_level_targets()}};
 #pragma endregion LogLevelTargeting
 
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <source_location>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace simperf {
+#pragma region AssertionRateLimit
+// Applies to non-fatal assertion types only. The first `LogFirst` failures of a site are always
+// logged; after that a token bucket refilled at `RatePerSecond` (holding at most `Burst` tokens)
+// decides, and suppressed failures are summarised at most once per `SummaryInterval`.
+struct AssertionRateLimit {
+  bool Enabled = true;
+  std::uint64_t LogFirst = 10;
+  double RatePerSecond = 1.0;
+  std::uint32_t Burst = 5;
+  std::chrono::milliseconds SummaryInterval = std::chrono::seconds(10);
+};
+
+// Set rarely and read by every rate limited failure, so readers take a sequence-locked copy
+// instead of a mutex. Stores must not race each other; ctx serialises them.
+class AtomicAssertionRateLimit {
+public:
+  void Store(const AssertionRateLimit &limit) {
+    auto sequence = m_Sequence.load(std::memory_order_relaxed);
+    m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_Enabled.store(limit.Enabled, std::memory_order_relaxed);
+    m_LogFirst.store(limit.LogFirst, std::memory_order_relaxed);
+    m_RatePerSecond.store(limit.RatePerSecond, std::memory_order_relaxed);
+    m_Burst.store(limit.Burst, std::memory_order_relaxed);
+    m_SummaryIntervalMs.store(limit.SummaryInterval.count(), std::memory_order_relaxed);
+    m_Sequence.store(sequence + 2, std::memory_order_release);
+  }
+
+  AssertionRateLimit Load(void) const {
+    for (;;) {
+      auto sequence = m_Sequence.load(std::memory_order_acquire);
+      AssertionRateLimit limit;
+      limit.Enabled = m_Enabled.load(std::memory_order_relaxed);
+      limit.LogFirst = m_LogFirst.load(std::memory_order_relaxed);
+      limit.RatePerSecond = m_RatePerSecond.load(std::memory_order_relaxed);
+      limit.Burst = m_Burst.load(std::memory_order_relaxed);
+      limit.SummaryInterval =
+          std::chrono::milliseconds(m_SummaryIntervalMs.load(std::memory_order_relaxed));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence % 2 == 0 && m_Sequence.load(std::memory_order_relaxed) == sequence)
+        return limit;
+    }
+  }
+
+private:
+  static constexpr AssertionRateLimit s_Defaults{};
+
+  std::atomic<std::uint64_t> m_Sequence{0};
+  std::atomic_bool m_Enabled{s_Defaults.Enabled};
+  std::atomic<std::uint64_t> m_LogFirst{s_Defaults.LogFirst};
+  std::atomic<double> m_RatePerSecond{s_Defaults.RatePerSecond};
+  std::atomic<std::uint32_t> m_Burst{s_Defaults.Burst};
+  std::atomic<std::int64_t> m_SummaryIntervalMs{s_Defaults.SummaryInterval.count()};
+};
+
+enum class AssertionAdmission { Log, Summarize, Suppress };
+
+struct AssertionSiteStats {
+  std::string_view File;
+  std::uint32_t Line;
+  AssertionType Type;
+  std::uint64_t Failures;
+  std::uint64_t Suppressed;
+};
+
+class AssertionSite {
+public:
+  AssertionSite(const std::source_location &location, AssertionType type)
+      : m_File(location.file_name()), m_Line(location.line()), m_Column(location.column()),
+        m_Type(type) {}
+
+  // Lock free; safe to call from any number of threads failing at the same site.
+  AssertionAdmission Admit(const AssertionRateLimit &limit, std::int64_t now_ns,
+                           std::uint64_t &suppressed_since_summary,
+                           std::chrono::nanoseconds &summary_window) {
+    auto failures = m_Failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (!limit.Enabled || failures <= limit.LogFirst || TakeToken(limit, now_ns))
+      return AssertionAdmission::Log;
+
+    m_Suppressed.fetch_add(1, std::memory_order_relaxed);
+    m_SuppressedSinceSummary.fetch_add(1, std::memory_order_relaxed);
+
+    auto last_summary = m_LastSummaryNs.load(std::memory_order_relaxed);
+    if (last_summary == 0) {
+      // First suppression opens the summary window.
+      m_LastSummaryNs.compare_exchange_strong(last_summary, now_ns, std::memory_order_relaxed);
+      return AssertionAdmission::Suppress;
+    }
+    if (now_ns - last_summary < limit.SummaryInterval.count() * 1'000'000)
+      return AssertionAdmission::Suppress;
+    if (!m_LastSummaryNs.compare_exchange_strong(last_summary, now_ns,
+                                                 std::memory_order_relaxed))
+      return AssertionAdmission::Suppress;
+
+    suppressed_since_summary = m_SuppressedSinceSummary.exchange(0, std::memory_order_relaxed);
+    summary_window = std::chrono::nanoseconds(now_ns - last_summary);
+    return AssertionAdmission::Summarize;
+  }
+
+  // Takes the pending suppressed count for a summary emitted outside of a failing call.
+  std::uint64_t TakeSuppressedSinceSummary(std::int64_t now_ns,
+                                           std::chrono::nanoseconds &summary_window) {
+    auto last_summary = m_LastSummaryNs.exchange(now_ns, std::memory_order_relaxed);
+    summary_window = std::chrono::nanoseconds(last_summary ? now_ns - last_summary : 0);
+    return m_SuppressedSinceSummary.exchange(0, std::memory_order_relaxed);
+  }
+
+  AssertionSiteStats Stats(void) const {
+    return {m_File, m_Line, m_Type, m_Failures.load(std::memory_order_relaxed),
+            m_Suppressed.load(std::memory_order_relaxed)};
+  }
+
+  std::string_view File(void) const { return m_File; }
+  std::uint32_t Line(void) const { return m_Line; }
+
+  bool Matches(const std::source_location &location) const {
+    return m_File == location.file_name() && m_Line == location.line() &&
+           m_Column == location.column();
+  }
+
+private:
+  // GCRA form of a token bucket: a single atomic "theoretical arrival time".
+  bool TakeToken(const AssertionRateLimit &limit, std::int64_t now_ns) {
+    if (limit.RatePerSecond <= 0.0)
+      return false;
+    auto interval = static_cast<std::int64_t>(1e9 / limit.RatePerSecond);
+    auto tolerance = interval * static_cast<std::int64_t>(limit.Burst > 0 ? limit.Burst - 1 : 0);
+    auto tat = m_TheoreticalArrivalNs.load(std::memory_order_relaxed);
+    for (;;) {
+      auto start = tat > now_ns ? tat : now_ns;
+      if (start - now_ns > tolerance)
+        return false;
+      if (m_TheoreticalArrivalNs.compare_exchange_weak(tat, start + interval,
+                                                       std::memory_order_relaxed))
+        return true;
+    }
+  }
+
+private:
+  const char *m_File;
+  std::uint32_t m_Line;
+  std::uint32_t m_Column;
+  AssertionType m_Type;
+  std::atomic<std::uint64_t> m_Failures{0};
+  std::atomic<std::uint64_t> m_Suppressed{0};
+  std::atomic<std::uint64_t> m_SuppressedSinceSummary{0};
+  std::atomic<std::int64_t> m_TheoreticalArrivalNs{0};
+  std::atomic<std::int64_t> m_LastSummaryNs{0};
+};
+
+static constexpr std::size_t ASSERTION_SITE_TABLE_SIZE = 1024; // must be a power of two
+
+// Sites are keyed by source location and only looked up on the failure path. s_Sites owns them;
+// s_Table indexes the first ASSERTION_SITE_TABLE_SIZE of them by open addressing, so a failing
+// call finds its site with a few loads and no lock. Sites are never removed.
+class AssertionSiteRegistry {
+public:
+  static AssertionSite &Get(const std::source_location &location, AssertionType type) {
+    auto hash = KeyHash{}(KeyOf(location));
+    for (std::size_t probe = 0; probe < ASSERTION_SITE_TABLE_SIZE; ++probe) {
+      AssertionSite *site =
+          s_Table[(hash + probe) % ASSERTION_SITE_TABLE_SIZE].load(std::memory_order_acquire);
+      if (site == nullptr)
+        break;
+      if (site->Matches(location))
+        return *site;
+    }
+    return Insert(location, type, hash);
+  }
+
+  static std::uint64_t FailureCount(std::string_view file, std::uint32_t line) {
+    std::uint64_t failures = 0;
+    for (const auto &stats : Stats()) {
+      if (stats.Line == line && stats.File.ends_with(file))
+        failures += stats.Failures;
+    }
+    return failures;
+  }
+
+  static std::vector<AssertionSiteStats> Stats(void) {
+    std::shared_lock lock(s_Lock);
+    std::vector<AssertionSiteStats> stats;
+    stats.reserve(s_Sites.size());
+    for (const auto &[key, site] : s_Sites)
+      stats.push_back(site->Stats());
+    return stats;
+  }
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::shared_lock lock(s_Lock);
+    for (const auto &[key, site] : s_Sites)
+      fn(*site);
+  }
+
+private:
+  SIMPERF_NOINLINE static AssertionSite &Insert(const std::source_location &location,
+                                                AssertionType type, std::size_t hash) {
+    std::unique_lock lock(s_Lock);
+    auto &site = s_Sites[KeyOf(location)];
+    if (site)
+      return *site;
+    site = std::make_unique<AssertionSite>(location, type);
+    for (std::size_t probe = 0; probe < ASSERTION_SITE_TABLE_SIZE; ++probe) {
+      auto &slot = s_Table[(hash + probe) % ASSERTION_SITE_TABLE_SIZE];
+      if (slot.load(std::memory_order_relaxed) == nullptr) {
+        slot.store(site.get(), std::memory_order_release);
+        break;
+      }
+    }
+    return *site;
+  }
+
+  struct Key {
+    const char *File;
+    std::uint32_t Line;
+    std::uint32_t Column;
+    bool operator==(const Key &) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      return std::hash<const void *>{}(key.File) ^ (std::size_t(key.Line) << 16) ^ key.Column;
+    }
+  };
+
+  static Key KeyOf(const std::source_location &location) {
+    return {location.file_name(), location.line(), location.column()};
+  }
+
+  inline static std::shared_mutex s_Lock;
+  inline static std::unordered_map<Key, std::unique_ptr<AssertionSite>, KeyHash> s_Sites;
+  inline static std::array<std::atomic<AssertionSite *>, ASSERTION_SITE_TABLE_SIZE> s_Table{};
+};
+#pragma endregion AssertionRateLimit
+} // namespace simperf
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include "logger-registry-impl.h"
+#include "spsc-ring-impl.h"
+
+namespace simperf {
+namespace async {
+#pragma region AsyncLogRecord
+// A record is one fixed-size ring slot. The caller copies the logger name, the format string and
+// the raw argument values into it; the backend thread does the filtering, formatting and I/O.
+// FormatRecordFn appends the formatted message to its output string.
+static constexpr std::size_t ASYNC_RECORD_SIZE = 256;
+static constexpr std::size_t ASYNC_RING_CAPACITY = 1024; // must be a power of two
+static constexpr std::size_t ASYNC_LOGGER_NAME_SIZE = 32;
+
+struct LogRecord;
+using FormatRecordFn = void (*)(const LogRecord &, std::string &);
+
+struct LogRecordHeader {
+  FormatRecordFn Format;
+  spdlog::log_clock::time_point Time;
+  std::uint64_t RequestID; // 0 outside a request; the backend writes the prefix
+  sp_log_level Level;
+  std::uint16_t FmtOffset;
+  std::uint16_t FmtSize;
+  std::uint8_t LoggerNameSize;
+  char LoggerName[ASYNC_LOGGER_NAME_SIZE];
+};
+
+static constexpr std::size_t ASYNC_PAYLOAD_SIZE =
+    ASYNC_RECORD_SIZE - ((sizeof(LogRecordHeader) + alignof(std::max_align_t) - 1) /
+                         alignof(std::max_align_t) * alignof(std::max_align_t));
+
+struct LogRecord : LogRecordHeader {
+  alignas(std::max_align_t) std::byte Payload[ASYNC_PAYLOAD_SIZE];
+
+  std::string_view LoggerNameView(void) const { return {LoggerName, LoggerNameSize}; }
+
+  std::string_view FmtView(void) const {
+    return {reinterpret_cast<const char *>(Payload) + FmtOffset, FmtSize};
+  }
+};
+
+static_assert(sizeof(LogRecord) == ASYNC_RECORD_SIZE, "LogRecord must fill exactly one slot");
+
+// String-like arguments are copied into the payload and handed back to std::format as views.
+struct StringRef {
+  std::uint16_t Offset;
+  std::uint16_t Size;
+};
+
+template <typename T> struct AsyncArg {
+  using Decayed = std::remove_cvref_t<T>;
+  static constexpr bool IsString = std::is_convertible_v<const Decayed &, std::string_view>;
+  static constexpr bool Supported =
+      IsString || (std::is_trivially_copyable_v<Decayed> && !std::is_pointer_v<Decayed>);
+  using Stored = std::conditional_t<IsString, StringRef, Decayed>;
+};
+
+template <typename T> inline const T &LoadArg(const T &value, const LogRecord &) { return value; }
+
+inline std::string_view LoadArg(const StringRef &ref, const LogRecord &record) {
+  return {reinterpret_cast<const char *>(record.Payload) + ref.Offset, ref.Size};
+}
+
+template <typename... Stored> void FormatRecord(const LogRecord &record, std::string &out) {
+  const auto &args =
+      *std::launder(reinterpret_cast<const std::tuple<Stored...> *>(record.Payload));
+  std::string_view fmt = record.FmtView();
+  auto loaded = std::apply(
+      [&](const auto &...stored) { return std::make_tuple(LoadArg(stored, record)...); }, args);
+  std::apply([&](auto &...values) { out += std::vformat(fmt, std::make_format_args(values...)); },
+             loaded);
+}
+#pragma endregion AsyncLogRecord
+
+#pragma region AsyncLogRing
+using LogRing = SpscRing<LogRecord, ASYNC_RING_CAPACITY>;
+#pragma endregion AsyncLogRing
+
+#pragma region AsyncLogBackend
+class AsyncLogBackend {
+public:
+  AsyncLogBackend(const AsyncLogBackend &) = delete;
+  AsyncLogBackend(AsyncLogBackend &&) = delete;
+
+  static AsyncLogBackend &Get() {
+    static AsyncLogBackend instance;
+    return instance;
+  }
+
+  void Start(std::chrono::milliseconds poll_interval) {
+    std::lock_guard lock(m_ThreadLock);
+    if (m_Running.load(std::memory_order_acquire))
+      return;
+    m_PollInterval = poll_interval;
+    m_StopRequested = false;
+    m_Thread = std::make_unique<std::thread>([this] { Run(); });
+    m_Running.store(true, std::memory_order_release);
+  }
+
+  // Drains everything that was enqueued before the call, then joins the backend thread.
+  void Stop(void) {
+    std::lock_guard lock(m_ThreadLock);
+    if (!m_Running.load(std::memory_order_acquire))
+      return;
+    m_Running.store(false, std::memory_order_release);
+    {
+      std::lock_guard wake(m_WakeLock);
+      m_StopRequested = true;
+    }
+    m_WakeCondition.notify_one();
+    m_Thread->join();
+    m_Thread.reset();
+  }
+
+  bool Running(void) const { return m_Running.load(std::memory_order_acquire); }
+
+  // Blocks until every record enqueued before the call has reached its sinks.
+  void Flush(void) {
+    if (!Running())
+      return;
+    std::unique_lock lock(m_WakeLock);
+    auto ticket = ++m_FlushRequested;
+    m_WakeCondition.notify_one();
+    m_FlushCondition.wait(lock, [&] { return m_FlushCompleted >= ticket || m_StopRequested; });
+  }
+
+  void SetLevel(sp_log_level level) { m_Level.store(level, std::memory_order_relaxed); }
+
+  bool ShouldEnqueue(sp_log_level level) const {
+    return level >= m_Level.load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t DroppedCount(void) const { return m_Dropped.load(std::memory_order_relaxed); }
+
+  void CountDropped(void) { m_Dropped.fetch_add(1, std::memory_order_relaxed); }
+
+  LogRing &ThreadRing(void) {
+    auto &holder = ThreadRingHolder::Local();
+    if (!holder.Ring) {
+      holder.Ring = std::make_shared<LogRing>();
+      std::lock_guard lock(m_RingsLock);
+      m_Rings.push_back(holder.Ring);
+    }
+    return *holder.Ring;
+  }
+
+private:
+  AsyncLogBackend() {
+#if !defined(_WIN32)
+    pthread_atfork(&AsyncLogBackend::PrepareFork, &AsyncLogBackend::AfterForkInParent,
+                   &AsyncLogBackend::AfterForkInChild);
+#endif
+  }
+
+  ~AsyncLogBackend() { Stop(); }
+
+#if !defined(_WIN32)
+  // Taking every lock across fork() means the child never inherits the backend thread halfway
+  // through a sink write, nor a ring list or wake state in the middle of an update.
+  static void PrepareFork(void) {
+    auto &backend = Get();
+    backend.m_ThreadLock.lock();
+    backend.m_DrainLock.lock();
+    backend.m_WakeLock.lock();
+    backend.m_RingsLock.lock();
+  }
+
+  static void AfterForkInParent(void) {
+    auto &backend = Get();
+    backend.m_RingsLock.unlock();
+    backend.m_WakeLock.unlock();
+    backend.m_DrainLock.unlock();
+    backend.m_ThreadLock.unlock();
+  }
+
+  // The backend thread does not exist in the child and every queued record belongs to the parent,
+  // which writes it. The child logs synchronously until async logging is enabled again; nothing
+  // here allocates or starts a thread.
+  static void AfterForkInChild(void) {
+    auto &backend = Get();
+    (void)backend.m_Thread.release(); // never joinable here, and destroying it would terminate()
+    backend.m_Running.store(false, std::memory_order_relaxed);
+    backend.m_StopRequested = false;
+    backend.m_FlushRequested = 0;
+    backend.m_FlushCompleted = 0;
+    // The parent's backend thread may have been waiting on these.
+    std::construct_at(&backend.m_WakeCondition);
+    std::construct_at(&backend.m_FlushCondition);
+    LogRing *own = ThreadRingHolder::Local().Ring.get();
+    for (const auto &ring : backend.m_Rings) {
+      if (ring.get() == own)
+        ring->Discard();
+      else
+        ring->Orphan(); // its thread is gone; the next drain releases it
+    }
+    backend.m_Touched.clear();
+    backend.m_RingsLock.unlock();
+    backend.m_WakeLock.unlock();
+    backend.m_DrainLock.unlock();
+    backend.m_ThreadLock.unlock();
+  }
+#endif
+
+  struct ThreadRingHolder {
+    std::shared_ptr<LogRing> Ring;
+
+    static ThreadRingHolder &Local(void) {
+      thread_local ThreadRingHolder holder;
+      return holder;
+    }
+
+    ~ThreadRingHolder() {
+      if (Ring)
+        Ring->Orphan();
+    }
+  };
+
+  void Run(void) {
+    std::uint64_t reported_dropped = 0;
+    for (;;) {
+      std::uint64_t flush_ticket;
+      bool stopping;
+      {
+        std::unique_lock lock(m_WakeLock);
+        m_WakeCondition.wait_for(lock, m_PollInterval, [&] {
+          return m_StopRequested || m_FlushRequested != m_FlushCompleted;
+        });
+        flush_ticket = m_FlushRequested;
+        stopping = m_StopRequested;
+      }
+
+      DrainAll();
+
+      auto dropped = DroppedCount();
+      if (dropped != reported_dropped) {
+        spdlog::default_logger_raw()->warn("async log queue full, dropped {} message(s)",
+                                           dropped - reported_dropped);
+        reported_dropped = dropped;
+      }
+
+      {
+        std::lock_guard lock(m_WakeLock);
+        m_FlushCompleted = flush_ticket;
+      }
+      m_FlushCondition.notify_all();
+
+      if (stopping)
+        break;
+    }
+  }
+
+  void DrainAll(void) {
+    std::lock_guard drain(m_DrainLock);
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+      std::lock_guard lock(m_RingsLock);
+      rings = m_Rings;
+    }
+
+    for (const auto &ring : rings) {
+      while (const LogRecord *record = ring->Front()) {
+        Dispatch(*record);
+        ring->Pop();
+      }
+    }
+
+    for (auto *logger : m_Touched)
+      logger->flush();
+    m_Touched.clear();
+
+    std::lock_guard lock(m_RingsLock);
+    std::erase_if(m_Rings, [](const std::shared_ptr<LogRing> &ring) {
+      return ring->Orphaned() && ring->Front() == nullptr;
+    });
+  }
+
+  void Dispatch(const LogRecord &record) {
+    auto name = record.LoggerNameView();
+    spdlog::logger *logger =
+        name.empty() ? spdlog::default_logger_raw() : LoggerRegistry::Resolve(name);
+    if (logger == nullptr || !logger->should_log(record.Level))
+      return;
+
+    m_Scratch.clear();
+    if (record.RequestID != 0) [[unlikely]]
+      std::format_to(std::back_inserter(m_Scratch), "[request {:016x}] ", record.RequestID);
+    // Formatting runs here rather than in the caller, so a bad format string or a throwing
+    // formatter must not escape the backend thread; the record is written with its raw format.
+    std::size_t prefix = m_Scratch.size();
+    try {
+      record.Format(record, m_Scratch);
+    } catch (const std::exception &e) {
+      m_Scratch.resize(prefix);
+      std::format_to(std::back_inserter(m_Scratch), "failed to format async log record \"{}\": {}",
+                     record.FmtView(), e.what());
+    }
+    logger->log(record.Time, spdlog::source_loc{}, record.Level, m_Scratch);
+    LoggerRegistry::CountMessage(*logger, record.Level);
+    if (std::find(m_Touched.begin(), m_Touched.end(), logger) == m_Touched.end())
+      m_Touched.push_back(logger);
+  }
+
+private:
+  std::mutex m_ThreadLock;
+  std::unique_ptr<std::thread> m_Thread;
+  std::atomic_bool m_Running{false};
+  std::chrono::milliseconds m_PollInterval{1};
+
+  std::mutex m_WakeLock;
+  std::condition_variable m_WakeCondition;
+  std::condition_variable m_FlushCondition;
+  bool m_StopRequested{false};
+  std::uint64_t m_FlushRequested{0};
+  std::uint64_t m_FlushCompleted{0};
+
+  std::mutex m_RingsLock;
+  std::vector<std::shared_ptr<LogRing>> m_Rings;
+
+  std::mutex m_DrainLock; // held by the backend thread while it writes to sinks
+
+  std::atomic<sp_log_level> m_Level{sp_log_level::trace};
+  std::atomic<std::uint64_t> m_Dropped{0};
+
+  std::string m_Scratch;
+  std::vector<spdlog::logger *> m_Touched;
+};
+#pragma endregion AsyncLogBackend
+
+#pragma region AsyncLogEnqueue
+template <typename T> inline std::size_t StringArgSize(const T &value) {
+  if constexpr (AsyncArg<T>::IsString)
+    return std::string_view(value).size();
+  else
+    return 0;
+}
+
+template <typename T>
+inline typename AsyncArg<T>::Stored StoreArg(const T &value, LogRecord &record,
+                                             std::size_t &cursor) {
+  if constexpr (AsyncArg<T>::IsString) {
+    std::string_view view(value);
+    std::memcpy(record.Payload + cursor, view.data(), view.size());
+    StringRef ref{static_cast<std::uint16_t>(cursor), static_cast<std::uint16_t>(view.size())};
+    cursor += view.size();
+    return ref;
+  } else {
+    return value;
+  }
+}
+
+// Returns false when the call cannot be deferred (unsupported argument types, a record that does
+// not fit in one slot, no backend thread, or a full ring for an error or critical record); the
+// caller then formats synchronously. Filtered records, and dropped ones below error, count as
+// handled.
+template <typename... Args>
+inline bool TryEnqueue(std::string_view logger_name, sp_log_level level, std::uint64_t request_id,
+                       std::string_view fmt, const Args &...args) {
+  using Tuple = std::tuple<typename AsyncArg<Args>::Stored...>;
+
+  if constexpr (!(AsyncArg<Args>::Supported && ...) || sizeof(Tuple) > ASYNC_PAYLOAD_SIZE) {
+    return false;
+  } else {
+    static_assert(std::is_trivially_destructible_v<Tuple>);
+
+    auto &backend = AsyncLogBackend::Get();
+    if (!backend.Running()) [[unlikely]]
+      return false;
+    if (!backend.ShouldEnqueue(level))
+      return true;
+
+    std::size_t size = sizeof(Tuple) + fmt.size() + (StringArgSize(args) + ... + 0);
+    if (size > ASYNC_PAYLOAD_SIZE || logger_name.size() > ASYNC_LOGGER_NAME_SIZE)
+      return false;
+
+    auto &ring = backend.ThreadRing();
+    LogRecord *record = ring.Reserve();
+    if (record == nullptr) {
+      if (level >= sp_log_level::err)
+        return false;
+      backend.CountDropped();
+      return true;
+    }
+
+    record->Format = &FormatRecord<typename AsyncArg<Args>::Stored...>;
+    record->Time = spdlog::log_clock::now();
+    record->RequestID = request_id;
+    record->Level = level;
+    record->LoggerNameSize = static_cast<std::uint8_t>(logger_name.size());
+    std::memcpy(record->LoggerName, logger_name.data(), logger_name.size());
+
+    std::size_t cursor = sizeof(Tuple);
+    record->FmtOffset = static_cast<std::uint16_t>(cursor);
+    record->FmtSize = static_cast<std::uint16_t>(fmt.size());
+    std::memcpy(record->Payload + cursor, fmt.data(), fmt.size());
+    cursor += fmt.size();
+
+    ::new (static_cast<void *>(record->Payload)) Tuple{StoreArg(args, *record, cursor)...};
+    ring.Commit();
+    return true;
+  }
+}
+#pragma endregion AsyncLogEnqueue
+} // namespace async
+} // namespace simperf
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace simperf {
+#pragma region RuntimeConfig
+struct SessionConfig {
+  bool Enabled = false;
+  std::string Name = "simperf";
+  std::string Path = "results.json";
+  std::string Format = "json"; // "json" or "perfetto"
+  std::int64_t FlushIntervalMs = 1000;
+  std::int64_t FlushBytes = 4 << 20;
+  bool IoUring = false;
+  std::string Capture = "per_thread"; // "per_thread" or "per_cpu"
+  std::int64_t TailThresholdUs = 0;   // only scopes at least this long, and their ancestors
+
+  bool operator==(const SessionConfig &) const = default;
+};
+
+struct MetricsConfig {
+  bool Enabled = false;
+  std::string Path = "simperf.prom";
+  std::int64_t IntervalMs = 10000;
+
+  bool operator==(const MetricsConfig &) const = default;
+};
+
+// Everything that can change without a restart. Unset fields leave the current value alone.
+//
+//   [simperf]
+//   assertions = true
+//   async_level = "info"
+//   [simperf.tags]             tag = bool
+//   [simperf.assertion_types]  explicit_no_throw = bool, ...
+//   [simperf.log_sites]        "parser.cpp:*" = bool
+//   [simperf.resource_usage]   tag = bool
+//   [simperf.profiling]        sample_every = 1, governor_budget = 0.01 (0 turns it off)
+//   [simperf.session]          enabled = bool, name = "...", path = "...", tail_threshold_us = 0
+//   [simperf.metrics]          enabled = bool, path = "simperf.prom", interval_ms = 10000
+//
+// Logger levels are read from the spdlog_setup `[[logger]]` entries of the same file.
+struct RuntimeConfig {
+  std::vector<std::pair<std::string, sp_log_level>> LoggerLevels;
+  std::optional<bool> GlobalAssertions;
+  std::optional<sp_log_level> AsyncLogLevel;
+  std::vector<std::pair<std::string, bool>> Tags;
+  std::vector<std::pair<AssertionType, bool>> AssertionTypes;
+  std::vector<std::pair<std::string, bool>> LogSitePatterns;
+  std::vector<std::pair<std::string, bool>> ResourceUsageTags;
+  std::optional<std::uint32_t> SampleEvery;
+  std::optional<double> GovernorBudget;
+  std::optional<SessionConfig> Session;
+  std::optional<MetricsConfig> Metrics;
+};
+
+inline std::optional<AssertionType> parse_assertion_type(std::string_view name) {
+  if (name == "value_check")
+    return AssertionType::ValueCheck;
+  if (name == "explicit_no_throw")
+    return AssertionType::ExplicitNoThrow;
+  if (name == "variable_throw")
+    return AssertionType::VariableThrow;
+  if (name == "throw")
+    return AssertionType::Throw;
+  if (name == "fatal")
+    return AssertionType::Fatal;
+  return std::nullopt;
+}
+
+template <typename Fn> inline void for_each_bool(const std::shared_ptr<cpptoml::table> &table,
+                                                  Fn &&fn) {
+  if (!table)
+    return;
+  for (const auto &kv : *table) {
+    if (auto value = kv.second->template as<bool>())
+      fn(kv.first, value->get());
+  }
+}
+
+// Throws cpptoml::parse_exception on malformed input.
+inline RuntimeConfig parse_runtime_config(const std::string &path) {
+  RuntimeConfig config;
+  auto root = cpptoml::parse_file(path);
+
+  if (auto loggers = root->get_table_array("logger")) {
+    for (const auto &logger_table : *loggers) {
+      auto name = logger_table->get_as<std::string>("name");
+      auto level = logger_table->get_as<std::string>("level");
+      if (name && level)
+        config.LoggerLevels.push_back({*name, spdlog::level::from_str(*level)});
+    }
+  }
+
+  auto simperf = root->get_table("simperf");
+  if (!simperf)
+    return config;
+
+  if (auto assertions = simperf->get_as<bool>("assertions"))
+    config.GlobalAssertions = *assertions;
+  if (auto async_level = simperf->get_as<std::string>("async_level"))
+    config.AsyncLogLevel = spdlog::level::from_str(*async_level);
+
+  for_each_bool(simperf->get_table("tags"),
+                [&](const std::string &tag, bool enabled) { config.Tags.push_back({tag, enabled}); });
+  for_each_bool(simperf->get_table("assertion_types"), [&](const std::string &name, bool enabled) {
+    if (auto type = parse_assertion_type(name))
+      config.AssertionTypes.push_back({*type, enabled});
+  });
+  for_each_bool(simperf->get_table("log_sites"), [&](const std::string &glob, bool enabled) {
+    config.LogSitePatterns.push_back({glob, enabled});
+  });
+  for_each_bool(simperf->get_table("resource_usage"), [&](const std::string &tag, bool enabled) {
+    config.ResourceUsageTags.push_back({tag, enabled});
+  });
+
+  if (auto profiling = simperf->get_table("profiling")) {
+    if (auto sample_every = profiling->get_as<std::int64_t>("sample_every"))
+      config.SampleEvery = static_cast<std::uint32_t>(*sample_every > 1 ? *sample_every : 1);
+    if (auto budget = profiling->get_as<double>("governor_budget"))
+      config.GovernorBudget = *budget > 0.0 ? *budget : 0.0;
+  }
+
+  if (auto session = simperf->get_table("session")) {
+    SessionConfig session_config;
+    session_config.Enabled = session->get_as<bool>("enabled").value_or(true);
+    session_config.Name = session->get_as<std::string>("name").value_or(session_config.Name);
+    session_config.Path = session->get_as<std::string>("path").value_or(session_config.Path);
+    session_config.Format =
+        session->get_as<std::string>("format").value_or(session_config.Format);
+    session_config.FlushIntervalMs = session->get_as<std::int64_t>("flush_interval_ms")
+                                         .value_or(session_config.FlushIntervalMs);
+    session_config.FlushBytes =
+        session->get_as<std::int64_t>("flush_bytes").value_or(session_config.FlushBytes);
+    session_config.IoUring = session->get_as<bool>("io_uring").value_or(session_config.IoUring);
+    session_config.Capture =
+        session->get_as<std::string>("capture").value_or(session_config.Capture);
+    session_config.TailThresholdUs = session->get_as<std::int64_t>("tail_threshold_us")
+                                         .value_or(session_config.TailThresholdUs);
+    config.Session = session_config;
+  }
+
+  if (auto metrics = simperf->get_table("metrics")) {
+    MetricsConfig metrics_config;
+    metrics_config.Enabled = metrics->get_as<bool>("enabled").value_or(true);
+    metrics_config.Path = metrics->get_as<std::string>("path").value_or(metrics_config.Path);
+    metrics_config.IntervalMs =
+        metrics->get_as<std::int64_t>("interval_ms").value_or(metrics_config.IntervalMs);
+    config.Metrics = metrics_config;
+  }
+  return config;
+}
+#pragma endregion RuntimeConfig
+
+#pragma region ConfigWatcher
+// Watches one config file from a background thread and calls `on_change` with the re-parsed
+// config. On Linux the containing directory is watched with inotify so that editors which replace
+// the file by rename are picked up; elsewhere the modification time is polled.
+class ConfigWatcher {
+public:
+  using Callback = std::function<void(const RuntimeConfig &)>;
+
+  ConfigWatcher(const ConfigWatcher &) = delete;
+  ConfigWatcher(ConfigWatcher &&) = delete;
+
+  static ConfigWatcher &Get() {
+    static ConfigWatcher instance;
+    return instance;
+  }
+
+  // Returns once the file is being watched, so no change made after the call is missed.
+  void Start(const std::filesystem::path &path, Callback on_change) {
+    Stop();
+    std::lock_guard lock(m_Lock);
+    m_Path = std::filesystem::absolute(path);
+    m_OnChange = std::move(on_change);
+    m_StopRequested.store(false, std::memory_order_release);
+    std::promise<void> watching;
+    auto ready = watching.get_future();
+    m_Thread = std::make_unique<std::thread>([this, &watching] { Run(watching); });
+    ready.wait();
+  }
+
+  void Stop(void) {
+    std::lock_guard lock(m_Lock);
+    if (!m_Thread)
+      return;
+    m_StopRequested.store(true, std::memory_order_release);
+    m_Thread->join();
+    m_Thread.reset();
+  }
+
+  bool Running(void) {
+    std::lock_guard lock(m_Lock);
+    return m_Thread != nullptr;
+  }
+
+  // Parses and applies the file now; returns false and keeps the current settings on failure.
+  bool Reload(void) {
+    try {
+      m_OnChange(parse_runtime_config(m_Path.string()));
+      return true;
+    } catch (const std::exception &e) {
+      spdlog::default_logger_raw()->warn("simperf: ignoring config '{}': {}", m_Path.string(),
+                                         e.what());
+      return false;
+    }
+  }
+
+private:
+#if defined(__linux__)
+  ConfigWatcher() {
+    pthread_atfork(&ConfigWatcher::PrepareFork, &ConfigWatcher::AfterForkInParent,
+                   &ConfigWatcher::AfterForkInChild);
+  }
+#else
+  ConfigWatcher() = default;
+#endif
+
+  ~ConfigWatcher() { Stop(); }
+
+#if defined(__linux__)
+  // Holding m_Lock across fork() keeps the child from inheriting a watcher halfway through Start().
+  static void PrepareFork(void) { Get().m_Lock.lock(); }
+
+  static void AfterForkInParent(void) { Get().m_Lock.unlock(); }
+
+  // The watcher thread does not exist in the child, which is left stopped and closes its copy of
+  // the thread's inotify descriptor. Nothing here allocates or starts a thread.
+  static void AfterForkInChild(void) {
+    auto &watcher = Get();
+    (void)watcher.m_Thread.release(); // never joinable here, and destroying it would terminate()
+    int fd = watcher.m_WatchFd.exchange(-1, std::memory_order_relaxed);
+    if (fd >= 0)
+      close(fd);
+    watcher.m_Lock.unlock();
+  }
+#endif
+
+  static constexpr std::chrono::milliseconds POLL_INTERVAL{250};
+  // Editors often write a file in several steps; let them finish before re-reading it.
+  static constexpr std::chrono::milliseconds SETTLE_DELAY{50};
+
+#if defined(__linux__)
+  void Run(std::promise<void> &watching) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+      return RunPolling(watching);
+    auto directory = m_Path.parent_path().string();
+    int watch = inotify_add_watch(fd, directory.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+    if (watch < 0) {
+      close(fd);
+      return RunPolling(watching);
+    }
+    m_WatchFd.store(fd, std::memory_order_relaxed);
+    watching.set_value(); // Start() returns and `watching` goes away
+
+    auto file_name = m_Path.filename().string();
+    alignas(inotify_event) char buffer[4096];
+    while (!m_StopRequested.load(std::memory_order_acquire)) {
+      pollfd pfd{fd, POLLIN, 0};
+      if (poll(&pfd, 1, static_cast<int>(POLL_INTERVAL.count())) <= 0)
+        continue;
+
+      bool changed = false;
+      ssize_t length;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length;) {
+          auto *event = reinterpret_cast<inotify_event *>(cursor);
+          if (event->len > 0 && file_name == event->name)
+            changed = true;
+          cursor += sizeof(inotify_event) + event->len;
+        }
+      }
+      if (changed) {
+        std::this_thread::sleep_for(SETTLE_DELAY);
+        Reload();
+      }
+    }
+    m_WatchFd.store(-1, std::memory_order_relaxed);
+    inotify_rm_watch(fd, watch);
+    close(fd);
+  }
+#else
+  void Run(std::promise<void> &watching) { RunPolling(watching); }
+#endif
+
+  void RunPolling(std::promise<void> &watching) {
+    std::error_code ec;
+    auto last_write = std::filesystem::last_write_time(m_Path, ec);
+    watching.set_value(); // Start() returns and `watching` goes away
+    while (!m_StopRequested.load(std::memory_order_acquire)) {
+      std::this_thread::sleep_for(POLL_INTERVAL);
+      auto write_time = std::filesystem::last_write_time(m_Path, ec);
+      if (!ec && write_time != last_write) {
+        last_write = write_time;
+        std::this_thread::sleep_for(SETTLE_DELAY);
+        Reload();
+      }
+    }
+  }
+
+private:
+  std::mutex m_Lock;
+  std::unique_ptr<std::thread> m_Thread;
+  std::atomic_bool m_StopRequested{false};
+  std::atomic<int> m_WatchFd{-1}; // the watcher thread's inotify descriptor, for fork()
+  std::filesystem::path m_Path;
+  Callback m_OnChange;
+};
+#pragma endregion ConfigWatcher
+} // namespace simperf
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <string_view>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "scope-stack-impl.h"
+#include "trace-collector-impl.h"
+
+namespace simperf {
+#pragma region CrashHandler
+static constexpr std::size_t CRASH_MAX_SIGNALS = 8;
+
+// On a fatal signal, writes the SIMPERF scopes every thread is inside, and the trace events still
+// waiting in the per-thread rings, to a text file. It then puts back whatever handler was there
+// before and raises the signal again, so the process dies and dumps core as it would have.
+//
+// The handler only calls open, write, close, clock_gettime, sigaction and raise, and reads state
+// the instrumented threads keep signal-readable. Those threads keep running meanwhile, so their
+// stacks may be a scope or two off by the time they are written. Only the thread that called
+// Install() gets an alternate signal stack; a stack overflow on any other thread dies unreported.
+class CrashHandler {
+public:
+#if defined(__linux__)
+  static bool Install(const char *path,
+                      std::initializer_list<int> signals = {SIGSEGV, SIGBUS, SIGABRT}) {
+    auto size = std::strlen(path);
+    if (size == 0 || size >= sizeof(s_Path) || signals.size() > CRASH_MAX_SIGNALS)
+      return false;
+    std::lock_guard lock(s_Lock);
+    RestoreAll();
+    std::memcpy(s_Path, path, size + 1);
+
+    stack_t stack{};
+    stack.ss_sp = s_AltStack;
+    stack.ss_size = sizeof(s_AltStack);
+    ::sigaltstack(&stack, nullptr);
+
+    struct sigaction action{};
+    action.sa_sigaction = &CrashHandler::OnSignal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (int signal : signals) {
+      auto &slot = s_Signals[s_SignalCount];
+      if (::sigaction(signal, &action, &slot.Previous) != 0)
+        continue;
+      slot.Signal = signal;
+      ++s_SignalCount;
+    }
+    return s_SignalCount > 0;
+  }
+
+  static void Uninstall(void) {
+    std::lock_guard lock(s_Lock);
+    RestoreAll();
+  }
+
+  // What the handler writes, for `signal`, on the calling thread. Usable outside a handler too.
+  static void WriteDump(int fd, int signal) {
+    DumpWriter out(fd);
+    auto self = static_cast<std::uint64_t>(::syscall(SYS_gettid));
+    auto now = MonotonicNanoseconds();
+    out.Put("simperf crash dump\nsignal ");
+    out.PutInt(signal);
+    out.Put(" (");
+    out.Put(SignalName(signal));
+    out.Put(") in thread ");
+    out.PutInt(self);
+    out.Put(" at ");
+    out.PutInt(now);
+    out.Put(" ns\n");
+
+    ScopeStack::Threads().ForEach([&](const ScopeStack &stack) {
+      std::uint32_t depth = stack.Depth;
+      std::atomic_signal_fence(std::memory_order_acquire);
+      out.Put("thread ");
+      out.PutInt(stack.ThreadID);
+      out.Put(stack.ThreadID == self ? " (crashed): " : ": ");
+      out.PutInt(depth);
+      out.Put(" open scope(s)\n");
+      for (std::size_t i = 0; i < std::min<std::size_t>(depth, SCOPE_STACK_DEPTH); ++i) {
+        out.Put("  #");
+        out.PutInt(i);
+        out.Put(" ");
+        out.Put(stack.Names[i] ? stack.Names[i] : "?");
+        if (auto start = stack.StartNs[i]) {
+          out.Put(" entered ");
+          out.PutInt(start);
+          out.Put(" ns, ");
+          out.PutInt(now - start);
+          out.Put(" ns ago");
+        }
+        out.Put("\n");
+      }
+    });
+
+    trace::TraceCollector::ThreadRings().ForEach([&](const trace::TraceRing &ring) {
+      std::size_t pending = 0;
+      ring.Events.ForEachPending([&](const trace::TraceEvent &) { ++pending; });
+      if (pending == 0)
+        return;
+      out.Put("pending events of thread ");
+      out.PutInt(ring.ThreadID);
+      out.Put(": ");
+      out.PutInt(pending);
+      out.Put("\n");
+      ring.Events.ForEachPending([&](const trace::TraceEvent &event) {
+        out.Put("  ");
+        out.Put(EventPhase(event.Type));
+        out.Put(" ");
+        out.Put(std::string_view(event.Text, std::min<std::size_t>(event.NameSize,
+                                                                   trace::TRACE_TEXT_SIZE)));
+        out.Put(" ts=");
+        out.PutInt(event.StartNs);
+        if (event.Type == trace::TraceEventType::Complete) {
+          out.Put(" dur=");
+          out.PutInt(event.DurationNs);
+        }
+        out.Put("\n");
+      });
+    });
+    out.Flush();
+  }
+#else
+  static bool Install(const char *) { return false; }
+  static void Uninstall(void) {}
+#endif
+
+private:
+#if defined(__linux__)
+  // Buffered write(2) with hand-rolled integer formatting; printf is not async-signal-safe.
+  class DumpWriter {
+  public:
+    explicit DumpWriter(int fd) : m_Fd(fd) {}
+
+    void Put(std::string_view text) {
+      while (!text.empty()) {
+        if (m_Used == sizeof(m_Buffer))
+          Flush();
+        auto size = std::min(text.size(), sizeof(m_Buffer) - m_Used);
+        std::memcpy(m_Buffer + m_Used, text.data(), size);
+        m_Used += size;
+        text.remove_prefix(size);
+      }
+    }
+
+    template <typename T> void PutInt(T value) {
+      char digits[24];
+      char *at = digits + sizeof(digits);
+      bool negative = value < 0;
+      auto magnitude = negative ? 0 - static_cast<std::uint64_t>(value)
+                                : static_cast<std::uint64_t>(value);
+      do {
+        *--at = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+      } while (magnitude != 0);
+      if (negative)
+        *--at = '-';
+      Put(std::string_view(at, static_cast<std::size_t>(digits + sizeof(digits) - at)));
+    }
+
+    void Flush(void) {
+      std::size_t written = 0;
+      while (written < m_Used) {
+        auto result = ::write(m_Fd, m_Buffer + written, m_Used - written);
+        if (result <= 0)
+          break;
+        written += static_cast<std::size_t>(result);
+      }
+      m_Used = 0;
+    }
+
+  private:
+    int m_Fd;
+    char m_Buffer[1024];
+    std::size_t m_Used = 0;
+  };
+
+  struct InstalledSignal {
+    int Signal;
+    struct sigaction Previous;
+  };
+
+  static void OnSignal(int signal, siginfo_t *, void *) {
+    int saved_errno = errno;
+    if (!s_Handling.test_and_set()) {
+      int fd = ::open(s_Path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (fd >= 0) {
+        WriteDump(fd, signal);
+        ::close(fd);
+      }
+    }
+    for (std::size_t i = 0; i < s_SignalCount; ++i) {
+      if (s_Signals[i].Signal == signal)
+        ::sigaction(signal, &s_Signals[i].Previous, nullptr);
+    }
+    errno = saved_errno;
+    // Pending until the handler returns, then delivered to the handler just put back.
+    ::raise(signal);
+  }
+
+  // Note: you must already own s_Lock before calling RestoreAll()
+  static void RestoreAll(void) {
+    for (std::size_t i = 0; i < s_SignalCount; ++i)
+      ::sigaction(s_Signals[i].Signal, &s_Signals[i].Previous, nullptr);
+    s_SignalCount = 0;
+  }
+
+  static std::int64_t MonotonicNanoseconds(void) {
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::int64_t>(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+  }
+
+  static std::string_view SignalName(int signal) {
+    switch (signal) {
+    case SIGSEGV:
+      return "SIGSEGV";
+    case SIGBUS:
+      return "SIGBUS";
+    case SIGABRT:
+      return "SIGABRT";
+    case SIGFPE:
+      return "SIGFPE";
+    case SIGILL:
+      return "SIGILL";
+    default:
+      return "signal";
+    }
+  }
+
+  static std::string_view EventPhase(trace::TraceEventType type) {
+    switch (type) {
+    case trace::TraceEventType::Complete:
+      return "X";
+    case trace::TraceEventType::Begin:
+      return "B";
+    case trace::TraceEventType::End:
+      return "E";
+    case trace::TraceEventType::Instant:
+      return "i";
+    case trace::TraceEventType::Counter:
+      return "C";
+    }
+    return "?";
+  }
+
+  inline static std::mutex s_Lock;
+  inline static char s_Path[4096];
+  inline static char s_AltStack[64 << 10];
+  inline static InstalledSignal s_Signals[CRASH_MAX_SIGNALS];
+  inline static std::size_t s_SignalCount = 0;
+  inline static std::atomic_flag s_Handling;
+#endif
+};
+#pragma endregion CrashHandler
+} // namespace simperf
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// `decomposer <= a == b` is intentional; silence the "suggest parentheses" family of warnings.
+#if defined(__GNUC__)
+#define SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_BEGIN                                                \
+  _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wparentheses\"")
+#define SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_END _Pragma("GCC diagnostic pop")
+#else
+#define SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_BEGIN
+#define SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_END
+#endif
+
+namespace simperf {
+#pragma region ExpressionDecomposition
+// Operand spellings of a stringified check, split at compile time at the first top-level
+// comparison, logical or bitwise operator (the same point at which ExpressionDecomposer splits).
+struct ExpressionOperands {
+  std::string_view Lhs;
+  std::string_view Op;
+  std::string_view Rhs;
+};
+
+namespace expression {
+constexpr std::string_view Trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t' || text.front() == '\n'))
+    text.remove_prefix(1);
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\n'))
+    text.remove_suffix(1);
+  return text;
+}
+
+constexpr bool IsOperandEnd(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+         c == ')' || c == ']' || c == '\'' || c == '"';
+}
+
+constexpr std::size_t LastNonSpace(std::string_view text, std::size_t before) {
+  while (before > 0 && text[before - 1] == ' ')
+    --before;
+  return before;
+}
+} // namespace expression
+
+constexpr ExpressionOperands SplitExpression(std::string_view expr) {
+  constexpr std::string_view operators[] = {"==", "!=", "<=", ">=", "&&", "||",
+                                            "<",  ">",  "&",  "|",  "^"};
+  int depth = 0;
+  char quote = 0;
+  for (std::size_t i = 0; i < expr.size(); ++i) {
+    char c = expr[i];
+    if (quote) {
+      if (c == '\\')
+        ++i;
+      else if (c == quote)
+        quote = 0;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      quote = c;
+      continue;
+    }
+    if (c == '(' || c == '[' || c == '{')
+      ++depth;
+    else if (c == ')' || c == ']' || c == '}')
+      --depth;
+    if (depth != 0)
+      continue;
+
+    std::string_view rest = expr.substr(i);
+    // Not splitting points: member access, shifts and the spaceship operator.
+    if (rest.starts_with("->") || rest.starts_with("<<") || rest.starts_with(">>") ||
+        rest.starts_with("<=>")) {
+      i += rest.starts_with("<=>") ? 2 : 1;
+      continue;
+    }
+    for (std::string_view op : operators) {
+      if (!rest.starts_with(op))
+        continue;
+      // A leading '&' (address-of) or '-' etc. is unary when nothing precedes it.
+      std::size_t end = expression::LastNonSpace(expr, i);
+      if (end == 0 || !expression::IsOperandEnd(expr[end - 1]))
+        break;
+      return {expression::Trim(expr.substr(0, i)), op,
+              expression::Trim(expr.substr(i + op.size()))};
+    }
+  }
+  return {expression::Trim(expr), {}, {}};
+}
+
+namespace expression {
+template <typename T, typename = void> struct IsStreamable : std::false_type {};
+
+template <typename T>
+struct IsStreamable<T, std::void_t<decltype(std::declval<std::ostream &>() << std::declval<T>())>>
+    : std::true_type {};
+
+template <typename> inline constexpr bool DependentFalse = false;
+
+template <typename T> void Describe(std::ostream &os, const T &value) {
+  if constexpr (std::is_same_v<T, bool>)
+    os << (value ? "true" : "false");
+  else if constexpr (IsStreamable<const T &>::value)
+    os << value;
+  else
+    os << "{?}";
+}
+} // namespace expression
+
+// Operators the decomposer cannot capture fail with a message saying how to rewrite the check,
+// instead of a wall of overload candidates; returning *this keeps that the only error.
+#define SIMPERF_EXPRESSION_REJECTED_OP(op, message)                                                \
+  template <typename T> auto operator op(const T &) const {                                        \
+    static_assert(expression::DependentFalse<T>, message);                                         \
+    return *this;                                                                                  \
+  }
+
+template <typename L, typename R> class BinaryExpression {
+public:
+  BinaryExpression(bool result, const L &lhs, std::string_view op, const R &rhs)
+      : m_Result(result), m_Lhs(lhs), m_Op(op), m_Rhs(rhs) {}
+
+  // `a == b & c` parses as `(a == b) & c`; only one operator can be captured.
+#define SIMPERF_EXPRESSION_SECOND_OP(op)                                                           \
+  SIMPERF_EXPRESSION_REJECTED_OP(op, "SIMPERF_ASSERT_WARGS captures a single operator; "          \
+                                     "parenthesise the rest of the check, e.g. "                   \
+                                     "SIMPERF_ASSERT_WARGS(a == (b & c)) or ((a == b) && c)")
+  SIMPERF_EXPRESSION_SECOND_OP(==)
+  SIMPERF_EXPRESSION_SECOND_OP(!=)
+  SIMPERF_EXPRESSION_SECOND_OP(<)
+  SIMPERF_EXPRESSION_SECOND_OP(<=)
+  SIMPERF_EXPRESSION_SECOND_OP(>)
+  SIMPERF_EXPRESSION_SECOND_OP(>=)
+  SIMPERF_EXPRESSION_SECOND_OP(&)
+  SIMPERF_EXPRESSION_SECOND_OP(|)
+  SIMPERF_EXPRESSION_SECOND_OP(^)
+  SIMPERF_EXPRESSION_SECOND_OP(&&)
+  SIMPERF_EXPRESSION_SECOND_OP(||)
+#undef SIMPERF_EXPRESSION_SECOND_OP
+
+  bool Result(void) const { return m_Result; }
+
+  std::string Describe(const ExpressionOperands &operands) const {
+    std::ostringstream os;
+    os << operands.Lhs << ": ";
+    expression::Describe(os, m_Lhs);
+    os << '\n' << (operands.Rhs.empty() ? std::string_view("rhs") : operands.Rhs) << ": ";
+    expression::Describe(os, m_Rhs);
+    return os.str();
+  }
+
+private:
+  bool m_Result;
+  const L &m_Lhs;
+  std::string_view m_Op;
+  const R &m_Rhs;
+};
+
+template <typename L> class UnaryExpression {
+public:
+  explicit UnaryExpression(const L &lhs) : m_Lhs(lhs) {}
+
+  bool Result(void) const { return static_cast<bool>(m_Lhs); }
+
+  std::string Describe(const ExpressionOperands &operands) const {
+    std::ostringstream os;
+    os << operands.Lhs << ": ";
+    expression::Describe(os, m_Lhs);
+    return os.str();
+  }
+
+  // Each operator captures the right-hand operand by reference and evaluates once.
+#define SIMPERF_EXPRESSION_BINARY_OP(op)                                                           \
+  template <typename R> auto operator op(const R &rhs) const {                                     \
+    return BinaryExpression<L, R>(static_cast<bool>(m_Lhs op rhs), m_Lhs, #op, rhs);               \
+  }
+  SIMPERF_EXPRESSION_BINARY_OP(==)
+  SIMPERF_EXPRESSION_BINARY_OP(!=)
+  SIMPERF_EXPRESSION_BINARY_OP(<)
+  SIMPERF_EXPRESSION_BINARY_OP(<=)
+  SIMPERF_EXPRESSION_BINARY_OP(>)
+  SIMPERF_EXPRESSION_BINARY_OP(>=)
+  SIMPERF_EXPRESSION_BINARY_OP(&)
+  SIMPERF_EXPRESSION_BINARY_OP(|)
+  SIMPERF_EXPRESSION_BINARY_OP(^)
+#undef SIMPERF_EXPRESSION_BINARY_OP
+
+  // Capturing these would lose short-circuit evaluation.
+  SIMPERF_EXPRESSION_REJECTED_OP(&&, "SIMPERF_ASSERT_WARGS cannot capture '&&' without losing "
+                                     "short-circuit evaluation; parenthesise the whole check, "
+                                     "e.g. SIMPERF_ASSERT_WARGS((a && b))")
+  SIMPERF_EXPRESSION_REJECTED_OP(||, "SIMPERF_ASSERT_WARGS cannot capture '||' without losing "
+                                     "short-circuit evaluation; parenthesise the whole check, "
+                                     "e.g. SIMPERF_ASSERT_WARGS((a || b))")
+
+private:
+  const L &m_Lhs;
+};
+
+#undef SIMPERF_EXPRESSION_REJECTED_OP
+
+// `ExpressionDecomposer{} <= a == b` parses as `(ExpressionDecomposer{} <= a) == b`, capturing
+// both operands without re-evaluating or re-parsing anything at runtime.
+struct ExpressionDecomposer {
+  template <typename L> UnaryExpression<L> operator<=(const L &lhs) const {
+    return UnaryExpression<L>(lhs);
+  }
+};
+#pragma endregion ExpressionDecomposition
+} // namespace simperf
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "trace-event-impl.h"
+
+namespace simperf {
+#pragma region FrameSeries
+struct FrameOptions {
+  std::size_t WorstFrames = 8;
+  std::size_t MaxEventsPerFrame = 4096; // later events still count towards SiteTimes
+  // Only frames that enter the running worst-N are written to the trace session; the rest only
+  // contribute to the stats.
+  bool RetainOnly = false;
+};
+
+using FrameSiteTimes = std::vector<std::pair<std::string, std::chrono::nanoseconds>>;
+
+// One complete iteration, kept with its events while it is among the worst.
+struct FrameRecord {
+  std::uint64_t Index;
+  std::int64_t StartNs; // steady_clock
+  std::chrono::nanoseconds Duration;
+  FrameSiteTimes SiteTimes; // inclusive time per scope name, nested scopes count twice
+  std::vector<trace::TraceEvent> Events;
+};
+
+struct FrameSeriesStats {
+  std::string_view Name;
+  std::uint64_t Frames;
+  std::chrono::nanoseconds TotalTime;
+  std::chrono::nanoseconds MinTime;
+  std::chrono::nanoseconds MaxTime;
+  std::chrono::nanoseconds LastTime;
+  FrameSiteTimes SiteTimes; // summed over every frame
+};
+
+class FrameSeries;
+
+// The frame the calling thread is in, filled in by Instrumentor::WriteComplete between two marks.
+struct FrameThread {
+  FrameSeries *Series = nullptr;
+  std::uint64_t Index = 0;
+  std::int64_t StartNs = 0;
+  FrameOptions Options; // the series' options as of the frame's start
+  std::vector<trace::TraceEvent> Events;
+  std::map<std::string, std::chrono::nanoseconds, std::less<>> SiteTimes;
+
+  static FrameThread &Local(void) {
+    thread_local FrameThread state;
+    return state;
+  }
+
+  // nullptr outside of a frame. A plain pointer so the check needs no thread_local guard.
+  static FrameThread *Current(void) { return tl_Current; }
+
+  static void SetCurrent(FrameThread *state) { tl_Current = state; }
+
+  void AddSiteTime(std::string_view name, std::chrono::nanoseconds duration) {
+    auto it = SiteTimes.find(name);
+    if (it == SiteTimes.end())
+      SiteTimes.emplace(std::string(name), duration);
+    else
+      it->second += duration;
+  }
+
+private:
+  inline static thread_local FrameThread *tl_Current = nullptr;
+};
+
+class FrameSeries {
+public:
+  explicit FrameSeries(std::string name) : m_Name(std::move(name)) {}
+
+  FrameSeries(const FrameSeries &) = delete;
+  FrameSeries &operator=(const FrameSeries &) = delete;
+
+  const std::string &Name(void) const { return m_Name; }
+
+  void SetOptions(const FrameOptions &options) {
+    std::lock_guard lock(m_Lock);
+    m_Options = options;
+    TrimWorst();
+  }
+
+  FrameOptions Options(void) {
+    std::lock_guard lock(m_Lock);
+    return m_Options;
+  }
+
+  // Folds the thread's finished frame into the stats. Returns true when it entered the worst-N,
+  // in which case its events were copied into the kept record.
+  bool Complete(const FrameThread &state, std::chrono::nanoseconds duration) {
+    std::lock_guard lock(m_Lock);
+    ++m_Frames;
+    m_TotalTime += duration;
+    m_MinTime = m_Frames == 1 ? duration : std::min(m_MinTime, duration);
+    m_MaxTime = std::max(m_MaxTime, duration);
+    m_LastTime = duration;
+    for (const auto &[name, time] : state.SiteTimes)
+      m_SiteTimes[name] += time;
+
+    if (m_Options.WorstFrames == 0)
+      return false;
+    if (m_Worst.size() == m_Options.WorstFrames && duration <= m_Worst.front().Duration)
+      return false;
+
+    m_Worst.push_back({state.Index, state.StartNs, duration,
+                       FrameSiteTimes(state.SiteTimes.begin(), state.SiteTimes.end()),
+                       state.Events});
+    std::push_heap(m_Worst.begin(), m_Worst.end(), ShorterFirst);
+    TrimWorst();
+    return true;
+  }
+
+  FrameSeriesStats Stats(void) {
+    std::lock_guard lock(m_Lock);
+    return {m_Name,
+            m_Frames,
+            m_TotalTime,
+            m_MinTime,
+            m_MaxTime,
+            m_LastTime,
+            FrameSiteTimes(m_SiteTimes.begin(), m_SiteTimes.end())};
+  }
+
+  // Slowest first.
+  std::vector<FrameRecord> WorstFrames(void) {
+    std::lock_guard lock(m_Lock);
+    std::vector<FrameRecord> worst = m_Worst;
+    std::sort(worst.begin(), worst.end(),
+              [](const FrameRecord &a, const FrameRecord &b) { return a.Duration > b.Duration; });
+    return worst;
+  }
+
+private:
+  // A min-heap on duration, so the least bad of the kept frames is evicted first.
+  static bool ShorterFirst(const FrameRecord &a, const FrameRecord &b) {
+    return a.Duration > b.Duration;
+  }
+
+  void TrimWorst(void) {
+    while (m_Worst.size() > m_Options.WorstFrames) {
+      std::pop_heap(m_Worst.begin(), m_Worst.end(), ShorterFirst);
+      m_Worst.pop_back();
+    }
+  }
+
+private:
+  const std::string m_Name;
+  std::mutex m_Lock;
+  FrameOptions m_Options;
+  std::uint64_t m_Frames = 0;
+  std::chrono::nanoseconds m_TotalTime{0};
+  std::chrono::nanoseconds m_MinTime{0};
+  std::chrono::nanoseconds m_MaxTime{0};
+  std::chrono::nanoseconds m_LastTime{0};
+  std::map<std::string, std::chrono::nanoseconds, std::less<>> m_SiteTimes;
+  std::vector<FrameRecord> m_Worst;
+};
+
+class FrameRegistry {
+public:
+  static FrameSeries &Get(std::string_view name) {
+    std::lock_guard lock(s_Lock);
+    for (const auto &series : s_Series) {
+      if (series->Name() == name)
+        return *series;
+    }
+    return *s_Series.emplace_back(std::make_unique<FrameSeries>(std::string(name)));
+  }
+
+  static std::vector<FrameSeriesStats> Stats(void) {
+    std::lock_guard lock(s_Lock);
+    std::vector<FrameSeriesStats> stats;
+    stats.reserve(s_Series.size());
+    for (const auto &series : s_Series)
+      stats.push_back(series->Stats());
+    return stats;
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<std::unique_ptr<FrameSeries>> s_Series;
+};
+#pragma endregion FrameSeries
+} // namespace simperf
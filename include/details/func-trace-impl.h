@@ -0,0 +1,245 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#if defined(__linux__)
+#include <link.h>
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#define SIMPERF_NO_INSTRUMENT
+#else
+#define SIMPERF_NO_INSTRUMENT __attribute__((no_instrument_function))
+#endif
+
+namespace simperf {
+#pragma region FunctionTracer
+static constexpr std::size_t FUNCTION_STACK_DEPTH = 256;
+static constexpr std::size_t FUNCTION_MAX_RANGES = 16;
+
+// [Low, High)
+struct AddressRange {
+  std::uintptr_t Low;
+  std::uintptr_t High;
+
+  SIMPERF_NO_INSTRUMENT bool Contains(std::uintptr_t address) const {
+    return address >= Low && address < High;
+  }
+};
+
+// What the -finstrument-functions hooks keep. With no include ranges every function is a candidate;
+// exclude ranges win over include ranges.
+struct FunctionTraceOptions {
+  std::chrono::nanoseconds MinDuration{std::chrono::microseconds(1)};
+  AddressRange Include[FUNCTION_MAX_RANGES]{};
+  AddressRange Exclude[FUNCTION_MAX_RANGES]{};
+  std::uint8_t IncludeCount = 0;
+  std::uint8_t ExcludeCount = 0;
+
+  bool IncludeRange(AddressRange range) {
+    if (IncludeCount == FUNCTION_MAX_RANGES)
+      return false;
+    Include[IncludeCount++] = range;
+    return true;
+  }
+
+  bool ExcludeRange(AddressRange range) {
+    if (ExcludeCount == FUNCTION_MAX_RANGES)
+      return false;
+    Exclude[ExcludeCount++] = range;
+    return true;
+  }
+
+  // The executable segments of every loaded module whose path contains `module`; "" is the main
+  // executable. Returns false when nothing matched.
+  bool IncludeModule(std::string_view module) { return ForModule(module, Include, IncludeCount); }
+  bool ExcludeModule(std::string_view module) { return ForModule(module, Exclude, ExcludeCount); }
+
+  SIMPERF_NO_INSTRUMENT bool Selects(std::uintptr_t address) const {
+    for (std::uint8_t i = 0; i < ExcludeCount; ++i) {
+      if (Exclude[i].Contains(address))
+        return false;
+    }
+    if (IncludeCount == 0)
+      return true;
+    for (std::uint8_t i = 0; i < IncludeCount; ++i) {
+      if (Include[i].Contains(address))
+        return true;
+    }
+    return false;
+  }
+
+private:
+  static bool ForModule(std::string_view module, AddressRange (&ranges)[FUNCTION_MAX_RANGES],
+                        std::uint8_t &count) {
+#if defined(__linux__)
+    struct Search {
+      std::string_view Module;
+      AddressRange *Ranges;
+      std::uint8_t *Count;
+      bool Found;
+    } search{module, ranges, &count, false};
+    ::dl_iterate_phdr(
+        [](dl_phdr_info *info, std::size_t, void *data) {
+          auto &search = *static_cast<Search *>(data);
+          std::string_view path = info->dlpi_name ? info->dlpi_name : "";
+          bool main_executable = path.empty();
+          if (search.Module.empty() ? !main_executable
+                                    : path.find(search.Module) == std::string_view::npos)
+            return 0;
+          for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i) {
+            const auto &segment = info->dlpi_phdr[i];
+            if (segment.p_type != PT_LOAD || !(segment.p_flags & PF_X))
+              continue;
+            if (*search.Count == FUNCTION_MAX_RANGES)
+              return 1;
+            auto low = static_cast<std::uintptr_t>(info->dlpi_addr + segment.p_vaddr);
+            search.Ranges[(*search.Count)++] = {low, low + segment.p_memsz};
+            search.Found = true;
+          }
+          return 0;
+        },
+        &search);
+    return search.Found;
+#else
+    (void)module;
+    (void)ranges;
+    (void)count;
+    return false;
+#endif
+  }
+};
+
+// A function the hooks decided to keep; its name is its address until simperf-symbolize runs.
+struct FunctionCall {
+  std::uintptr_t Function;
+  std::uintptr_t CallSite;
+  std::int64_t StartNs; // steady_clock
+  std::int64_t DurationNs;
+};
+
+// Backs __cyg_profile_func_enter/exit. Entries go onto a fixed per-thread stack; only a call that
+// is selected by address and outlives MinDuration is reported at its exit, so short calls cost
+// two clock reads and filtered ones none. The thread is marked busy while a hook runs, so code it
+// reaches that was itself built with instrumentation (inlined library templates, say) returns
+// from the nested hook straight away.
+class FunctionTracer {
+public:
+  // Note: Configure() must not race with instrumented code; call it before Enable().
+  static void Configure(const FunctionTraceOptions &options) { s_Options = options; }
+
+  static const FunctionTraceOptions &Options(void) { return s_Options; }
+
+  static void Enable(void) { s_Enabled.store(true, std::memory_order_release); }
+  static void Disable(void) { s_Enabled.store(false, std::memory_order_release); }
+
+  SIMPERF_NO_INSTRUMENT static bool Enabled(void) {
+    return s_Enabled.load(std::memory_order_acquire);
+  }
+
+  SIMPERF_NO_INSTRUMENT static void Enter(void *function, void *call_site) {
+    Thread &thread = tl_Thread;
+    if (thread.Busy)
+      return;
+    thread.Busy = true;
+    if (Enabled()) {
+      std::uint32_t depth = thread.Depth++;
+      if (depth < FUNCTION_STACK_DEPTH) {
+        auto address = reinterpret_cast<std::uintptr_t>(function);
+        Entry &entry = thread.Stack[depth];
+        entry.Function = address;
+        entry.CallSite = reinterpret_cast<std::uintptr_t>(call_site);
+        entry.StartNs = s_Options.Selects(address) ? Now() : -1;
+      }
+    }
+    thread.Busy = false;
+  }
+
+  // True when the call should be reported; `call` is filled in and the calling thread is marked
+  // busy until EndReport(), so instrumented code run while reporting is not traced.
+  SIMPERF_NO_INSTRUMENT static bool Exit(void *function, FunctionCall &call) {
+    Thread &thread = tl_Thread;
+    if (thread.Busy || thread.Depth == 0)
+      return false;
+    thread.Busy = true;
+    std::uint32_t depth = --thread.Depth;
+    // An entry from before Enable() or a longjmp leaves the stack out of step; drop the call.
+    if (depth < FUNCTION_STACK_DEPTH) {
+      const Entry &entry = thread.Stack[depth];
+      if (entry.Function == reinterpret_cast<std::uintptr_t>(function) && entry.StartNs >= 0) {
+        auto duration = Now() - entry.StartNs;
+        if (duration >= s_Options.MinDuration.count() && Enabled()) {
+          call = {entry.Function, entry.CallSite, entry.StartNs, duration};
+          return true;
+        }
+      }
+    }
+    thread.Busy = false;
+    return false;
+  }
+
+  SIMPERF_NO_INSTRUMENT static void EndReport(void) { tl_Thread.Busy = false; }
+
+  // Copies /proc/self/maps next to the session's output, so simperf-symbolize can map addresses
+  // back to modules after this process is gone.
+  static bool SnapshotMaps(const std::filesystem::path &path) {
+#if defined(__linux__)
+    std::ifstream maps("/proc/self/maps", std::ios::binary);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!maps || !out)
+      return false;
+    out << maps.rdbuf();
+    return static_cast<bool>(out);
+#else
+    (void)path;
+    return false;
+#endif
+  }
+
+  static std::filesystem::path MapsPath(const std::filesystem::path &session_path) {
+    auto path = session_path;
+    path += ".maps";
+    return path;
+  }
+
+private:
+  struct Entry {
+    std::uintptr_t Function;
+    std::uintptr_t CallSite;
+    std::int64_t StartNs; // -1 when filtered out by address
+  };
+
+  struct Thread {
+    Entry Stack[FUNCTION_STACK_DEPTH];
+    std::uint32_t Depth;
+    bool Busy;
+  };
+
+  SIMPERF_NO_INSTRUMENT static std::int64_t Now(void) {
+#if defined(__linux__)
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<std::int64_t>(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  inline static std::atomic_bool s_Enabled{false};
+  inline static FunctionTraceOptions s_Options{};
+  static thread_local Thread tl_Thread;
+};
+
+inline thread_local FunctionTracer::Thread FunctionTracer::tl_Thread{};
+#pragma endregion FunctionTracer
+} // namespace simperf
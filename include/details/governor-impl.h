@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <source_location>
+#include <string_view>
+#include <vector>
+
+#include "latency-histogram-impl.h"
+#include "logger-registry-impl.h"
+#include "tail-latency-impl.h"
+
+namespace simperf {
+#pragma region Governor
+struct GovernorOptions {
+  bool Enabled = true;
+  double Budget = 0.01; // share of one core a single site's instrumentation may cost
+  // What one timed scope costs: two clock reads plus capturing the event.
+  std::chrono::nanoseconds CostPerCall{60};
+  std::chrono::nanoseconds EvaluateEvery{std::chrono::milliseconds(100)};
+  std::uint32_t MaxSampleEvery = 1024; // past this a site only counts its calls
+};
+
+// Per thread and per site, flushed into the site every GOVERNOR_TALLY_FLUSH calls so hot scopes
+// on many threads do not all write one cache line. Trivially constructible, so the thread_local
+// needs no guard.
+struct GovernorTally {
+  std::uint32_t Calls;
+  std::uint32_t Timed;
+  std::uint32_t FastDropped; // timed, but under the tail latency threshold
+  std::int64_t TimedNs;
+  std::uint64_t Seen; // drives 1 in N sampling
+};
+
+static constexpr std::uint32_t GOVERNOR_TALLY_FLUSH = 1024;
+
+struct GovernedSiteStats {
+  std::string_view Name;
+  std::string_view File;
+  std::uint32_t Line;
+  std::uint64_t Calls;          // flushed calls only; threads keep up to 1023 each
+  double CallsPerSecond;        // over the last evaluation
+  std::chrono::nanoseconds MeanDuration;
+  double OverheadShare;         // what timing every call would cost, in cores
+  std::uint32_t SampleEvery;    // 1 timed in full, 0 count-only
+  std::uint64_t Demotions;
+  std::uint64_t FastDropped;    // left out of the trace by TailLatency
+};
+
+class GovernedSite;
+
+class Governor {
+public:
+  static void SetOptions(const GovernorOptions &options) {
+    std::lock_guard lock(s_Lock);
+    s_Options = options;
+    s_Enabled.store(options.Enabled, std::memory_order_relaxed);
+  }
+
+  static GovernorOptions Options(void) {
+    std::lock_guard lock(s_Lock);
+    return s_Options;
+  }
+
+  static bool Enabled(void) { return s_Enabled.load(std::memory_order_relaxed); }
+
+  static void Register(GovernedSite &site) {
+    std::lock_guard lock(s_Lock);
+    s_Sites.push_back(&site);
+  }
+
+  // What is throttled right now, and what was before.
+  static std::vector<GovernedSiteStats> Report(void);
+
+  static std::vector<GovernedSite *> Sites(void) {
+    std::lock_guard lock(s_Lock);
+    return s_Sites;
+  }
+
+  // Sites are static and never unregister, so `fn` runs without s_Lock held and may lock them.
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    for (GovernedSite *site : Sites())
+      fn(*site);
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<GovernedSite *> s_Sites;
+  inline static GovernorOptions s_Options;
+  inline static std::atomic_bool s_Enabled{true};
+};
+
+// One static GovernedSite per SIMPERF_PROFILE_SCOPE expansion. Every call is counted; whether it
+// is also timed and traced depends on the site's SampleEvery, which the governor lowers for sites
+// whose instrumentation would cost more than its budget and raises again when they cool down.
+class GovernedSite {
+public:
+  explicit GovernedSite(const char *name,
+                        std::source_location location = std::source_location::current())
+      : m_Name(name), m_Location(location) {
+    Governor::Register(*this);
+  }
+
+  GovernedSite(const GovernedSite &) = delete;
+  GovernedSite &operator=(const GovernedSite &) = delete;
+
+  const char *Name(void) const { return m_Name; }
+  const std::source_location &Location(void) const { return m_Location; }
+
+  // Hot path: whether this call is timed.
+  bool Admit(GovernorTally &tally) {
+    if (++tally.Calls >= GOVERNOR_TALLY_FLUSH) [[unlikely]]
+      Flush(tally);
+    auto every = m_SampleEvery.load(std::memory_order_relaxed);
+    if (every == 1) [[likely]]
+      return true;
+    return every != 0 && ++tally.Seen % every == 0;
+  }
+
+  static void AddTimed(GovernorTally &tally, std::int64_t duration_ns) {
+    ++tally.Timed;
+    tally.TimedNs += duration_ns;
+  }
+
+  static void AddFastDropped(GovernorTally &tally) { ++tally.FastDropped; }
+
+  // Timed calls go into the site's histogram only while an exporter reads it; see
+  // MetricsExporter. Otherwise the shared counters would be written on every call for nothing.
+  static bool LatencyRecording(void) { return s_LatencyRecording.load(std::memory_order_relaxed); }
+  static void SetLatencyRecording(bool enabled) {
+    s_LatencyRecording.store(enabled, std::memory_order_relaxed);
+  }
+
+  void RecordLatency(std::int64_t duration_ns) { m_Latency.Record(duration_ns); }
+
+  LatencyHistogram::Snapshot Latency(void) const { return m_Latency.Take(); }
+
+  std::uint32_t SampleEvery(void) const { return m_SampleEvery.load(std::memory_order_relaxed); }
+
+  // TailLatency::ThresholdFor() this site, looked up again only when the options change.
+  std::int64_t TailThresholdNs(void) {
+    auto generation = TailLatency::Generation();
+    if (m_TailGeneration.load(std::memory_order_acquire) != generation) [[unlikely]] {
+      m_TailThresholdNs.store(TailLatency::ThresholdFor(m_Name), std::memory_order_relaxed);
+      m_TailGeneration.store(generation, std::memory_order_release);
+    }
+    return m_TailThresholdNs.load(std::memory_order_relaxed);
+  }
+
+  GovernedSiteStats Stats(void) {
+    std::lock_guard lock(m_Lock);
+    return {m_Name,
+            m_Location.file_name(),
+            m_Location.line(),
+            m_Calls,
+            m_CallsPerSecond,
+            std::chrono::nanoseconds(static_cast<std::int64_t>(m_MeanNs)),
+            m_OverheadShare,
+            m_SampleEvery.load(std::memory_order_relaxed),
+            m_Demotions,
+            m_FastDropped};
+  }
+
+private:
+  SIMPERF_NOINLINE void Flush(GovernorTally &tally) {
+    auto now = std::chrono::steady_clock::now();
+    // Read before m_Lock, so no thread waits for s_Lock while it holds a site.
+    auto options = Governor::Options();
+    std::lock_guard lock(m_Lock);
+    m_Calls += tally.Calls;
+    m_WindowTimed += tally.Timed;
+    m_WindowTimedNs += tally.TimedNs;
+    m_FastDropped += tally.FastDropped;
+    tally.Calls = 0;
+    tally.Timed = 0;
+    tally.TimedNs = 0;
+    tally.FastDropped = 0;
+
+    if (m_WindowStart == std::chrono::steady_clock::time_point{}) {
+      m_WindowStart = now;
+      m_WindowCalls = m_Calls;
+      return;
+    }
+    auto elapsed = now - m_WindowStart;
+    if (elapsed < options.EvaluateEvery)
+      return;
+    Evaluate(options, std::chrono::duration<double>(elapsed).count());
+    m_WindowStart = now;
+    m_WindowCalls = m_Calls;
+    m_WindowTimed = 0;
+    m_WindowTimedNs = 0;
+  }
+
+  // Note: you must already own m_Lock before calling Evaluate()
+  void Evaluate(const GovernorOptions &options, double seconds) {
+    m_CallsPerSecond = static_cast<double>(m_Calls - m_WindowCalls) / seconds;
+    if (m_WindowTimed > 0) // count-only windows keep the last known mean
+      m_MeanNs = static_cast<double>(m_WindowTimedNs) / static_cast<double>(m_WindowTimed);
+    auto cost = static_cast<double>(options.CostPerCall.count());
+    m_OverheadShare = m_CallsPerSecond * cost * 1e-9;
+
+    // Frequent scopes that do real work keep their events; it is tiny and hot ones whose timing
+    // would mostly measure the profiler.
+    std::uint32_t every = 1;
+    if (Governor::Enabled() && options.Budget > 0.0 && m_OverheadShare > options.Budget &&
+        cost > options.Budget * m_MeanNs) {
+      auto needed = std::ceil(m_OverheadShare / options.Budget);
+      every = 1;
+      while (every < needed && every <= options.MaxSampleEvery)
+        every <<= 1;
+      if (every > options.MaxSampleEvery)
+        every = 0;
+    }
+
+    auto previous = m_SampleEvery.exchange(every, std::memory_order_relaxed);
+    if (previous == every)
+      return;
+    bool demoted = previous == 1 || (every == 0) || (previous != 0 && every > previous);
+    if (demoted)
+      ++m_Demotions;
+    if (spdlog::logger *logger = LoggerRegistry::Resolve("simperf")) {
+      if (every == 1)
+        logger->info("simperf governor: '{}' ({}:{}) back to full timing at {:.0f} calls/s",
+                     m_Name, m_Location.file_name(), m_Location.line(), m_CallsPerSecond);
+      else
+        logger->warn("simperf governor: throttling '{}' ({}:{}): {:.0f} calls/s, mean {:.0f} ns, "
+                     "timing all would cost ~{:.1f}% of a core; {}",
+                     m_Name, m_Location.file_name(), m_Location.line(), m_CallsPerSecond,
+                     m_MeanNs, m_OverheadShare * 100.0,
+                     every == 0 ? std::string("counting calls only")
+                                : "timing 1 in " + std::to_string(every));
+    }
+  }
+
+private:
+  const char *m_Name;
+  std::source_location m_Location;
+  std::atomic<std::uint32_t> m_SampleEvery{1};
+  std::atomic<std::uint64_t> m_TailGeneration{0};
+  std::atomic<std::int64_t> m_TailThresholdNs{0};
+  LatencyHistogram m_Latency;
+  inline static std::atomic_bool s_LatencyRecording{false};
+
+  std::mutex m_Lock;
+  std::uint64_t m_Calls = 0;
+  std::chrono::steady_clock::time_point m_WindowStart{};
+  std::uint64_t m_WindowCalls = 0;
+  std::uint64_t m_WindowTimed = 0;
+  std::int64_t m_WindowTimedNs = 0;
+  double m_CallsPerSecond = 0.0;
+  double m_MeanNs = 0.0;
+  double m_OverheadShare = 0.0;
+  std::uint64_t m_Demotions = 0;
+  std::uint64_t m_FastDropped = 0;
+};
+
+inline std::vector<GovernedSiteStats> Governor::Report(void) {
+  std::vector<GovernedSiteStats> report;
+  ForEach([&](GovernedSite &site) { report.push_back(site.Stats()); });
+  return report;
+}
+#pragma endregion Governor
+} // namespace simperf
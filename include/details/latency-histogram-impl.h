@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace simperf {
+#pragma region LatencyHistogram
+// Four buckets per power of two of nanoseconds, so any percentile read back is within 25% of the
+// true value. Recording is two relaxed atomic adds; readers take a Snapshot() and subtract an
+// older one to get a window.
+class LatencyHistogram {
+public:
+  static constexpr std::size_t BUCKETS = 4 + 62 * 4;
+
+  struct Snapshot {
+    std::array<std::uint64_t, BUCKETS> Counts{};
+    std::uint64_t SumNs = 0;
+
+    std::uint64_t Count(void) const {
+      std::uint64_t count = 0;
+      for (auto bucket : Counts)
+        count += bucket;
+      return count;
+    }
+
+    Snapshot Since(const Snapshot &earlier) const {
+      Snapshot window;
+      for (std::size_t i = 0; i < BUCKETS; ++i)
+        window.Counts[i] = Counts[i] - earlier.Counts[i];
+      window.SumNs = SumNs - earlier.SumNs;
+      return window;
+    }
+
+    // The upper bound of the bucket holding the `fraction` quantile, 0 when empty.
+    std::uint64_t PercentileNs(double fraction) const {
+      auto count = Count();
+      if (count == 0)
+        return 0;
+      auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count - 1)) + 1;
+      std::uint64_t seen = 0;
+      for (std::size_t i = 0; i < BUCKETS; ++i) {
+        seen += Counts[i];
+        if (seen >= rank)
+          return i + 1 < BUCKETS ? LowerBound(i + 1) - 1 : LowerBound(i);
+      }
+      return LowerBound(BUCKETS - 1);
+    }
+  };
+
+  void Record(std::int64_t duration_ns) {
+    auto ns = duration_ns > 0 ? static_cast<std::uint64_t>(duration_ns) : 0;
+    m_Counts[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    m_SumNs.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  Snapshot Take(void) const {
+    Snapshot snapshot;
+    for (std::size_t i = 0; i < BUCKETS; ++i)
+      snapshot.Counts[i] = m_Counts[i].load(std::memory_order_relaxed);
+    snapshot.SumNs = m_SumNs.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  static std::size_t BucketOf(std::uint64_t ns) {
+    if (ns < 4)
+      return static_cast<std::size_t>(ns);
+    auto power = static_cast<std::size_t>(63 - std::countl_zero(ns));
+    auto sub = static_cast<std::size_t>(ns >> (power - 2)) & 3;
+    return 4 + (power - 2) * 4 + sub;
+  }
+
+  static std::uint64_t LowerBound(std::size_t bucket) {
+    if (bucket < 4)
+      return bucket;
+    auto power = (bucket - 4) / 4 + 2;
+    auto sub = (bucket - 4) % 4;
+    return static_cast<std::uint64_t>(4 + sub) << (power - 2);
+  }
+
+private:
+  std::array<std::atomic<std::uint64_t>, BUCKETS> m_Counts{};
+  std::atomic<std::uint64_t> m_SumNs{0};
+};
+#pragma endregion LatencyHistogram
+} // namespace simperf
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace simperf {
+#pragma region LockSite
+// Instrumented locks add their uncontended acquisitions to their site in batches of this many, and
+// time one in this many uncontended exclusive holds.
+static constexpr std::uint32_t LOCK_SAMPLE_PERIOD = 64;
+
+struct LockSiteStats {
+  std::string_view Name;
+  std::string_view File;
+  std::uint32_t Line;
+  std::uint64_t Acquisitions; // lags by up to LOCK_SAMPLE_PERIOD per live lock
+  std::uint64_t Contentions;
+  std::chrono::nanoseconds WaitTime;
+  std::chrono::nanoseconds MaxWait;
+  std::uint64_t TimedHolds; // every contended hold plus a sample of the uncontended ones
+  std::chrono::nanoseconds HoldTime;
+  std::chrono::nanoseconds MaxHold;
+};
+
+// Every instrumented lock declared at the same place shares one LockSite. Sites live for the rest
+// of the program so their stats outlive the locks that fed them.
+class LockSite {
+public:
+  LockSite(const char *name, std::source_location location)
+      : m_Name(name ? name : DefaultName(location)), m_Location(location) {}
+
+  LockSite(const LockSite &) = delete;
+  LockSite &operator=(const LockSite &) = delete;
+
+  const std::string &Name(void) const { return m_Name; }
+  const std::source_location &Location(void) const { return m_Location; }
+
+  void AddAcquisitions(std::uint64_t count) {
+    if (count)
+      m_Acquisitions.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  void RecordWait(std::chrono::nanoseconds wait) {
+    m_Contentions.fetch_add(1, std::memory_order_relaxed);
+    m_WaitNs.fetch_add(wait.count(), std::memory_order_relaxed);
+    UpdateMax(m_MaxWaitNs, wait.count());
+  }
+
+  void RecordHold(std::chrono::nanoseconds hold) {
+    m_TimedHolds.fetch_add(1, std::memory_order_relaxed);
+    m_HoldNs.fetch_add(hold.count(), std::memory_order_relaxed);
+    UpdateMax(m_MaxHoldNs, hold.count());
+  }
+
+  LockSiteStats Stats(void) const {
+    return {m_Name,
+            m_Location.file_name(),
+            m_Location.line(),
+            m_Acquisitions.load(std::memory_order_relaxed),
+            m_Contentions.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(m_WaitNs.load(std::memory_order_relaxed)),
+            std::chrono::nanoseconds(m_MaxWaitNs.load(std::memory_order_relaxed)),
+            m_TimedHolds.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(m_HoldNs.load(std::memory_order_relaxed)),
+            std::chrono::nanoseconds(m_MaxHoldNs.load(std::memory_order_relaxed))};
+  }
+
+private:
+  static std::string DefaultName(const std::source_location &location) {
+    std::string_view file = location.file_name();
+    if (auto slash = file.find_last_of("/\\"); slash != std::string_view::npos)
+      file.remove_prefix(slash + 1);
+    return std::format("lock {}:{}", file, location.line());
+  }
+
+  static void UpdateMax(std::atomic<std::int64_t> &max, std::int64_t value) {
+    auto current = max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+  }
+
+private:
+  std::string m_Name;
+  std::source_location m_Location;
+  std::atomic<std::uint64_t> m_Acquisitions{0};
+  std::atomic<std::uint64_t> m_Contentions{0};
+  std::atomic<std::int64_t> m_WaitNs{0};
+  std::atomic<std::int64_t> m_MaxWaitNs{0};
+  std::atomic<std::uint64_t> m_TimedHolds{0};
+  std::atomic<std::int64_t> m_HoldNs{0};
+  std::atomic<std::int64_t> m_MaxHoldNs{0};
+};
+
+// Sites are keyed by source location. File names are compared by content, so a lock declared in a
+// header shares one site across translation units.
+class LockSiteRegistry {
+public:
+  static LockSite &Resolve(const char *name, const std::source_location &location) {
+    Key key{location.file_name(), location.line(), location.column()};
+    {
+      std::shared_lock lock(s_Lock);
+      if (LockSite *site = Find(key, name))
+        return *site;
+    }
+    std::unique_lock lock(s_Lock);
+    if (LockSite *site = Find(key, name))
+      return *site;
+    auto &site = *s_Sites.emplace_back(std::make_unique<LockSite>(name, location));
+    s_ByLocation[key].push_back(&site);
+    return site;
+  }
+
+  static std::vector<LockSiteStats> Stats(void) {
+    std::shared_lock lock(s_Lock);
+    std::vector<LockSiteStats> stats;
+    stats.reserve(s_Sites.size());
+    for (const auto &site : s_Sites)
+      stats.push_back(site->Stats());
+    return stats;
+  }
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::shared_lock lock(s_Lock);
+    for (const auto &site : s_Sites)
+      fn(*site);
+  }
+
+private:
+  struct Key {
+    std::string_view File;
+    std::uint32_t Line;
+    std::uint32_t Column;
+    bool operator==(const Key &) const = default;
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      return std::hash<std::string_view>{}(key.File) ^ (std::size_t(key.Line) << 16) ^ key.Column;
+    }
+  };
+
+  // A location holds more than one site only when its locks are given different names.
+  // Note: you must already own s_Lock before calling Find()
+  static LockSite *Find(const Key &key, const char *name) {
+    auto found = s_ByLocation.find(key);
+    if (found == s_ByLocation.end())
+      return nullptr;
+    for (LockSite *site : found->second) {
+      if (name == nullptr || site->Name() == name)
+        return site;
+    }
+    return nullptr;
+  }
+
+  inline static std::shared_mutex s_Lock;
+  inline static std::vector<std::unique_ptr<LockSite>> s_Sites; // in registration order
+  inline static std::unordered_map<Key, std::vector<LockSite *>, KeyHash> s_ByLocation;
+};
+#pragma endregion LockSite
+} // namespace simperf
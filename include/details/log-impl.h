@@ -1,25 +1,63 @@
 #pragma once
 
+#include "log-site-impl.h"
+
 #define SIMPERF_LOG_IT(logger_name, log_level, ...)                                                \
-  ::simperf::ctx::LogIt(logger_name, log_level, __VA_ARGS__)
+  ::simperf::ctx::LogIt(SIMPERF_LOGGER_HANDLE(), logger_name, log_level, __VA_ARGS__)
 #define SIMPERF_FORMATTED_LOG_IT(logger_name, log_level, ...)                                      \
-  ::simperf::ctx::FormattedLogIt(logger_name, log_level, __VA_ARGS__)
+  ::simperf::ctx::FormattedLogIt(SIMPERF_LOGGER_HANDLE(), logger_name, log_level, __VA_ARGS__)
 #define SIMPERF_AUTOFORMATTED_LOG_IT(logger_name, log_level, ...)                                  \
   ::simperf::ctx::AutoFormattedLogIt(logger_name, log_level, __VA_ARGS__)
 
+// Each surviving call site owns a static LogSite whose enable flag can be flipped at runtime
+// through ::simperf::LogSiteRegistry.
+#define SIMPERF_LOG_SITE_IT(logger_name, log_level, ...)                                           \
+  do {                                                                                             \
+    static ::simperf::LogSite simperf_log_site_(__FILE__, __LINE__, #logger_name, log_level);      \
+    if (simperf_log_site_.IsEnabled()) {                                                           \
+      simperf_log_site_.CountMessage();                                                            \
+      ::simperf::ctx::FormattedLogIt(simperf_log_site_.Handle, logger_name, log_level,             \
+                                     __VA_ARGS__);                                                 \
+    }                                                                                              \
+  } while (0)
+
 #if (defined(_DEBUG) && !defined(SIMPERF_DISABLE)) || defined(SIMPERF_ENABLE)
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_TRACE
 #define SIMPERF_TRACE(logger_name, ...)                                                            \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::trace, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::trace, __VA_ARGS__)
+#else
+#define SIMPERF_TRACE(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_DEBUG
 #define SIMPERF_DEBUG(logger_name, ...)                                                            \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::debug, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::debug, __VA_ARGS__)
+#else
+#define SIMPERF_DEBUG(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_INFO
 #define SIMPERF_INFO(logger_name, ...)                                                             \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::info, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::info, __VA_ARGS__)
+#else
+#define SIMPERF_INFO(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_WARN
 #define SIMPERF_WARN(logger_name, ...)                                                             \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::warn, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::warn, __VA_ARGS__)
+#else
+#define SIMPERF_WARN(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_ERROR
 #define SIMPERF_ERROR(logger_name, ...)                                                            \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::err, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::err, __VA_ARGS__)
+#else
+#define SIMPERF_ERROR(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_CRITICAL
 #define SIMPERF_CRITICAL(logger_name, ...)                                                         \
-  SIMPERF_FORMATTED_LOG_IT(logger_name, spdlog::level::critical, __VA_ARGS__)
+  SIMPERF_LOG_SITE_IT(logger_name, spdlog::level::critical, __VA_ARGS__)
+#else
+#define SIMPERF_CRITICAL(logger_name, ...)
+#endif
 
 #if defined(_WIN64)
 #define SIMPERF_DEBUGBREAK() __debugbreak()
@@ -34,7 +72,7 @@
 #define SIMPERF_RESOLVE_LOG_LEVEL(logger, source)                                                  \
   ::simperf::s_LogLevelTargets.at(logger).second.at(source)
 
-#define SIMPERF_LOG_FLUSH(logger) ::spdlog::get(logger)->flush()
+#define SIMPERF_LOG_FLUSH(logger) ::simperf::LoggerRegistry::Resolve(logger)->flush()
 
 #define SIMPERF_LOG_ASSERT(logger, msg, ...)                                                       \
   SIMPERF_FORMATTED_LOG_IT(                                                                        \
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "logger-registry-impl.h"
+
+// Compile-time floor: logging macros below SIMPERF_ACTIVE_LEVEL expand to nothing. The values
+// mirror spdlog::level::level_enum.
+#define SIMPERF_LEVEL_TRACE 0
+#define SIMPERF_LEVEL_DEBUG 1
+#define SIMPERF_LEVEL_INFO 2
+#define SIMPERF_LEVEL_WARN 3
+#define SIMPERF_LEVEL_ERROR 4
+#define SIMPERF_LEVEL_CRITICAL 5
+#define SIMPERF_LEVEL_OFF 6
+
+#if !defined(SIMPERF_ACTIVE_LEVEL)
+#define SIMPERF_ACTIVE_LEVEL SIMPERF_LEVEL_TRACE
+#endif
+
+namespace simperf {
+#pragma region LogSite
+struct LogSite;
+
+struct LogSiteInfo {
+  std::string_view File;
+  int Line;
+  std::string_view Tag;
+  spdlog::level::level_enum Level;
+  bool Enabled;
+  std::uint64_t Messages; // logged while enabled
+};
+
+// Every surviving logging macro expansion owns a static LogSite. Rules are kept in the order they
+// were added and the last matching rule wins, both for sites that already exist and for sites that
+// register later.
+class LogSiteRegistry {
+public:
+  enum class RuleKind { File, Tag, Pattern };
+
+  static void Register(LogSite &site);
+
+  // Matches `glob` against the full __FILE__ path or its file name.
+  static void SetFileStatus(std::string_view glob, bool enabled) {
+    AddRule(RuleKind::File, glob, enabled);
+  }
+
+  // The tag of a site is the logger argument as written at the call site, without quotes.
+  static void SetTagStatus(std::string_view glob, bool enabled) {
+    AddRule(RuleKind::Tag, glob, enabled);
+  }
+
+  // Matches `glob` against "<file name>:<line>", e.g. "parser.cpp:*" or "*.cpp:120".
+  static void SetPatternStatus(std::string_view glob, bool enabled) {
+    AddRule(RuleKind::Pattern, glob, enabled);
+  }
+
+  // Drops every rule and re-enables every site.
+  static void ResetStatus(void);
+
+  // Swaps every rule of `kind` for `rules` in one step, e.g. when a config file is reloaded.
+  static void ReplaceRules(RuleKind kind, const std::vector<std::pair<std::string, bool>> &rules);
+
+  static std::vector<LogSiteInfo> Sites(void);
+
+  static bool GlobMatch(std::string_view glob, std::string_view text) {
+    std::size_t g = 0, t = 0, star = std::string_view::npos, resume = 0;
+    while (t < text.size()) {
+      if (g < glob.size() && (glob[g] == '?' || glob[g] == text[t])) {
+        ++g;
+        ++t;
+      } else if (g < glob.size() && glob[g] == '*') {
+        star = g++;
+        resume = t;
+      } else if (star != std::string_view::npos) {
+        g = star + 1;
+        t = ++resume;
+      } else {
+        return false;
+      }
+    }
+    while (g < glob.size() && glob[g] == '*')
+      ++g;
+    return g == glob.size();
+  }
+
+private:
+  struct Rule {
+    RuleKind Kind;
+    std::string Glob;
+    bool Enabled;
+  };
+
+  static void AddRule(RuleKind kind, std::string_view glob, bool enabled);
+
+  // Note: you must already own s_Lock before calling ApplyRulesLocked()
+  static void ApplyRulesLocked(LogSite &site);
+
+  static bool RuleMatches(const Rule &rule, const LogSite &site);
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<LogSite *> s_Sites;
+  inline static std::vector<Rule> s_Rules;
+};
+
+struct LogSite {
+  LogSite(const char *file, int line, std::string_view tag, spdlog::level::level_enum level)
+      : File(file), Line(line), Tag(StripQuotes(tag)), Level(level) {
+    LogSiteRegistry::Register(*this);
+  }
+
+  LogSite(const LogSite &) = delete;
+  LogSite &operator=(const LogSite &) = delete;
+
+  bool IsEnabled(void) const { return Enabled.load(std::memory_order_relaxed); }
+
+  void CountMessage(void) { Messages.fetch_add(1, std::memory_order_relaxed); }
+
+  std::string_view FileName(void) const {
+    std::string_view file(File);
+    auto slash = file.find_last_of("/\\");
+    return slash == std::string_view::npos ? file : file.substr(slash + 1);
+  }
+
+  const char *File;
+  int Line;
+  std::string_view Tag;
+  spdlog::level::level_enum Level;
+  std::atomic_bool Enabled{true};
+  std::atomic<std::uint64_t> Messages{0};
+  LoggerHandle Handle;
+
+private:
+  static constexpr std::string_view StripQuotes(std::string_view tag) {
+    if (tag.size() >= 2 && tag.front() == '"' && tag.back() == '"')
+      return tag.substr(1, tag.size() - 2);
+    return tag;
+  }
+};
+
+inline void LogSiteRegistry::Register(LogSite &site) {
+  std::lock_guard lock(s_Lock);
+  s_Sites.push_back(&site);
+  ApplyRulesLocked(site);
+}
+
+inline void LogSiteRegistry::ResetStatus(void) {
+  std::lock_guard lock(s_Lock);
+  s_Rules.clear();
+  for (LogSite *site : s_Sites)
+    site->Enabled.store(true, std::memory_order_relaxed);
+}
+
+inline void
+LogSiteRegistry::ReplaceRules(RuleKind kind,
+                              const std::vector<std::pair<std::string, bool>> &rules) {
+  std::lock_guard lock(s_Lock);
+  std::erase_if(s_Rules, [&](const Rule &rule) { return rule.Kind == kind; });
+  for (const auto &[glob, enabled] : rules)
+    s_Rules.push_back({kind, glob, enabled});
+  for (LogSite *site : s_Sites) {
+    bool enabled = true;
+    for (const Rule &rule : s_Rules) {
+      if (RuleMatches(rule, *site))
+        enabled = rule.Enabled;
+    }
+    site->Enabled.store(enabled, std::memory_order_relaxed);
+  }
+}
+
+inline std::vector<LogSiteInfo> LogSiteRegistry::Sites(void) {
+  std::lock_guard lock(s_Lock);
+  std::vector<LogSiteInfo> sites;
+  sites.reserve(s_Sites.size());
+  for (const LogSite *site : s_Sites)
+    sites.push_back({site->File, site->Line, site->Tag, site->Level, site->IsEnabled(),
+                     site->Messages.load(std::memory_order_relaxed)});
+  return sites;
+}
+
+inline void LogSiteRegistry::AddRule(RuleKind kind, std::string_view glob, bool enabled) {
+  std::lock_guard lock(s_Lock);
+  s_Rules.push_back({kind, std::string(glob), enabled});
+  for (LogSite *site : s_Sites) {
+    if (RuleMatches(s_Rules.back(), *site))
+      site->Enabled.store(enabled, std::memory_order_relaxed);
+  }
+}
+
+inline void LogSiteRegistry::ApplyRulesLocked(LogSite &site) {
+  for (const Rule &rule : s_Rules) {
+    if (RuleMatches(rule, site))
+      site.Enabled.store(rule.Enabled, std::memory_order_relaxed);
+  }
+}
+
+inline bool LogSiteRegistry::RuleMatches(const Rule &rule, const LogSite &site) {
+  switch (rule.Kind) {
+  case RuleKind::File:
+    return GlobMatch(rule.Glob, site.File) || GlobMatch(rule.Glob, site.FileName());
+  case RuleKind::Tag:
+    return GlobMatch(rule.Glob, site.Tag);
+  case RuleKind::Pattern:
+    return GlobMatch(rule.Glob, std::string(site.FileName()) + ":" + std::to_string(site.Line));
+  }
+  return false;
+}
+#pragma endregion LogSite
+} // namespace simperf
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace simperf {
+#pragma region LoggerRegistry
+// One node per distinct logger name ever looked up. Nodes are never freed, so call sites can keep
+// raw pointers to them; `Resolved` is refreshed lazily whenever the registry generation moves.
+struct LoggerNode {
+  explicit LoggerNode(std::string_view name) : Name(name) {}
+
+  const std::string Name;
+  std::shared_ptr<spdlog::logger> Registered; // guarded by the registry write lock
+  std::atomic<spdlog::logger *> Resolved{nullptr};
+  std::atomic<std::uint64_t> ResolvedGeneration{0};
+  // Messages this logger accepted, per level, counted where they are handed to it.
+  std::array<std::atomic<std::uint64_t>, spdlog::level::n_levels> Messages{};
+};
+
+// Read-mostly registry: lookups are a single acquire load of an immutable snapshot, while writers
+// copy, modify and publish a new snapshot under a lock. Replaced snapshots, and every logger ever
+// resolved, are retained until exit: readers never announce when they are done with a raw pointer,
+// so a dropped logger may still be in use on another thread. Each logger is retained once.
+class LoggerRegistry {
+public:
+  static std::uint64_t Generation(void) { return s_Generation.load(std::memory_order_acquire); }
+
+  // Bumps the generation so every cached resolution is recomputed on next use. Call after loggers
+  // are registered or dropped behind the registry's back (spdlog::register_logger, spdlog_setup).
+  static void Invalidate(void) { s_Generation.fetch_add(1, std::memory_order_acq_rel); }
+
+  static LoggerNode &Intern(std::string_view name) {
+    if (LoggerNode *node = Find(name))
+      return *node;
+    std::lock_guard lock(s_WriteLock);
+    if (LoggerNode *node = Find(name))
+      return *node;
+    auto &node = *s_Nodes.emplace_back(std::make_unique<LoggerNode>(name));
+    PublishLocked([&](Snapshot &snapshot) { snapshot.insert({node.Name, &node}); });
+    return node;
+  }
+
+  static spdlog::logger *Resolve(LoggerNode &node) {
+    auto generation = Generation();
+    if (node.ResolvedGeneration.load(std::memory_order_acquire) == generation) [[likely]]
+      return node.Resolved.load(std::memory_order_relaxed);
+    return Refresh(node);
+  }
+
+  static spdlog::logger *Resolve(std::string_view name) { return Resolve(Intern(name)); }
+
+  // Registered loggers win over spdlog's registry, which wins over the default logger.
+  static std::shared_ptr<spdlog::logger> Get(std::string_view name) {
+    auto &node = Intern(name);
+    std::lock_guard lock(s_WriteLock);
+    if (node.Registered)
+      return node.Registered;
+    auto dynamic_found = spdlog::get(node.Name);
+    return dynamic_found ? dynamic_found : spdlog::default_logger();
+  }
+
+  static void Publish(const std::shared_ptr<spdlog::logger> &logger_) {
+    auto &node = Intern(logger_->name());
+    std::lock_guard lock(s_WriteLock);
+    node.Registered = logger_;
+    RetainLocked(logger_);
+    Invalidate();
+  }
+
+  // Counts a message `logger_` is about to write, under the node of its own name, so messages
+  // redirected to the default logger are counted there. Call only when should_log() passed.
+  static void CountMessage(const spdlog::logger &logger_, spdlog::level::level_enum level) {
+    Intern(logger_.name()).Messages[level].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::lock_guard lock(s_WriteLock);
+    for (const auto &node : s_Nodes)
+      fn(static_cast<const LoggerNode &>(*node));
+  }
+
+  static bool Contains(std::string_view name) {
+    LoggerNode *node = Find(name);
+    if (node == nullptr)
+      return false;
+    std::lock_guard lock(s_WriteLock);
+    return node->Registered != nullptr;
+  }
+
+  static bool Drop(std::string_view name) {
+    bool dropped = false;
+    LoggerNode *node = Find(name);
+    std::lock_guard lock(s_WriteLock);
+    if (node) {
+      dropped = node->Registered != nullptr;
+      node->Registered.reset();
+    }
+    Invalidate();
+    return dropped;
+  }
+
+private:
+  struct NameHash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>{}(name);
+    }
+  };
+
+  using Snapshot = std::unordered_map<std::string, LoggerNode *, NameHash, std::equal_to<>>;
+
+  static LoggerNode *Find(std::string_view name) {
+    const Snapshot *snapshot = s_Current.load(std::memory_order_acquire);
+    if (snapshot == nullptr)
+      return nullptr;
+    auto found = snapshot->find(name);
+    return found != snapshot->end() ? found->second : nullptr;
+  }
+
+  // Note: you must already own s_WriteLock before calling PublishLocked()
+  template <typename Fn> static void PublishLocked(Fn &&modify) {
+    const Snapshot *current = s_Current.load(std::memory_order_relaxed);
+    auto next = current ? std::make_unique<Snapshot>(*current) : std::make_unique<Snapshot>();
+    modify(*next);
+    s_Current.store(next.get(), std::memory_order_release);
+    s_Snapshots.push_back(std::move(next));
+  }
+
+  static spdlog::logger *Refresh(LoggerNode &node) {
+    std::lock_guard lock(s_WriteLock);
+    auto generation = Generation();
+    std::shared_ptr<spdlog::logger> resolved = node.Registered;
+    if (!resolved)
+      resolved = spdlog::get(node.Name);
+    if (!resolved)
+      resolved = spdlog::default_logger();
+    if (resolved)
+      RetainLocked(resolved);
+    node.Resolved.store(resolved.get(), std::memory_order_relaxed);
+    node.ResolvedGeneration.store(generation, std::memory_order_release);
+    return resolved.get();
+  }
+
+  // Note: you must already own s_WriteLock before calling RetainLocked()
+  static void RetainLocked(const std::shared_ptr<spdlog::logger> &logger_) {
+    if (std::find(s_Retained.begin(), s_Retained.end(), logger_) == s_Retained.end())
+      s_Retained.push_back(logger_);
+  }
+
+private:
+  inline static std::mutex s_WriteLock;
+  inline static std::atomic<std::uint64_t> s_Generation{1};
+  inline static std::atomic<const Snapshot *> s_Current{nullptr};
+  inline static std::vector<std::unique_ptr<const Snapshot>> s_Snapshots;
+  inline static std::vector<std::unique_ptr<LoggerNode>> s_Nodes;
+  inline static std::vector<std::shared_ptr<spdlog::logger>> s_Retained;
+};
+
+// Per call site cache. Steady state is two acquire loads, a name compare and a relaxed load: no
+// hash lookup, no lock and no shared_ptr refcount traffic.
+class LoggerHandle {
+public:
+  spdlog::logger *Resolve(std::string_view name) {
+    LoggerNode *node = m_Node.load(std::memory_order_acquire);
+    if (node == nullptr || node->Name != name) [[unlikely]] {
+      node = &LoggerRegistry::Intern(name);
+      m_Node.store(node, std::memory_order_release);
+    }
+    return LoggerRegistry::Resolve(*node);
+  }
+
+private:
+  std::atomic<LoggerNode *> m_Node{nullptr};
+};
+#pragma endregion LoggerRegistry
+} // namespace simperf
+
+#define SIMPERF_LOGGER_HANDLE()                                                                    \
+  []() -> ::simperf::LoggerHandle & {                                                              \
+    static ::simperf::LoggerHandle handle;                                                         \
+    return handle;                                                                                 \
+  }()
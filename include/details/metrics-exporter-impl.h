@@ -0,0 +1,267 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include "governor-impl.h"
+#include "logger-registry-impl.h"
+
+namespace simperf {
+#pragma region MetricsExporter
+struct MetricsExporterOptions {
+  std::string Path = "simperf.prom";
+  std::chrono::milliseconds Interval{std::chrono::seconds(10)};
+};
+
+// Writes a Prometheus text exposition file for node-local scrapers (e.g. the node_exporter
+// textfile collector) every Interval, replacing it by rename so a scrape never sees half a file:
+//
+//   simperf_scope_calls_total                                  per SIMPERF_PROFILE_SCOPE site
+//   simperf_scope_seconds{quantile="0.5"|"0.99"}               summary: quantiles over the last
+//                                                              interval, _sum and _count over
+//                                                              every timed call
+//   simperf_scope_sample_every                                 the governor's current setting
+//   simperf_log_messages_total{logger, level}                  per logger that wrote them
+//
+// Calls are the governor's count, which each thread flushes every GOVERNOR_TALLY_FLUSH calls.
+// Seconds and quantiles come from the sites' latency histograms, which timed scopes only feed
+// while the exporter runs, so they cover the calls timed since it started.
+class MetricsExporter {
+public:
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter(MetricsExporter &&) = delete;
+
+  static MetricsExporter &Get() {
+    static MetricsExporter instance;
+    return instance;
+  }
+
+  // Restarts the exporter if it is already running.
+  void Start(const MetricsExporterOptions &options) {
+    std::lock_guard lock(m_Lock);
+    InternalStop();
+    m_Options = options;
+    m_StopRequested = false;
+    GovernedSite::SetLatencyRecording(true);
+    m_Thread = std::make_unique<std::thread>([this] { Run(); });
+  }
+
+  // Writes the file one last time.
+  void Stop(void) {
+    std::lock_guard lock(m_Lock);
+    if (!m_Thread)
+      return;
+    InternalStop();
+    WriteNow(m_Options.Path);
+  }
+
+  bool Running(void) {
+    std::lock_guard lock(m_Lock);
+    return m_Thread != nullptr;
+  }
+
+  MetricsExporterOptions Options(void) {
+    std::lock_guard lock(m_Lock);
+    return m_Options;
+  }
+
+  // Writes `path` now; the windowed quantiles cover everything since the previous write.
+  bool WriteNow(const std::string &path) {
+    std::lock_guard lock(m_WriteLock);
+    auto text = Render();
+    auto temporary = path + ".tmp";
+    {
+      std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+      out << text;
+      if (!out.flush())
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return !error;
+  }
+
+private:
+  MetricsExporter() {
+#if !defined(_WIN32)
+    pthread_atfork(&MetricsExporter::PrepareFork, &MetricsExporter::AfterForkInParent,
+                   &MetricsExporter::AfterForkInChild);
+#endif
+  }
+
+  // Sites may already be gone at exit, so there is no final write here.
+  ~MetricsExporter() {
+    std::lock_guard lock(m_Lock);
+    InternalStop();
+  }
+
+#if !defined(_WIN32)
+  // Taking every lock across fork() means the child never inherits the options, the wake state or
+  // the previous snapshots in the middle of an update.
+  static void PrepareFork(void) {
+    auto &exporter = Get();
+    exporter.m_Lock.lock();
+    exporter.m_WakeLock.lock();
+    exporter.m_WriteLock.lock();
+  }
+
+  static void AfterForkInParent(void) {
+    auto &exporter = Get();
+    exporter.m_WriteLock.unlock();
+    exporter.m_WakeLock.unlock();
+    exporter.m_Lock.unlock();
+  }
+
+  // The exporter thread does not exist in the child, which is left stopped: the parent keeps
+  // writing the file, and the child can Start() one of its own. Nothing here allocates or starts a
+  // thread.
+  static void AfterForkInChild(void) {
+    auto &exporter = Get();
+    if (exporter.m_Thread) {
+      (void)exporter.m_Thread.release(); // never joinable here, and destroying it would terminate()
+      GovernedSite::SetLatencyRecording(false);
+    }
+    exporter.m_StopRequested = false;
+    std::construct_at(&exporter.m_WakeCondition); // the exporter thread may have been waiting on it
+    exporter.m_WriteLock.unlock();
+    exporter.m_WakeLock.unlock();
+    exporter.m_Lock.unlock();
+  }
+#endif
+
+  // Note: you must already own m_Lock before calling InternalStop()
+  void InternalStop(void) {
+    if (!m_Thread)
+      return;
+    GovernedSite::SetLatencyRecording(false);
+    {
+      std::lock_guard wake(m_WakeLock);
+      m_StopRequested = true;
+    }
+    m_WakeCondition.notify_one();
+    m_Thread->join();
+    m_Thread.reset();
+  }
+
+  void Run(void) {
+    auto options = m_Options; // fixed for this thread's lifetime
+    std::unique_lock wake(m_WakeLock);
+    while (!m_WakeCondition.wait_for(wake, options.Interval, [this] { return m_StopRequested; })) {
+      wake.unlock();
+      WriteNow(options.Path);
+      wake.lock();
+    }
+  }
+
+  // Note: you must already own m_WriteLock before calling Render()
+  std::string Render(void) {
+    std::string scopes_calls, scopes_seconds, scopes_sample_every;
+    Governor::ForEach([&](GovernedSite &site) {
+      auto stats = site.Stats();
+      auto snapshot = site.Latency();
+      auto &previous = m_Previous[&site];
+      auto window = snapshot.Since(previous);
+      previous = snapshot;
+
+      auto labels = std::format("site=\"{}\",file=\"{}\",line=\"{}\"", Escape(site.Name()),
+                                Escape(FileName(site.Location().file_name())),
+                                site.Location().line());
+      scopes_calls += std::format("simperf_scope_calls_total{{{}}} {}\n", labels, stats.Calls);
+      for (auto [quantile, text] : {std::pair{0.5, "0.5"}, std::pair{0.99, "0.99"}}) {
+        scopes_seconds += std::format("simperf_scope_seconds{{{},quantile=\"{}\"}} ", labels, text);
+        if (window.Count() == 0)
+          scopes_seconds += "NaN\n";
+        else
+          scopes_seconds += std::format(
+              "{}\n", static_cast<double>(window.PercentileNs(quantile)) * 1e-9);
+      }
+      scopes_seconds += std::format("simperf_scope_seconds_sum{{{}}} {}\n", labels,
+                                    static_cast<double>(snapshot.SumNs) * 1e-9);
+      scopes_seconds +=
+          std::format("simperf_scope_seconds_count{{{}}} {}\n", labels, snapshot.Count());
+      scopes_sample_every += std::format("simperf_scope_sample_every{{{}}} {}\n", labels,
+                                         stats.SampleEvery);
+    });
+
+    std::string messages;
+    LoggerRegistry::ForEach([&](const LoggerNode &node) {
+      for (int level = 0; level < spdlog::level::n_levels; ++level) {
+        auto count = node.Messages[level].load(std::memory_order_relaxed);
+        if (count == 0)
+          continue;
+        auto name = spdlog::level::to_string_view(static_cast<spdlog::level::level_enum>(level));
+        messages += std::format("simperf_log_messages_total{{logger=\"{}\",level=\"{}\"}} {}\n",
+                                Escape(node.Name), std::string_view(name.data(), name.size()),
+                                count);
+      }
+    });
+
+    std::string text;
+    text += "# HELP simperf_scope_calls_total Calls of a profiled scope.\n"
+            "# TYPE simperf_scope_calls_total counter\n";
+    text += scopes_calls;
+    text += "# HELP simperf_scope_seconds Duration of timed calls of a profiled scope; quantiles "
+            "cover the last export interval.\n"
+            "# TYPE simperf_scope_seconds summary\n";
+    text += scopes_seconds;
+    text += "# HELP simperf_scope_sample_every 1 when every call is timed, N for 1 in N, 0 for "
+            "none.\n"
+            "# TYPE simperf_scope_sample_every gauge\n";
+    text += scopes_sample_every;
+    text += "# HELP simperf_log_messages_total Messages written through SIMPERF logging, by the "
+            "logger that wrote them.\n"
+            "# TYPE simperf_log_messages_total counter\n";
+    text += messages;
+    return text;
+  }
+
+  static std::string_view FileName(std::string_view path) {
+    auto slash = path.find_last_of("/\\");
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+  }
+
+  static std::string Escape(std::string_view value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+      if (c == '\\' || c == '"')
+        escaped += '\\';
+      if (c == '\n')
+        escaped += "\\n";
+      else
+        escaped += c;
+    }
+    return escaped;
+  }
+
+private:
+  std::mutex m_Lock;
+  MetricsExporterOptions m_Options;
+  std::unique_ptr<std::thread> m_Thread;
+
+  std::mutex m_WakeLock;
+  std::condition_variable m_WakeCondition;
+  bool m_StopRequested = false;
+
+  std::mutex m_WriteLock;
+  std::unordered_map<const GovernedSite *, LatencyHistogram::Snapshot> m_Previous;
+};
+#pragma endregion MetricsExporter
+} // namespace simperf
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace simperf {
+#pragma region MpscRing
+// Any number of producers, one consumer. Each slot carries a sequence number: a producer claims a
+// slot with one compare-exchange on the head, fills it in place and publishes it by advancing the
+// slot's sequence, so producers never wait for each other. A producer preempted between Reserve()
+// and Commit() holds up the consumer at its slot until it resumes; everyone else keeps writing.
+template <typename Record, std::size_t Capacity> class MpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  MpscRing() { Reset(); }
+
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  // Returns nullptr when full; otherwise fill the record and Commit(position).
+  Record *Reserve(std::uint64_t &position) {
+    auto head = m_Head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &slot = m_Slots[head & (Capacity - 1)];
+      auto sequence = slot.Sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::int64_t>(sequence - head);
+      if (lag == 0) {
+        if (m_Head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+          position = head;
+          return &slot.Value;
+        }
+      } else if (lag < 0) {
+        return nullptr;
+      } else {
+        head = m_Head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void Commit(std::uint64_t position) {
+    m_Slots[position & (Capacity - 1)].Sequence.store(position + 1, std::memory_order_release);
+  }
+
+  const Record *Front(void) const {
+    const Slot &slot = m_Slots[m_Tail & (Capacity - 1)];
+    if (slot.Sequence.load(std::memory_order_acquire) != m_Tail + 1)
+      return nullptr;
+    return &slot.Value;
+  }
+
+  void Pop(void) {
+    m_Slots[m_Tail & (Capacity - 1)].Sequence.store(m_Tail + Capacity, std::memory_order_release);
+    ++m_Tail;
+  }
+
+  // Consumer side: throws away everything committed up to the first slot still being written.
+  void Discard(void) {
+    while (Front())
+      Pop();
+  }
+
+  // Note: no producer may be running when calling Reset(), e.g. in a freshly forked child
+  void Reset(void) {
+    for (std::size_t i = 0; i < Capacity; ++i)
+      m_Slots[i].Sequence.store(i, std::memory_order_relaxed);
+    m_Head.store(0, std::memory_order_relaxed);
+    m_Tail = 0;
+  }
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> Sequence;
+    Record Value;
+  };
+
+  std::array<Slot, Capacity> m_Slots;
+  alignas(64) std::atomic<std::uint64_t> m_Head{0};
+  alignas(64) std::uint64_t m_Tail{0};
+};
+#pragma endregion MpscRing
+} // namespace simperf
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "trace-event-impl.h"
+
+namespace simperf {
+namespace trace {
+#pragma region ProtoWriter
+// Minimal protobuf wire format writer. Nested messages reserve a four byte (redundant) varint for
+// their length and patch it on close, so nothing is encoded twice.
+class ProtoWriter {
+public:
+  explicit ProtoWriter(std::string &out) : m_Out(out) {}
+
+  void Varint(std::uint64_t value) {
+    while (value >= 0x80) {
+      m_Out += static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    m_Out += static_cast<char>(value);
+  }
+
+  void Tag(std::uint32_t field, std::uint32_t wire_type) { Varint(field << 3 | wire_type); }
+
+  void UInt(std::uint32_t field, std::uint64_t value) {
+    Tag(field, 0);
+    Varint(value);
+  }
+
+  void Int(std::uint32_t field, std::int64_t value) {
+    UInt(field, static_cast<std::uint64_t>(value));
+  }
+
+  void Bool(std::uint32_t field, bool value) { UInt(field, value ? 1 : 0); }
+
+  void Double(std::uint32_t field, double value) {
+    Tag(field, 1);
+    char bytes[sizeof(double)];
+    std::memcpy(bytes, &value, sizeof(double)); // protobuf is little endian, like our targets
+    m_Out.append(bytes, sizeof(double));
+  }
+
+  void String(std::uint32_t field, std::string_view value) {
+    Tag(field, 2);
+    Varint(value.size());
+    m_Out.append(value);
+  }
+
+  std::size_t BeginNested(std::uint32_t field) {
+    Tag(field, 2);
+    m_Out.append(NESTED_LENGTH_SIZE, '\0');
+    return m_Out.size();
+  }
+
+  void EndNested(std::size_t start) {
+    auto size = m_Out.size() - start;
+    char *length = m_Out.data() + start - NESTED_LENGTH_SIZE;
+    for (std::size_t i = 0; i < NESTED_LENGTH_SIZE; ++i) {
+      length[i] = static_cast<char>((size & 0x7f) | (i + 1 < NESTED_LENGTH_SIZE ? 0x80 : 0));
+      size >>= 7;
+    }
+  }
+
+  template <typename Fn> void Nested(std::uint32_t field, Fn &&fill) {
+    auto start = BeginNested(field);
+    fill();
+    EndNested(start);
+  }
+
+private:
+  static constexpr std::size_t NESTED_LENGTH_SIZE = 4; // messages up to 256 MiB
+
+  std::string &m_Out;
+};
+#pragma endregion ProtoWriter
+
+#pragma region PerfettoEncoder
+// Field numbers from perfetto/protos/perfetto/trace/*.proto.
+namespace perfetto {
+enum : std::uint32_t {
+  TRACE_PACKET = 1,
+
+  PACKET_TIMESTAMP = 8,
+  PACKET_SEQUENCE_ID = 10,
+  PACKET_TRACK_EVENT = 11,
+  PACKET_INTERNED_DATA = 12,
+  PACKET_SEQUENCE_FLAGS = 13,
+  PACKET_PREVIOUS_DROPPED = 42,
+  PACKET_TIMESTAMP_CLOCK_ID = 58,
+  PACKET_TRACK_DESCRIPTOR = 60,
+
+  TRACK_UUID = 1,
+  TRACK_NAME = 2,
+  TRACK_PROCESS = 3,
+  TRACK_THREAD = 4,
+  TRACK_PARENT_UUID = 5,
+  TRACK_COUNTER = 8,
+
+  PROCESS_PID = 1,
+  PROCESS_NAME = 6,
+
+  THREAD_PID = 1,
+  THREAD_TID = 2,
+  THREAD_NAME = 5,
+
+  EVENT_DEBUG_ANNOTATIONS = 4,
+  EVENT_TYPE = 9,
+  EVENT_NAME_IID = 10,
+  EVENT_TRACK_UUID = 11,
+  EVENT_CATEGORIES = 22,
+  EVENT_DOUBLE_COUNTER_VALUE = 44,
+
+  ANNOTATION_UINT_VALUE = 3,
+  ANNOTATION_INT_VALUE = 4,
+  ANNOTATION_DOUBLE_VALUE = 5,
+  ANNOTATION_STRING_VALUE = 6,
+  ANNOTATION_NAME = 10,
+
+  INTERNED_EVENT_NAMES = 2,
+  INTERNED_NAME_IID = 1,
+  INTERNED_NAME_NAME = 2,
+};
+
+enum : std::uint64_t {
+  TYPE_SLICE_BEGIN = 1,
+  TYPE_SLICE_END = 2,
+  TYPE_INSTANT = 3,
+  TYPE_COUNTER = 4,
+
+  SEQ_INCREMENTAL_STATE_CLEARED = 1,
+  SEQ_NEEDS_INCREMENTAL_STATE = 2,
+
+  BUILTIN_CLOCK_MONOTONIC = 3, // steady_clock on the platforms Perfetto runs on
+};
+} // namespace perfetto
+
+// Writes a Perfetto `Trace` proto. Every producer thread is its own packet sequence with its own
+// interned event names; a Complete event becomes a slice begin/end pair on the thread's track.
+class PerfettoEncoder : public TraceEncoder {
+public:
+  void Begin(const TraceSessionInfo &session, std::string &out) override {
+    m_ProcessID = session.ProcessID;
+    Packet(out, SESSION_SEQUENCE, [&](ProtoWriter &packet) {
+      packet.Nested(perfetto::PACKET_TRACK_DESCRIPTOR, [&] {
+        packet.UInt(perfetto::TRACK_UUID, ProcessTrack());
+        packet.Nested(perfetto::TRACK_PROCESS, [&] {
+          packet.Int(perfetto::PROCESS_PID, m_ProcessID);
+          packet.String(perfetto::PROCESS_NAME, session.Name);
+        });
+      });
+    });
+  }
+
+  void Encode(const TraceThreadInfo &thread, const TraceEvent &event, std::string &out) override {
+    auto &sequence = m_Sequences[thread.Sequence];
+    if (!sequence.Described) {
+      sequence.Described = true;
+      Packet(out, thread.Sequence, [&](ProtoWriter &packet) {
+        packet.UInt(perfetto::PACKET_SEQUENCE_FLAGS, perfetto::SEQ_INCREMENTAL_STATE_CLEARED);
+        packet.Nested(perfetto::PACKET_TRACK_DESCRIPTOR, [&] {
+          packet.UInt(perfetto::TRACK_UUID, ThreadTrack(thread.ThreadID));
+          packet.UInt(perfetto::TRACK_PARENT_UUID, ProcessTrack());
+          packet.Nested(perfetto::TRACK_THREAD, [&] {
+            packet.Int(perfetto::THREAD_PID, m_ProcessID);
+            packet.Int(perfetto::THREAD_TID, static_cast<std::int64_t>(thread.ThreadID));
+            if (!thread.ThreadName.empty())
+              packet.String(perfetto::THREAD_NAME, thread.ThreadName);
+          });
+        });
+      });
+    }
+
+    auto track = ThreadTrack(thread.ThreadID);
+    switch (event.Type) {
+    case TraceEventType::Complete:
+      TrackEvent(out, thread, sequence, event, event.StartNs, perfetto::TYPE_SLICE_BEGIN, track);
+      TrackEvent(out, thread, sequence, event, event.StartNs + event.DurationNs,
+                 perfetto::TYPE_SLICE_END, track);
+      break;
+    case TraceEventType::Begin:
+      TrackEvent(out, thread, sequence, event, event.StartNs, perfetto::TYPE_SLICE_BEGIN, track);
+      break;
+    case TraceEventType::End:
+      TrackEvent(out, thread, sequence, event, event.StartNs, perfetto::TYPE_SLICE_END, track);
+      break;
+    case TraceEventType::Instant:
+      TrackEvent(out, thread, sequence, event, event.StartNs, perfetto::TYPE_INSTANT, track);
+      break;
+    case TraceEventType::Counter:
+      TrackEvent(out, thread, sequence, event, event.StartNs, perfetto::TYPE_COUNTER,
+                 CounterTrack(out, event.Name()));
+      break;
+    }
+  }
+
+  void End(std::string &) override {}
+
+private:
+  static constexpr std::uint32_t SESSION_SEQUENCE = 1;
+
+  struct SequenceState {
+    bool Described = false;
+    std::uint64_t NextNameID = 1;
+    std::unordered_map<std::string, std::uint64_t> Names;
+  };
+
+  template <typename Fn> void Packet(std::string &out, std::uint32_t sequence, Fn &&fill) {
+    ProtoWriter writer(out);
+    writer.Nested(perfetto::TRACE_PACKET, [&] {
+      writer.UInt(perfetto::PACKET_SEQUENCE_ID, sequence);
+      fill(writer);
+    });
+  }
+
+  void TrackEvent(std::string &out, const TraceThreadInfo &thread, SequenceState &sequence,
+                  const TraceEvent &event, std::int64_t timestamp, std::uint64_t type,
+                  std::uint64_t track) {
+    bool dropped = thread.DroppedBefore > 0 && type != perfetto::TYPE_SLICE_END;
+    Packet(out, thread.Sequence, [&](ProtoWriter &packet) {
+      packet.UInt(perfetto::PACKET_TIMESTAMP, static_cast<std::uint64_t>(timestamp));
+      packet.UInt(perfetto::PACKET_TIMESTAMP_CLOCK_ID, perfetto::BUILTIN_CLOCK_MONOTONIC);
+      packet.UInt(perfetto::PACKET_SEQUENCE_FLAGS, perfetto::SEQ_NEEDS_INCREMENTAL_STATE);
+      if (dropped)
+        packet.Bool(perfetto::PACKET_PREVIOUS_DROPPED, true);
+
+      std::uint64_t name_id = 0;
+      if (type != perfetto::TYPE_SLICE_END && type != perfetto::TYPE_COUNTER) {
+        auto [found, inserted] = sequence.Names.try_emplace(std::string(event.Name()), 0);
+        if (inserted) {
+          found->second = sequence.NextNameID++;
+          packet.Nested(perfetto::PACKET_INTERNED_DATA, [&] {
+            packet.Nested(perfetto::INTERNED_EVENT_NAMES, [&] {
+              packet.UInt(perfetto::INTERNED_NAME_IID, found->second);
+              packet.String(perfetto::INTERNED_NAME_NAME, event.Name());
+            });
+          });
+        }
+        name_id = found->second;
+      }
+
+      packet.Nested(perfetto::PACKET_TRACK_EVENT, [&] {
+        packet.UInt(perfetto::EVENT_TYPE, type);
+        packet.UInt(perfetto::EVENT_TRACK_UUID, track);
+        if (name_id != 0) {
+          packet.UInt(perfetto::EVENT_NAME_IID, name_id);
+          if (event.Category)
+            packet.String(perfetto::EVENT_CATEGORIES, event.Category);
+          for (std::uint8_t i = 0; i < event.ArgCount; ++i)
+            Annotation(packet, event, event.Args[i]);
+          if (event.RequestID) {
+            Annotation(packet, "request_id", event.RequestID);
+            Annotation(packet, "span_id", event.SpanID);
+            if (event.ParentSpanID)
+              Annotation(packet, "parent_span_id", event.ParentSpanID);
+          }
+        }
+        if (type == perfetto::TYPE_COUNTER)
+          packet.Double(perfetto::EVENT_DOUBLE_COUNTER_VALUE, event.Value);
+      });
+    });
+  }
+
+  static void Annotation(ProtoWriter &packet, const TraceEvent &event, const TraceArg &arg) {
+    packet.Nested(perfetto::EVENT_DEBUG_ANNOTATIONS, [&] {
+      packet.String(perfetto::ANNOTATION_NAME, arg.Key);
+      switch (arg.Kind) {
+      case TraceArgKind::Int:
+        packet.Int(perfetto::ANNOTATION_INT_VALUE, arg.Int);
+        break;
+      case TraceArgKind::Double:
+        packet.Double(perfetto::ANNOTATION_DOUBLE_VALUE, arg.Double);
+        break;
+      case TraceArgKind::String:
+        packet.String(perfetto::ANNOTATION_STRING_VALUE, event.StringArg(arg));
+        break;
+      }
+    });
+  }
+
+  static void Annotation(ProtoWriter &packet, std::string_view name, std::uint64_t value) {
+    packet.Nested(perfetto::EVENT_DEBUG_ANNOTATIONS, [&] {
+      packet.String(perfetto::ANNOTATION_NAME, name);
+      packet.UInt(perfetto::ANNOTATION_UINT_VALUE, value);
+    });
+  }
+
+  std::uint64_t ProcessTrack(void) const { return m_ProcessID; }
+
+  std::uint64_t ThreadTrack(std::uint64_t thread_id) const {
+    return (std::uint64_t(m_ProcessID) << 32 | (thread_id & 0xffffffff)) ^ (1ull << 62);
+  }
+
+  // Counters are process scoped tracks, described on first use.
+  std::uint64_t CounterTrack(std::string &out, std::string_view name) {
+    auto [found, inserted] = m_Counters.try_emplace(std::string(name), 0);
+    if (inserted) {
+      found->second = (std::hash<std::string_view>{}(name) | (1ull << 63)) ^ m_ProcessID;
+      Packet(out, SESSION_SEQUENCE, [&](ProtoWriter &packet) {
+        packet.Nested(perfetto::PACKET_TRACK_DESCRIPTOR, [&] {
+          packet.UInt(perfetto::TRACK_UUID, found->second);
+          packet.UInt(perfetto::TRACK_PARENT_UUID, ProcessTrack());
+          packet.String(perfetto::TRACK_NAME, name);
+          packet.Nested(perfetto::TRACK_COUNTER, [] {});
+        });
+      });
+    }
+    return found->second;
+  }
+
+private:
+  std::uint32_t m_ProcessID = 0;
+  std::unordered_map<std::uint32_t, SequenceState> m_Sequences;
+  std::unordered_map<std::string, std::uint64_t> m_Counters;
+};
+#pragma endregion PerfettoEncoder
+} // namespace trace
+} // namespace simperf
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace simperf {
+#pragma region Process
+inline std::uint32_t current_process_id(void) {
+#if defined(_WIN32)
+  return static_cast<std::uint32_t>(_getpid());
+#else
+  return static_cast<std::uint32_t>(::getpid());
+#endif
+}
+
+// Pairs a steady_clock reading with the wall clock so traces from different processes (each with
+// its own arbitrary steady epoch) can be put on one timeline: realtime = steady + offset.
+struct ClockAnchor {
+  std::int64_t SteadyMicroseconds;
+  std::int64_t RealtimeMicroseconds;
+
+  std::int64_t Offset(void) const { return RealtimeMicroseconds - SteadyMicroseconds; }
+
+  static ClockAnchor Capture(void) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    // Bracket the wall clock read and take the midpoint to halve the skew between the two.
+    auto before = std::chrono::steady_clock::now();
+    auto realtime = std::chrono::system_clock::now();
+    auto after = std::chrono::steady_clock::now();
+    auto steady = before + (after - before) / 2;
+    return {duration_cast<microseconds>(steady.time_since_epoch()).count(),
+            duration_cast<microseconds>(realtime.time_since_epoch()).count()};
+  }
+};
+
+// "trace.json" in process 1234 becomes "trace.1234.json".
+inline std::string per_process_path(const std::string &path, std::uint32_t pid) {
+  std::filesystem::path p(path);
+  auto renamed = p.parent_path() / p.stem();
+  renamed += "." + std::to_string(pid);
+  renamed += p.extension();
+  return renamed.string();
+}
+#pragma endregion Process
+} // namespace simperf
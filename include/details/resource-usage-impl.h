@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+namespace simperf {
+#pragma region ResourceUsage
+// What the kernel accounted to the calling thread. Fields the platform cannot report stay zero and
+// Cpu stays -1.
+struct ResourceUsage {
+  std::int64_t CpuNs = 0;
+  std::int64_t VoluntarySwitches = 0;
+  std::int64_t InvoluntarySwitches = 0;
+  std::int64_t MinorFaults = 0;
+  std::int64_t MajorFaults = 0;
+  int Cpu = -1;
+
+  static ResourceUsage Capture(void) {
+    ResourceUsage usage;
+#if defined(__linux__)
+    timespec cpu_time;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time) == 0)
+      usage.CpuNs = static_cast<std::int64_t>(cpu_time.tv_sec) * 1'000'000'000 + cpu_time.tv_nsec;
+    rusage thread_usage;
+    if (::getrusage(RUSAGE_THREAD, &thread_usage) == 0) {
+      usage.VoluntarySwitches = thread_usage.ru_nvcsw;
+      usage.InvoluntarySwitches = thread_usage.ru_nivcsw;
+      usage.MinorFaults = thread_usage.ru_minflt;
+      usage.MajorFaults = thread_usage.ru_majflt;
+    }
+    usage.Cpu = ::sched_getcpu();
+#endif
+    return usage;
+  }
+};
+
+struct ResourceUsageDelta {
+  std::int64_t CpuNs;
+  std::int64_t VoluntarySwitches;
+  std::int64_t InvoluntarySwitches;
+  std::int64_t MinorFaults;
+  std::int64_t MajorFaults;
+  bool Migrated; // ended on a different core than it began on
+
+  static ResourceUsageDelta Between(const ResourceUsage &begin, const ResourceUsage &end) {
+    return {end.CpuNs - begin.CpuNs,
+            end.VoluntarySwitches - begin.VoluntarySwitches,
+            end.InvoluntarySwitches - begin.InvoluntarySwitches,
+            end.MinorFaults - begin.MinorFaults,
+            end.MajorFaults - begin.MajorFaults,
+            begin.Cpu != end.Cpu};
+  }
+};
+#pragma endregion ResourceUsage
+
+#pragma region UsageSite
+struct UsageSiteStats {
+  std::string_view Name;
+  std::string_view Tag;
+  std::string_view File;
+  std::uint32_t Line;
+  std::uint64_t Samples;
+  std::chrono::nanoseconds WallTime;
+  std::chrono::nanoseconds CpuTime;
+  std::uint64_t VoluntarySwitches;
+  std::uint64_t InvoluntarySwitches;
+  std::uint64_t MinorFaults;
+  std::uint64_t MajorFaults;
+  std::uint64_t Migrations;
+};
+
+class UsageSite;
+
+// Resource usage is opt-in per tag; no tag is enabled until SetTagEnabled() says so.
+class UsageSiteRegistry {
+public:
+  static void Register(UsageSite &site) {
+    std::lock_guard lock(s_Lock);
+    s_Sites.push_back(&site);
+  }
+
+  static void SetTagEnabled(std::string_view tag, bool enabled = true) {
+    std::lock_guard lock(s_Lock);
+    if (enabled)
+      s_EnabledTags.emplace(tag);
+    else
+      s_EnabledTags.erase(std::string(tag));
+    s_Generation.fetch_add(1, std::memory_order_release);
+  }
+
+  static bool TagEnabled(std::string_view tag) {
+    std::lock_guard lock(s_Lock);
+    return s_EnabledTags.contains(std::string(tag));
+  }
+
+  static std::uint64_t Generation(void) { return s_Generation.load(std::memory_order_acquire); }
+
+  static std::vector<UsageSiteStats> Stats(void);
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::lock_guard lock(s_Lock);
+    for (UsageSite *site : s_Sites)
+      fn(*site);
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<UsageSite *> s_Sites;
+  inline static std::unordered_set<std::string> s_EnabledTags;
+  inline static std::atomic<std::uint64_t> s_Generation{1};
+};
+
+// One static UsageSite per SIMPERF_PROFILE_SCOPE_USAGE expansion. Whether its tag is enabled is
+// cached against the registry generation, so a disabled site costs one atomic load.
+class UsageSite {
+public:
+  UsageSite(const char *name, const char *tag,
+            std::source_location location = std::source_location::current())
+      : m_Name(name), m_Tag(tag), m_Location(location) {
+    UsageSiteRegistry::Register(*this);
+  }
+
+  UsageSite(const UsageSite &) = delete;
+  UsageSite &operator=(const UsageSite &) = delete;
+
+  const char *Name(void) const { return m_Name; }
+  const char *Tag(void) const { return m_Tag; }
+  const std::source_location &Location(void) const { return m_Location; }
+
+  bool Enabled(void) {
+    auto generation = UsageSiteRegistry::Generation();
+    if (m_CheckedGeneration.load(std::memory_order_relaxed) != generation) [[unlikely]] {
+      m_Enabled.store(UsageSiteRegistry::TagEnabled(m_Tag), std::memory_order_relaxed);
+      m_CheckedGeneration.store(generation, std::memory_order_relaxed);
+    }
+    return m_Enabled.load(std::memory_order_relaxed);
+  }
+
+  void Record(std::chrono::nanoseconds wall, const ResourceUsageDelta &delta) {
+    m_Samples.fetch_add(1, std::memory_order_relaxed);
+    m_WallNs.fetch_add(wall.count(), std::memory_order_relaxed);
+    m_CpuNs.fetch_add(delta.CpuNs, std::memory_order_relaxed);
+    m_VoluntarySwitches.fetch_add(delta.VoluntarySwitches, std::memory_order_relaxed);
+    m_InvoluntarySwitches.fetch_add(delta.InvoluntarySwitches, std::memory_order_relaxed);
+    m_MinorFaults.fetch_add(delta.MinorFaults, std::memory_order_relaxed);
+    m_MajorFaults.fetch_add(delta.MajorFaults, std::memory_order_relaxed);
+    if (delta.Migrated)
+      m_Migrations.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  UsageSiteStats Stats(void) const {
+    return {m_Name,
+            m_Tag,
+            m_Location.file_name(),
+            m_Location.line(),
+            m_Samples.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(m_WallNs.load(std::memory_order_relaxed)),
+            std::chrono::nanoseconds(m_CpuNs.load(std::memory_order_relaxed)),
+            static_cast<std::uint64_t>(m_VoluntarySwitches.load(std::memory_order_relaxed)),
+            static_cast<std::uint64_t>(m_InvoluntarySwitches.load(std::memory_order_relaxed)),
+            static_cast<std::uint64_t>(m_MinorFaults.load(std::memory_order_relaxed)),
+            static_cast<std::uint64_t>(m_MajorFaults.load(std::memory_order_relaxed)),
+            m_Migrations.load(std::memory_order_relaxed)};
+  }
+
+private:
+  const char *m_Name;
+  const char *m_Tag;
+  std::source_location m_Location;
+  std::atomic<std::uint64_t> m_CheckedGeneration{0};
+  std::atomic_bool m_Enabled{false};
+  std::atomic<std::uint64_t> m_Samples{0};
+  std::atomic<std::int64_t> m_WallNs{0};
+  std::atomic<std::int64_t> m_CpuNs{0};
+  std::atomic<std::int64_t> m_VoluntarySwitches{0};
+  std::atomic<std::int64_t> m_InvoluntarySwitches{0};
+  std::atomic<std::int64_t> m_MinorFaults{0};
+  std::atomic<std::int64_t> m_MajorFaults{0};
+  std::atomic<std::uint64_t> m_Migrations{0};
+};
+
+inline std::vector<UsageSiteStats> UsageSiteRegistry::Stats(void) {
+  std::lock_guard lock(s_Lock);
+  std::vector<UsageSiteStats> stats;
+  stats.reserve(s_Sites.size());
+  for (const UsageSite *site : s_Sites)
+    stats.push_back(site->Stats());
+  return stats;
+}
+#pragma endregion UsageSite
+} // namespace simperf
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <ucontext.h>
+#endif
+
+#include "scope-stack-impl.h"
+#include "spsc-ring-impl.h"
+#include "trace-collector-impl.h"
+
+#if defined(__linux__) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace simperf {
+#pragma region Sampler
+static constexpr std::size_t SAMPLE_MAX_FRAMES = 24;
+static constexpr std::size_t SAMPLE_SCOPE_SIZE = 48;
+static constexpr std::size_t SAMPLE_RING_CAPACITY = 512; // must be a power of two
+
+// Written by the SIGPROF handler on the sampled thread, read by the sampler thread.
+struct SampleRecord {
+  std::int64_t TimestampNs; // steady_clock
+  std::uint32_t Depth;
+  std::uint8_t ScopeSize;
+  char Scope[SAMPLE_SCOPE_SIZE]; // copied: the scope's name may not outlive it
+  std::uintptr_t Frames[SAMPLE_MAX_FRAMES];
+};
+
+// Samples per (enclosing instrumented scope, sampled function).
+struct SampleStats {
+  std::string Scope;
+  std::string Function;
+  std::uint64_t Samples;
+};
+
+// Statistical profiling of registered threads: a per-thread CPU time timer raises SIGPROF, whose
+// handler walks the frame pointer chain into the thread's ring. A backend thread symbolizes the
+// samples and writes them into the current trace session as "sample" instant events on the
+// sampled thread's track, tagged with the enclosing SIMPERF scope.
+//
+// Stacks are only as deep as the frame pointers allow, so build with -fno-omit-frame-pointer.
+// Functions of the executable itself are named only when it is linked with -rdynamic.
+class Sampler {
+public:
+  Sampler(const Sampler &) = delete;
+  Sampler(Sampler &&) = delete;
+
+  static Sampler &Get() {
+    static Sampler instance;
+    return instance;
+  }
+
+#if defined(__linux__)
+  // Installs the SIGPROF handler, starts the backend thread and registers the calling thread.
+  // Threads still registered from before a Stop() are sampled again.
+  bool Start(std::chrono::microseconds interval = std::chrono::microseconds(1000)) {
+    {
+      std::lock_guard lock(m_ThreadsLock);
+      if (m_Running.load(std::memory_order_acquire))
+        return true;
+      struct sigaction action{};
+      action.sa_sigaction = &Sampler::OnSignal;
+      action.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      if (::sigaction(SIGPROF, &action, &m_PreviousAction) != 0)
+        return false;
+      m_Interval = interval;
+      for (const auto &thread : m_Threads)
+        if (!thread->Released)
+          Arm(*thread);
+      m_StopRequested = false;
+      m_Running.store(true, std::memory_order_release);
+      m_Thread = std::make_unique<std::thread>([this] { Run(); });
+    }
+    return RegisterThread();
+  }
+
+  // Disarms every thread's timer, writes out what was sampled so far and joins the backend.
+  void Stop(void) {
+    {
+      std::lock_guard lock(m_ThreadsLock);
+      if (!m_Running.load(std::memory_order_acquire))
+        return;
+      m_Running.store(false, std::memory_order_release);
+      for (const auto &thread : m_Threads)
+        thread->Disarm();
+    }
+    {
+      std::lock_guard wake(m_WakeLock);
+      m_StopRequested = true;
+    }
+    m_WakeCondition.notify_one();
+    m_Thread->join();
+    m_Thread.reset();
+    // A SIGPROF from a timer deleted above may still be pending, and the previous action is
+    // usually SIG_DFL, which would terminate the process. Ignoring the signal discards it.
+    struct sigaction ignore{};
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    ::sigaction(SIGPROF, &ignore, nullptr);
+    ::sigaction(SIGPROF, &m_PreviousAction, nullptr);
+  }
+
+  // Starts sampling the calling thread until it exits or calls UnregisterThread().
+  bool RegisterThread(void) {
+    auto &holder = ThreadHolder::Local();
+    if (holder.Thread)
+      return true;
+
+    auto thread = std::make_shared<SampledThread>();
+    thread->ThreadID = trace::current_thread_id();
+    pthread_attr_t attributes;
+    if (::pthread_getattr_np(::pthread_self(), &attributes) == 0) {
+      void *stack = nullptr;
+      std::size_t size = 0;
+      ::pthread_attr_getstack(&attributes, &stack, &size);
+      ::pthread_attr_destroy(&attributes);
+      thread->StackLow = reinterpret_cast<std::uintptr_t>(stack);
+      thread->StackHigh = thread->StackLow + size;
+    }
+    thread->Events = trace::TraceCollector::Get().AttachRing(thread->ThreadID);
+
+    std::lock_guard lock(m_ThreadsLock);
+    if (!m_Running.load(std::memory_order_acquire))
+      return false;
+
+    tl_Thread = thread.get();
+    if (!Arm(*thread)) {
+      tl_Thread = nullptr;
+      thread->Events->Events.Orphan();
+      return false;
+    }
+    holder.Thread = thread;
+    m_Threads.push_back(thread);
+    return true;
+  }
+
+  void UnregisterThread(void) { ThreadHolder::Local().Release(); }
+#else
+  bool Start(std::chrono::microseconds interval = std::chrono::microseconds(1000)) {
+    (void)interval;
+    return false;
+  }
+  void Stop(void) {}
+  bool RegisterThread(void) { return false; }
+  void UnregisterThread(void) {}
+#endif
+
+  bool Running(void) const { return m_Running.load(std::memory_order_acquire); }
+
+  std::uint64_t SampleCount(void) const { return m_Samples.load(std::memory_order_relaxed); }
+
+  std::uint64_t DroppedCount(void) const { return m_Dropped.load(std::memory_order_relaxed); }
+
+  // Most sampled first.
+  std::vector<SampleStats> Stats(void) {
+    std::lock_guard lock(m_StatsLock);
+    std::vector<SampleStats> stats;
+    stats.reserve(m_Stats.size());
+    for (const auto &[key, samples] : m_Stats)
+      stats.push_back({key.first, key.second, samples});
+    std::sort(stats.begin(), stats.end(),
+              [](const SampleStats &a, const SampleStats &b) { return a.Samples > b.Samples; });
+    return stats;
+  }
+
+private:
+#if defined(__linux__)
+  Sampler() {
+    pthread_atfork(&Sampler::PrepareFork, &Sampler::AfterForkInParent, &Sampler::AfterForkInChild);
+  }
+#else
+  Sampler() = default;
+#endif
+
+  ~Sampler() { Stop(); }
+
+#if defined(__linux__)
+  // Taking every lock across fork() means the child never inherits the thread list, the stats or
+  // the wake state in the middle of an update.
+  static void PrepareFork(void) {
+    auto &sampler = Get();
+    sampler.m_ThreadsLock.lock();
+    sampler.m_WakeLock.lock();
+    sampler.m_StatsLock.lock();
+  }
+
+  static void AfterForkInParent(void) {
+    auto &sampler = Get();
+    sampler.m_StatsLock.unlock();
+    sampler.m_WakeLock.unlock();
+    sampler.m_ThreadsLock.unlock();
+  }
+
+  // Neither the backend thread nor any timer survives fork() (timers are not inherited, so there
+  // is nothing to delete), and the only thread left is the one that forked. The child is left
+  // stopped, with every known thread released, so that Stop() at exit returns at once and Start()
+  // begins afresh. Only state is reset here, with nothing allocated, freed or started.
+  static void AfterForkInChild(void) {
+    auto &sampler = Get();
+    if (sampler.m_Running.load(std::memory_order_relaxed))
+      ::sigaction(SIGPROF, &sampler.m_PreviousAction, nullptr);
+    sampler.m_Running.store(false, std::memory_order_relaxed);
+    (void)sampler.m_Thread.release(); // never joinable here, and destroying it would terminate()
+    sampler.m_StopRequested = false;
+    std::construct_at(&sampler.m_WakeCondition); // the backend may have been waiting on it
+    for (const auto &thread : sampler.m_Threads) {
+      thread->HasTimer = false;
+      thread->Released = true;
+      thread->Samples.Discard(); // the parent writes these
+      thread->Samples.Orphan();
+    }
+    if (tl_Thread != nullptr) {
+      tl_Thread = nullptr;
+      ThreadHolder::Local().Thread.reset(); // m_Threads still holds it
+    }
+    sampler.m_StatsLock.unlock();
+    sampler.m_WakeLock.unlock();
+    sampler.m_ThreadsLock.unlock();
+  }
+
+  struct SampledThread {
+    SpscRing<SampleRecord, SAMPLE_RING_CAPACITY> Samples;
+    std::uint64_t ThreadID = 0;
+    std::uintptr_t StackLow = 0;
+    std::uintptr_t StackHigh = 0;
+    timer_t Timer{};
+    bool HasTimer = false;
+    bool Released = false; // by the thread itself; never armed again
+    std::shared_ptr<trace::TraceRing> Events; // on ThreadID's track, written by the backend
+    std::atomic<std::uint64_t> Dropped{0};
+
+    // Note: you must already own m_ThreadsLock, or be the thread itself, to call Disarm()
+    void Disarm(void) {
+      if (HasTimer)
+        ::timer_delete(Timer);
+      HasTimer = false;
+    }
+  };
+
+  struct ThreadHolder {
+    std::shared_ptr<SampledThread> Thread;
+
+    static ThreadHolder &Local(void) {
+      thread_local ThreadHolder holder;
+      return holder;
+    }
+
+    // The handler is detached before the timer goes, so a signal still in flight finds nothing.
+    void Release(void) {
+      if (!Thread)
+        return;
+      tl_Thread = nullptr;
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      {
+        std::lock_guard lock(Sampler::Get().m_ThreadsLock);
+        Thread->Disarm();
+        Thread->Released = true;
+      }
+      Thread->Samples.Orphan();
+      Thread.reset();
+    }
+
+    ~ThreadHolder() { Release(); }
+  };
+
+  // A CPU time timer for `thread`, raising SIGPROF on it every m_Interval.
+  // Note: you must already own m_ThreadsLock before calling Arm()
+  bool Arm(SampledThread &thread) {
+    sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = static_cast<pid_t>(thread.ThreadID);
+    if (::timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &thread.Timer) != 0)
+      return false;
+    thread.HasTimer = true;
+
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(m_Interval);
+    itimerspec spec{};
+    spec.it_interval.tv_sec = static_cast<time_t>(seconds.count());
+    spec.it_interval.tv_nsec = static_cast<long>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(m_Interval - seconds).count());
+    spec.it_value = spec.it_interval;
+    ::timer_settime(thread.Timer, 0, &spec, nullptr);
+    return true;
+  }
+
+  // Async-signal-safe: no locks, no allocation, only the calling thread's own state.
+  static void OnSignal(int, siginfo_t *, void *context) {
+    SampledThread *thread = tl_Thread;
+    if (thread == nullptr)
+      return;
+    int saved_errno = errno;
+    SampleRecord *record = thread->Samples.Reserve();
+    if (record == nullptr) {
+      thread->Dropped.fetch_add(1, std::memory_order_relaxed);
+      errno = saved_errno;
+      return;
+    }
+
+    timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    record->TimestampNs = static_cast<std::int64_t>(now.tv_sec) * 1'000'000'000 + now.tv_nsec;
+
+    const char *scope = ScopeStack::Local().Top();
+    std::size_t scope_size = scope ? ::strnlen(scope, SAMPLE_SCOPE_SIZE) : 0;
+    std::memcpy(record->Scope, scope ? scope : "", scope_size);
+    record->ScopeSize = static_cast<std::uint8_t>(scope_size);
+
+    record->Depth = WalkStack(static_cast<const ucontext_t *>(context), thread->StackLow,
+                              thread->StackHigh, record->Frames);
+    thread->Samples.Commit();
+    errno = saved_errno;
+  }
+
+  static std::uint32_t WalkStack(const ucontext_t *context, std::uintptr_t low,
+                                 std::uintptr_t high, std::uintptr_t (&frames)[SAMPLE_MAX_FRAMES]) {
+#if defined(__x86_64__)
+    auto pc = static_cast<std::uintptr_t>(context->uc_mcontext.gregs[REG_RIP]);
+    auto fp = static_cast<std::uintptr_t>(context->uc_mcontext.gregs[REG_RBP]);
+#elif defined(__aarch64__)
+    auto pc = static_cast<std::uintptr_t>(context->uc_mcontext.pc);
+    auto fp = static_cast<std::uintptr_t>(context->uc_mcontext.regs[29]);
+#else
+    (void)context;
+    (void)low;
+    (void)high;
+    (void)frames;
+    return 0;
+#endif
+#if defined(__x86_64__) || defined(__aarch64__)
+    std::uint32_t depth = 0;
+    frames[depth++] = pc;
+    // Every frame must lie on this thread's stack, above the last one; anything else ends the walk
+    // rather than risk a fault inside the handler.
+    while (depth < SAMPLE_MAX_FRAMES && fp >= low && fp + 2 * sizeof(std::uintptr_t) <= high &&
+           fp % alignof(std::uintptr_t) == 0) {
+      const auto *frame = reinterpret_cast<const std::uintptr_t *>(fp);
+      std::uintptr_t next = frame[0];
+      std::uintptr_t return_address = frame[1];
+      if (return_address == 0)
+        break;
+      frames[depth++] = return_address;
+      if (next <= fp)
+        break;
+      fp = next;
+    }
+    return depth;
+#endif
+  }
+
+  void Run(void) {
+    for (;;) {
+      bool stopping;
+      {
+        std::unique_lock lock(m_WakeLock);
+        m_WakeCondition.wait_for(lock, std::chrono::milliseconds(10),
+                                 [&] { return m_StopRequested; });
+        stopping = m_StopRequested;
+      }
+      DrainAll();
+      if (stopping)
+        break;
+    }
+  }
+
+  void DrainAll(void) {
+    std::vector<std::shared_ptr<SampledThread>> threads;
+    {
+      std::lock_guard lock(m_ThreadsLock);
+      threads = m_Threads;
+    }
+
+    auto &collector = trace::TraceCollector::Get();
+    for (const auto &thread : threads) {
+      m_Dropped.fetch_add(thread->Dropped.exchange(0, std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+      while (const SampleRecord *record = thread->Samples.Front()) {
+        std::string_view scope(record->Scope, record->ScopeSize);
+        const std::string &function =
+            record->Depth ? Symbolize(record->Frames[0], false) : Unknown();
+        {
+          std::lock_guard lock(m_StatsLock);
+          ++m_Stats[{std::string(scope), function}];
+        }
+        m_Samples.fetch_add(1, std::memory_order_relaxed);
+
+        if (trace::TraceEvent *event = collector.ReserveIn(*thread->Events)) {
+          event->Reset(trace::TraceEventType::Instant, function, "sample");
+          event->StartNs = record->TimestampNs;
+          if (!scope.empty())
+            event->AddArg("scope", scope);
+          if (record->Depth > 1)
+            event->AddArg("caller", Symbolize(record->Frames[1], true));
+          event->AddArg(trace::TraceArg::Integer("depth", record->Depth));
+          collector.Commit(*thread->Events);
+        }
+        thread->Samples.Pop();
+      }
+    }
+
+    std::lock_guard lock(m_ThreadsLock);
+    std::erase_if(m_Threads, [](const std::shared_ptr<SampledThread> &thread) {
+      bool done = thread->Samples.Orphaned() && thread->Samples.Front() == nullptr;
+      if (done)
+        thread->Events->Events.Orphan();
+      return done;
+    });
+  }
+
+  static const std::string &Unknown(void) {
+    static const std::string unknown = "[unknown]";
+    return unknown;
+  }
+
+  // Return addresses point after the call, so they are looked up one byte back.
+  const std::string &Symbolize(std::uintptr_t address, bool return_address) {
+    auto lookup = return_address ? address - 1 : address;
+    auto [found, inserted] = m_Symbols.try_emplace(lookup);
+    if (!inserted)
+      return found->second;
+
+    Dl_info info{};
+    if (::dladdr(reinterpret_cast<void *>(lookup), &info) && info.dli_sname) {
+      int status = 0;
+      char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+      found->second = status == 0 && demangled ? demangled : info.dli_sname;
+      std::free(demangled);
+    } else if (info.dli_fname) {
+      std::string_view module = info.dli_fname;
+      if (auto slash = module.find_last_of('/'); slash != std::string_view::npos)
+        module.remove_prefix(slash + 1);
+      found->second = std::format("{}+{:#x}", module,
+                                  lookup - reinterpret_cast<std::uintptr_t>(info.dli_fbase));
+    } else {
+      found->second = std::format("{:#x}", lookup);
+    }
+    return found->second;
+  }
+
+  inline static thread_local SampledThread *tl_Thread = nullptr;
+
+  std::mutex m_ThreadsLock;
+  std::vector<std::shared_ptr<SampledThread>> m_Threads;
+  struct sigaction m_PreviousAction{};
+  std::chrono::microseconds m_Interval{1000};
+  std::unique_ptr<std::thread> m_Thread;
+
+  std::mutex m_WakeLock;
+  std::condition_variable m_WakeCondition;
+  bool m_StopRequested{false};
+
+  std::unordered_map<std::uintptr_t, std::string> m_Symbols; // backend thread only
+#endif
+
+  std::atomic_bool m_Running{false};
+  std::atomic<std::uint64_t> m_Samples{0};
+  std::atomic<std::uint64_t> m_Dropped{0};
+  std::mutex m_StatsLock;
+  std::map<std::pair<std::string, std::string>, std::uint64_t> m_Stats;
+};
+#pragma endregion Sampler
+} // namespace simperf
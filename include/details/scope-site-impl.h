@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <source_location>
+#include <string_view>
+#include <vector>
+
+namespace simperf {
+#pragma region ScopeSite
+struct ScopeSiteStats {
+  std::string_view Name;
+  std::string_view File;
+  std::uint32_t Line;
+  std::chrono::nanoseconds Budget;
+  std::uint64_t Overruns;
+  std::chrono::nanoseconds WorstOverrun;
+};
+
+// One static ScopeSite per budgeted profiling macro expansion. Counters are only written on an
+// overrun, so a scope that stays within budget never touches shared cache lines.
+class ScopeSite {
+public:
+  ScopeSite(const char *name, std::chrono::nanoseconds budget,
+            std::source_location location = std::source_location::current());
+
+  ScopeSite(const ScopeSite &) = delete;
+  ScopeSite &operator=(const ScopeSite &) = delete;
+
+  const char *Name(void) const { return m_Name; }
+  std::chrono::nanoseconds Budget(void) const { return m_Budget; }
+  const std::source_location &Location(void) const { return m_Location; }
+
+  void RecordOverrun(std::chrono::nanoseconds overrun) {
+    m_Overruns.fetch_add(1, std::memory_order_relaxed);
+    auto worst = m_WorstOverrunNs.load(std::memory_order_relaxed);
+    while (overrun.count() > worst &&
+           !m_WorstOverrunNs.compare_exchange_weak(worst, overrun.count(),
+                                                   std::memory_order_relaxed)) {
+    }
+  }
+
+  std::uint64_t Overruns(void) const { return m_Overruns.load(std::memory_order_relaxed); }
+
+  ScopeSiteStats Stats(void) const {
+    return {m_Name,
+            m_Location.file_name(),
+            m_Location.line(),
+            m_Budget,
+            m_Overruns.load(std::memory_order_relaxed),
+            std::chrono::nanoseconds(m_WorstOverrunNs.load(std::memory_order_relaxed))};
+  }
+
+private:
+  const char *m_Name;
+  std::chrono::nanoseconds m_Budget;
+  std::source_location m_Location;
+  std::atomic<std::uint64_t> m_Overruns{0};
+  std::atomic<std::int64_t> m_WorstOverrunNs{0};
+};
+
+class ScopeSiteRegistry {
+public:
+  static void Register(ScopeSite &site) {
+    std::lock_guard lock(s_Lock);
+    s_Sites.push_back(&site);
+  }
+
+  static std::vector<ScopeSiteStats> Stats(void) {
+    std::lock_guard lock(s_Lock);
+    std::vector<ScopeSiteStats> stats;
+    stats.reserve(s_Sites.size());
+    for (const ScopeSite *site : s_Sites)
+      stats.push_back(site->Stats());
+    return stats;
+  }
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::lock_guard lock(s_Lock);
+    for (ScopeSite *site : s_Sites)
+      fn(*site);
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<ScopeSite *> s_Sites;
+};
+
+inline ScopeSite::ScopeSite(const char *name, std::chrono::nanoseconds budget,
+                            std::source_location location)
+    : m_Name(name), m_Budget(budget), m_Location(location) {
+  ScopeSiteRegistry::Register(*this);
+}
+#pragma endregion ScopeSite
+} // namespace simperf
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "signal-registry-impl.h"
+
+#if !defined(SIMPERF_COLD)
+#if defined(_MSC_VER)
+#define SIMPERF_NOINLINE __declspec(noinline)
+#define SIMPERF_COLD
+#else
+#define SIMPERF_NOINLINE __attribute__((noinline))
+#define SIMPERF_COLD __attribute__((cold))
+#endif
+#endif
+
+namespace simperf {
+#pragma region ScopeStack
+static constexpr std::size_t SCOPE_STACK_DEPTH = 64;
+static constexpr std::size_t SCOPE_STACK_THREADS = 512; // threads beyond this are not listed
+
+// The instrumented scopes the calling thread is currently inside, innermost last, with the
+// steady_clock nanoseconds each was entered at (0 for scopes that were not timed). Signal handlers
+// on any thread may read it at any point, so each store is ordered before the depth change that
+// publishes it. Scopes nested deeper than SCOPE_STACK_DEPTH are counted but not kept.
+struct ScopeStack {
+  const char *Names[SCOPE_STACK_DEPTH];
+  std::int64_t StartNs[SCOPE_STACK_DEPTH];
+  std::uint32_t Depth;
+  bool Registered;
+  std::uint64_t ThreadID;
+
+  static ScopeStack &Local(void) { return tl_Stack; }
+
+  // Every thread that has entered a scope, until it exits.
+  static const SignalRegistry<ScopeStack, SCOPE_STACK_THREADS> &Threads(void) { return s_Threads; }
+
+  void Push(const char *name, std::int64_t start_ns = 0) {
+    if (!Registered) [[unlikely]]
+      Register();
+    if (Depth < SCOPE_STACK_DEPTH) {
+      Names[Depth] = name;
+      StartNs[Depth] = start_ns;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    ++Depth;
+  }
+
+  // Only the forking thread exists in the child; forget the others and take up the new thread ID.
+  static void AfterForkInChild(void) {
+    ScopeStack *self = &tl_Stack;
+    s_Threads.ReleaseIf([self](const ScopeStack &stack) { return &stack != self; });
+    if (self->Registered)
+      self->ThreadID = CurrentThreadID();
+  }
+
+  void Pop(void) {
+    std::atomic_signal_fence(std::memory_order_release);
+    --Depth;
+  }
+
+  std::size_t Size(void) const { return std::min<std::size_t>(Depth, SCOPE_STACK_DEPTH); }
+
+  // nullptr outside of any scope.
+  const char *Top(void) const { return Depth == 0 ? nullptr : Names[Size() - 1]; }
+
+private:
+  struct Registration {
+    std::size_t Slot;
+    ~Registration() { s_Threads.Release(Slot); }
+  };
+
+  static std::uint64_t CurrentThreadID(void) {
+#if defined(__linux__)
+    return static_cast<std::uint64_t>(::syscall(SYS_gettid));
+#else
+    return 0;
+#endif
+  }
+
+  // Once per thread, so kept out of Push().
+  SIMPERF_NOINLINE SIMPERF_COLD void Register(void) {
+    Registered = true;
+    ThreadID = CurrentThreadID();
+    thread_local Registration registration{s_Threads.Claim(this)};
+    (void)registration;
+  }
+
+  static thread_local ScopeStack tl_Stack;
+  static SignalRegistry<ScopeStack, SCOPE_STACK_THREADS> s_Threads;
+};
+
+inline thread_local ScopeStack ScopeStack::tl_Stack{};
+inline SignalRegistry<ScopeStack, SCOPE_STACK_THREADS> ScopeStack::s_Threads;
+#pragma endregion ScopeStack
+} // namespace simperf
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace simperf {
+#pragma region SignalRegistry
+// A fixed set of pointers that signal handlers may walk at any time: claiming and releasing a slot
+// are single atomic operations and nothing is ever allocated or locked. Items must outlive their
+// slot. Claim() returns Capacity once every slot is taken, which Release() ignores.
+template <typename T, std::size_t Capacity> class SignalRegistry {
+public:
+  constexpr SignalRegistry() = default;
+
+  SignalRegistry(const SignalRegistry &) = delete;
+  SignalRegistry &operator=(const SignalRegistry &) = delete;
+
+  std::size_t Claim(T *item) {
+    for (std::size_t slot = 0; slot < Capacity; ++slot) {
+      T *expected = nullptr;
+      if (m_Slots[slot].compare_exchange_strong(expected, item, std::memory_order_release,
+                                                std::memory_order_relaxed))
+        return slot;
+    }
+    return Capacity;
+  }
+
+  void Release(std::size_t slot) {
+    if (slot < Capacity)
+      m_Slots[slot].store(nullptr, std::memory_order_release);
+  }
+
+  // E.g. in a forked child, for the parent's threads that did not come along.
+  template <typename Pred> void ReleaseIf(Pred &&pred) {
+    for (auto &slot : m_Slots) {
+      T *item = slot.load(std::memory_order_acquire);
+      if (item && pred(*item))
+        slot.store(nullptr, std::memory_order_release);
+    }
+  }
+
+  template <typename Fn> void ForEach(Fn &&fn) const {
+    for (const auto &slot : m_Slots) {
+      if (T *item = slot.load(std::memory_order_acquire))
+        fn(*item);
+    }
+  }
+
+private:
+  std::atomic<T *> m_Slots[Capacity]{};
+};
+#pragma endregion SignalRegistry
+} // namespace simperf
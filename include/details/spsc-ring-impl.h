@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace simperf {
+#pragma region SpscRing
+// Single producer (the owning thread), single consumer (a backend thread). Records are written in
+// place: Reserve() a slot, fill it, Commit() it; the consumer reads Front() in place and Pop()s it.
+template <typename Record, std::size_t Capacity> class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  Record *Reserve(void) {
+    auto head = m_Head.load(std::memory_order_relaxed);
+    if (head - m_CachedTail >= Capacity) {
+      m_CachedTail = m_Tail.load(std::memory_order_acquire);
+      if (head - m_CachedTail >= Capacity)
+        return nullptr;
+    }
+    return &m_Records[head & (Capacity - 1)];
+  }
+
+  void Commit(void) {
+    m_Head.store(m_Head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  const Record *Front(void) const {
+    auto tail = m_Tail.load(std::memory_order_relaxed);
+    if (tail == m_Head.load(std::memory_order_acquire))
+      return nullptr;
+    return &m_Records[tail & (Capacity - 1)];
+  }
+
+  void Pop(void) {
+    m_Tail.store(m_Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer side: throws away everything currently committed.
+  void Discard(void) {
+    m_Tail.store(m_Head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  // Reads what is committed but not yet popped, oldest first, without consuming it. Safe from a
+  // signal handler; records the consumer pops meanwhile may be overwritten while being read.
+  template <typename Fn> void ForEachPending(Fn &&fn) const {
+    auto head = m_Head.load(std::memory_order_acquire);
+    auto tail = m_Tail.load(std::memory_order_acquire);
+    for (; tail != head; ++tail)
+      fn(m_Records[tail & (Capacity - 1)]);
+  }
+
+  void Orphan(void) { m_Orphaned.store(true, std::memory_order_release); }
+
+  bool Orphaned(void) const { return m_Orphaned.load(std::memory_order_acquire); }
+
+private:
+  std::array<Record, Capacity> m_Records;
+  alignas(64) std::atomic<std::uint64_t> m_Head{0};
+  std::uint64_t m_CachedTail{0};
+  alignas(64) std::atomic<std::uint64_t> m_Tail{0};
+  std::atomic_bool m_Orphaned{false};
+};
+#pragma endregion SpscRing
+} // namespace simperf
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "scope-stack-impl.h"
+
+namespace simperf {
+#pragma region TailLatency
+struct TailLatencyOptions {
+  bool Enabled = false;
+  std::chrono::nanoseconds Threshold{std::chrono::milliseconds(1)};
+  // Overrides of Threshold by scope name.
+  std::vector<std::pair<std::string, std::chrono::nanoseconds>> SiteThresholds;
+};
+
+// Keeps only the scopes that took at least their threshold, plus the scopes that were open around
+// them on the same thread, so every outlier is written in context. Faster scopes end on their own
+// thread without touching the trace ring and are only counted, per site where there is one.
+//
+// An ancestor is kept as it ends: the slow scope marks the stack depth above which the enclosing
+// scopes still owe an event, and each of them passes the mark down as it closes.
+class TailLatency {
+public:
+  static void SetOptions(const TailLatencyOptions &options) {
+    {
+      std::lock_guard lock(s_Lock);
+      s_Options = options;
+    }
+    s_ThresholdNs.store(options.Threshold.count(), std::memory_order_relaxed);
+    s_Generation.fetch_add(1, std::memory_order_release);
+    s_Enabled.store(options.Enabled, std::memory_order_release);
+  }
+
+  static TailLatencyOptions Options(void) {
+    std::lock_guard lock(s_Lock);
+    return s_Options;
+  }
+
+  static bool Enabled(void) { return s_Enabled.load(std::memory_order_relaxed); }
+
+  static std::int64_t ThresholdNs(void) { return s_ThresholdNs.load(std::memory_order_relaxed); }
+
+  // Moves whenever the options do, so sites can cache ThresholdFor().
+  static std::uint64_t Generation(void) { return s_Generation.load(std::memory_order_acquire); }
+
+  static std::int64_t ThresholdFor(std::string_view name) {
+    std::lock_guard lock(s_Lock);
+    for (const auto &[site, threshold] : s_Options.SiteThresholds) {
+      if (site == name)
+        return threshold.count();
+    }
+    return s_Options.Threshold.count();
+  }
+
+  // Note: call while the ending scope is still the innermost one on ScopeStack::Local()
+  static bool Keep(std::int64_t duration_ns, std::int64_t threshold_ns) {
+    std::uint32_t index = ScopeStack::Local().Depth - 1;
+    if (duration_ns < threshold_ns && index >= tl_KeepBelow)
+      return false;
+    tl_KeepBelow = index;
+    return true;
+  }
+
+  // The innermost scope ends without an event; it passes on whatever it owed.
+  static void Skip(void) {
+    std::uint32_t index = ScopeStack::Local().Depth - 1;
+    tl_KeepBelow = std::min(tl_KeepBelow, index);
+  }
+
+  // Fast scopes of no particular site, e.g. timers constructed directly.
+  static void CountDropped(void) { s_UnsitedDropped.fetch_add(1, std::memory_order_relaxed); }
+
+  static std::uint64_t UnsitedDropped(void) {
+    return s_UnsitedDropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static TailLatencyOptions s_Options;
+  inline static std::atomic_bool s_Enabled{false};
+  inline static std::atomic<std::int64_t> s_ThresholdNs{1'000'000};
+  inline static std::atomic<std::uint64_t> s_Generation{1};
+  inline static std::atomic<std::uint64_t> s_UnsitedDropped{0};
+  inline static thread_local std::uint32_t tl_KeepBelow = 0;
+};
+#pragma endregion TailLatency
+} // namespace simperf
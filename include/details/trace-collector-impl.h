@@ -0,0 +1,494 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "perfetto-impl.h"
+#include "signal-registry-impl.h"
+#include "trace-event-impl.h"
+#include "trace-json-impl.h"
+#include "trace-writer-impl.h"
+
+namespace simperf {
+namespace trace {
+#pragma region TraceCollector
+// Owns the per-thread rings and, while a session is open, a writer thread that drains them through
+// the session's encoder into the output file.
+class TraceCollector {
+public:
+  TraceCollector(const TraceCollector &) = delete;
+  TraceCollector(TraceCollector &&) = delete;
+
+  static TraceCollector &Get() {
+    static TraceCollector instance;
+    return instance;
+  }
+
+  bool Active(void) const { return m_Active.load(std::memory_order_relaxed); }
+
+  // Hot path. Returns nullptr when no session is open or the ring is full; otherwise the caller
+  // fills the slot and calls Commit(reservation).
+  TraceEvent *Reserve(TraceReservation &reservation) {
+    if (!Active()) {
+      if (!ResumePending() || !ResumeAfterFork())
+        return nullptr;
+    }
+    if (m_CpuCapture.load(std::memory_order_acquire)) {
+      CpuRing &ring = *m_CpuRings[current_cpu() % m_CpuRings.size()];
+      reservation.Cpu = &ring;
+      reservation.ThreadID = CachedThreadID();
+      reservation.Event = ring.Events.Reserve(reservation.Position);
+      if (reservation.Event == nullptr) [[unlikely]]
+        ring.Dropped.fetch_add(1, std::memory_order_relaxed);
+      return reservation.Event;
+    }
+    TraceRing &ring = ThreadRing();
+    reservation.Ring = &ring;
+    reservation.Event = ring.Events.Reserve();
+    if (reservation.Event == nullptr) [[unlikely]]
+      ring.Dropped.fetch_add(1, std::memory_order_relaxed);
+    return reservation.Event;
+  }
+
+  void Commit(const TraceReservation &reservation) {
+    if (reservation.Cpu) {
+      reservation.Event->ThreadID = reservation.ThreadID;
+      reservation.Cpu->Events.Commit(reservation.Position);
+    } else {
+      reservation.Ring->Events.Commit();
+    }
+  }
+
+  void Commit(TraceRing &ring) { ring.Events.Commit(); }
+
+  // Events given up on after `reservation` failed, counted with the ones Reserve() dropped.
+  void CountDropped(const TraceReservation &reservation, std::uint64_t count) {
+    if (reservation.Cpu)
+      reservation.Cpu->Dropped.fetch_add(count, std::memory_order_relaxed);
+    else if (reservation.Ring)
+      reservation.Ring->Dropped.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  // Constructs the calling thread's ring holder, so that a thread_local constructed afterwards is
+  // destroyed first and may still Reserve() from its destructor.
+  void PrepareThread(void) { (void)ThreadRingHolder::Local(); }
+
+  // The rings of live producing threads, for signal handlers; see CrashHandler.
+  static const SignalRegistry<TraceRing, TRACE_RING_THREADS> &ThreadRings(void) {
+    return s_ThreadRings;
+  }
+
+  // A ring on `thread_id`'s track for a producer other than that thread, e.g. a backend thread
+  // writing events on its behalf. Orphan() it when done.
+  std::shared_ptr<TraceRing> AttachRing(std::uint64_t thread_id) {
+    auto sequence = m_NextSequence.fetch_add(1, std::memory_order_relaxed);
+    auto ring = std::make_shared<TraceRing>(sequence, thread_id);
+    std::lock_guard lock(m_RingsLock);
+    m_Rings.push_back(ring);
+    return ring;
+  }
+
+  // Like Reserve() for a ring from AttachRing(); only its one producer may call this.
+  TraceEvent *ReserveIn(TraceRing &ring) {
+    if (!Active())
+      return nullptr;
+    TraceEvent *event = ring.Events.Reserve();
+    if (event == nullptr) [[unlikely]]
+      ring.Dropped.fetch_add(1, std::memory_order_relaxed);
+    return event;
+  }
+
+  void SetThreadName(std::string_view name) {
+    {
+      std::lock_guard lock(m_RingsLock);
+      m_CpuThreadNames[CachedThreadID()] = name;
+      ++m_CpuThreadNamesVersion;
+      if (m_CaptureMode == CaptureMode::PerCpu)
+        return;
+    }
+    TraceRing &ring = ThreadRing();
+    std::lock_guard lock(m_RingsLock);
+    ring.ThreadName = name;
+  }
+
+  // Takes effect from the next BeginSession().
+  void SetCaptureMode(CaptureMode mode) {
+    std::lock_guard lock(m_SessionLock);
+    std::lock_guard rings(m_RingsLock);
+    m_CaptureMode = mode;
+  }
+
+  CaptureMode GetCaptureMode(void) {
+    std::lock_guard lock(m_SessionLock);
+    std::lock_guard rings(m_RingsLock);
+    return m_CaptureMode;
+  }
+
+  std::size_t CpuRingCount(void) const { return m_CpuRings.size(); }
+
+  void SetPollInterval(std::chrono::milliseconds interval) {
+    m_PollIntervalMs.store(interval.count(), std::memory_order_relaxed);
+  }
+
+  // Takes effect from the next BeginSession().
+  void SetWriterOptions(const TraceWriterOptions &options) {
+    std::lock_guard lock(m_SessionLock);
+    m_WriterOptions = options;
+  }
+
+  TraceWriterOptions WriterOptions(void) {
+    std::lock_guard lock(m_SessionLock);
+    return m_WriterOptions;
+  }
+
+  // Ends the current session first, if any. Events still queued from an earlier session are
+  // discarded rather than written into this one.
+  bool BeginSession(const TraceSessionInfo &info, const std::string &path, TraceFormat format) {
+    std::lock_guard lock(m_SessionLock);
+    m_ResumeAfterFork.store(false, std::memory_order_relaxed);
+    InternalEndSession();
+    return InternalBeginSession(info, path, format);
+  }
+
+  // Writes everything captured before the call, then the footer, and closes the file. A forked
+  // child that recorded nothing since the fork writes no file.
+  void EndSession(void) {
+    std::lock_guard lock(m_SessionLock);
+    m_ResumeAfterFork.store(false, std::memory_order_relaxed);
+    InternalEndSession();
+  }
+
+  // Whether this is a forked child whose parent had a session open, and the child's own session
+  // has not started yet.
+  bool ResumePending(void) const { return m_ResumeAfterFork.load(std::memory_order_relaxed); }
+
+  // Starts the session a forked child continues in, next to the parent's file. The child's first
+  // event does this; call it to start the session, and the file, before then.
+  bool ResumeAfterFork(void) {
+    std::lock_guard lock(m_SessionLock);
+    if (!m_ResumeAfterFork.exchange(false, std::memory_order_relaxed))
+      return Active();
+    auto pid = current_process_id();
+    return InternalBeginSession({m_Info.Name, pid, m_Info.ProcessID, ClockAnchor::Capture()},
+                                per_process_path(m_Path, pid), m_Format);
+  }
+
+  const std::string &SessionPath(void) const { return m_Path; }
+
+  const TraceSessionInfo &SessionInfo(void) const { return m_Info; }
+
+  std::uint64_t DroppedCount(void) const { return m_Dropped.load(std::memory_order_relaxed); }
+
+  // Events lost to full rings in the session that ended last.
+  std::uint64_t LastSessionDropped(void) const {
+    return m_LastSessionDropped.load(std::memory_order_relaxed);
+  }
+
+  // Write submissions made for the current or, once it has ended, the last session.
+  std::uint64_t WriteSubmissions(void) {
+    std::lock_guard lock(m_WriteLock);
+    return m_Writer.Submissions();
+  }
+
+#if !defined(_WIN32)
+  // Taking every lock across fork() means the child never inherits a half drained ring, a half
+  // written file or a ring list in the middle of an update.
+  void PrepareFork(void) {
+    m_SessionLock.lock();
+    m_WakeLock.lock();
+    m_WriteLock.lock();
+    m_RingsLock.lock();
+  }
+
+  void AfterForkInParent(void) {
+    m_RingsLock.unlock();
+    m_WriteLock.unlock();
+    m_WakeLock.unlock();
+    m_SessionLock.unlock();
+  }
+
+  // The writer thread does not exist in the child and every queued event belongs to the parent.
+  // The child drops both, along with its copy of the parent's file. Only state is reset here, with
+  // nothing allocated, freed or started; if a session was open the child continues in one of its
+  // own from ResumeAfterFork().
+  void AfterForkInChild(void) {
+    bool was_active = Active();
+    m_Active.store(false, std::memory_order_relaxed);
+    (void)m_Thread.release(); // never joinable here, and destroying it would terminate()
+    // The writer may have been waiting on it; destroying it at exit would wait for that thread.
+    std::construct_at(&m_WakeCondition);
+    m_StopRequested = false;
+    for (const auto &ring : m_Rings) {
+      ring->Events.Discard();
+      ring->Events.Orphan(); // its thread is gone, or gets a ring with its new ID; freed later
+      ring->Dropped.store(0, std::memory_order_relaxed);
+    }
+    for (const auto &ring : m_CpuRings) {
+      ring->Events.Reset(); // slots the parent's other threads were filling never complete here
+      ring->Dropped.store(0, std::memory_order_relaxed);
+    }
+    s_ThreadRings.ReleaseIf([](const TraceRing &) { return true; });
+    auto &holder = ThreadRingHolder::Local();
+    if (holder.Ring) {
+      holder.Slot = TRACE_RING_THREADS;
+      holder.Ring.reset(); // m_Rings still holds it
+    }
+    tl_ThreadID = 0;
+    m_Dropped.store(0, std::memory_order_relaxed);
+    m_Buffer.clear();
+    m_Writer.Abandon(); // the parent still owns, and will write, whatever was pending
+    m_ResumeAfterFork.store(was_active, std::memory_order_relaxed);
+    m_RingsLock.unlock();
+    m_WriteLock.unlock();
+    m_WakeLock.unlock();
+    m_SessionLock.unlock();
+  }
+#endif
+
+private:
+  TraceCollector() = default;
+
+  ~TraceCollector() { EndSession(); }
+
+  struct ThreadRingHolder {
+    std::shared_ptr<TraceRing> Ring;
+    std::size_t Slot = TRACE_RING_THREADS;
+
+    static ThreadRingHolder &Local(void) {
+      thread_local ThreadRingHolder holder;
+      return holder;
+    }
+
+    ~ThreadRingHolder() {
+      if (Ring) {
+        s_ThreadRings.Release(Slot);
+        Ring->Events.Orphan();
+      }
+    }
+  };
+
+  // current_thread_id() is a system call on Linux; per-CPU events need it for every write.
+  static std::uint32_t CachedThreadID(void) {
+    if (tl_ThreadID == 0) [[unlikely]]
+      tl_ThreadID = static_cast<std::uint32_t>(current_thread_id());
+    return tl_ThreadID;
+  }
+
+  TraceRing &ThreadRing(void) {
+    auto &holder = ThreadRingHolder::Local();
+    if (!holder.Ring) [[unlikely]] {
+      holder.Ring = std::make_shared<TraceRing>(
+          m_NextSequence.fetch_add(1, std::memory_order_relaxed), current_thread_id());
+      holder.Slot = s_ThreadRings.Claim(holder.Ring.get());
+      std::lock_guard lock(m_RingsLock);
+      m_Rings.push_back(holder.Ring);
+    }
+    return *holder.Ring;
+  }
+
+  // Note: you must already own m_SessionLock before calling InternalBeginSession()
+  bool InternalBeginSession(const TraceSessionInfo &info, const std::string &path,
+                            TraceFormat format) {
+    if (!m_Writer.Open(path, m_WriterOptions))
+      return false;
+
+    m_Info = info;
+    m_Path = path;
+    m_Format = format;
+    if (format == TraceFormat::Perfetto)
+      m_Encoder = std::make_unique<PerfettoEncoder>();
+    else
+      m_Encoder = std::make_unique<ChromeJsonEncoder>();
+
+    // No writer is running, so this thread is the only consumer. The CPU rings are never freed:
+    // a producer may still be inside Reserve() from a session that already ended.
+    {
+      std::lock_guard lock(m_RingsLock);
+      for (const auto &ring : m_Rings) {
+        ring->Events.Discard();
+        ring->Dropped.store(0, std::memory_order_relaxed);
+      }
+      if (m_CaptureMode == CaptureMode::PerCpu && m_CpuRings.empty()) {
+        m_CpuRings.resize(std::max(1u, std::thread::hardware_concurrency()));
+        for (auto &ring : m_CpuRings)
+          ring = std::make_unique<CpuRing>();
+      }
+      for (const auto &ring : m_CpuRings) {
+        ring->Events.Discard();
+        ring->Dropped.store(0, std::memory_order_relaxed);
+      }
+      m_CpuCapture.store(m_CaptureMode == CaptureMode::PerCpu, std::memory_order_release);
+    }
+
+    m_Encoder->Begin(m_Info, m_Buffer);
+    WriteBuffer();
+    m_StopRequested = false;
+    m_Active.store(true, std::memory_order_release);
+    m_Thread = std::make_unique<std::thread>([this] { Run(); });
+    return true;
+  }
+
+  // Note: you must already own m_SessionLock before calling InternalEndSession()
+  void InternalEndSession(void) {
+    if (!m_Thread)
+      return;
+    m_Active.store(false, std::memory_order_release);
+    {
+      std::lock_guard wake(m_WakeLock);
+      m_StopRequested = true;
+    }
+    m_WakeCondition.notify_one();
+    m_Thread->join();
+    m_Thread.reset();
+
+    m_Encoder->End(m_Buffer);
+    WriteBuffer();
+    m_Writer.Close();
+    m_Encoder.reset();
+
+    auto dropped = m_Dropped.exchange(0, std::memory_order_relaxed);
+    m_LastSessionDropped.store(dropped, std::memory_order_relaxed);
+    if (dropped)
+      spdlog::default_logger_raw()->warn("trace rings full, dropped {} event(s) from '{}'",
+                                         dropped, m_Path);
+  }
+
+  void Run(void) {
+    for (;;) {
+      bool stopping;
+      {
+        std::unique_lock lock(m_WakeLock);
+        m_WakeCondition.wait_for(
+            lock, std::chrono::milliseconds(m_PollIntervalMs.load(std::memory_order_relaxed)),
+            [&] { return m_StopRequested; });
+        stopping = m_StopRequested;
+      }
+
+      {
+        std::lock_guard lock(m_WriteLock);
+        DrainAll();
+        WriteBuffer();
+        if (stopping || m_Writer.ShouldFlush(std::chrono::steady_clock::now()))
+          m_Writer.Flush();
+      }
+
+      if (stopping)
+        break;
+    }
+  }
+
+  // Note: you must already own m_WriteLock before calling DrainAll()
+  void DrainAll(void) {
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+      std::lock_guard lock(m_RingsLock);
+      rings = m_Rings;
+      m_ThreadNames.resize(rings.size());
+      for (std::size_t i = 0; i < rings.size(); ++i)
+        m_ThreadNames[i] = rings[i]->ThreadName;
+      if (m_CpuThreadNamesDrained != m_CpuThreadNamesVersion) {
+        m_CpuThreadNamesCopy = m_CpuThreadNames;
+        m_CpuThreadNamesDrained = m_CpuThreadNamesVersion;
+      }
+    }
+
+    for (std::size_t i = 0; i < rings.size(); ++i) {
+      TraceRing &ring = *rings[i];
+      auto dropped = ring.Dropped.exchange(0, std::memory_order_relaxed);
+      m_Dropped.fetch_add(dropped, std::memory_order_relaxed);
+      TraceThreadInfo thread{ring.Sequence, ring.ThreadID, m_ThreadNames[i], dropped};
+      while (const TraceEvent *event = ring.Events.Front()) {
+        m_Encoder->Encode(thread, *event, m_Buffer);
+        thread.DroppedBefore = 0;
+        ring.Events.Pop();
+      }
+    }
+    DrainCpuRings();
+
+    std::lock_guard lock(m_RingsLock);
+    std::erase_if(m_Rings, [](const std::shared_ptr<TraceRing> &ring) {
+      return ring->Events.Orphaned() && ring->Events.Front() == nullptr;
+    });
+  }
+
+  // Each thread seen in a CPU ring still gets a packet sequence, and a track, of its own.
+  // Note: you must already own m_WriteLock before calling DrainCpuRings()
+  void DrainCpuRings(void) {
+    for (const auto &ring : m_CpuRings) {
+      auto dropped = ring->Dropped.exchange(0, std::memory_order_relaxed);
+      m_Dropped.fetch_add(dropped, std::memory_order_relaxed);
+      while (const TraceEvent *event = ring->Events.Front()) {
+        auto [sequence, inserted] = m_CpuSequences.try_emplace(event->ThreadID, 0);
+        if (inserted)
+          sequence->second = m_NextSequence.fetch_add(1, std::memory_order_relaxed);
+        auto name = m_CpuThreadNamesCopy.find(event->ThreadID);
+        TraceThreadInfo thread{sequence->second, event->ThreadID,
+                               name == m_CpuThreadNamesCopy.end() ? std::string_view()
+                                                                  : std::string_view(name->second),
+                               dropped};
+        m_Encoder->Encode(thread, *event, m_Buffer);
+        dropped = 0;
+        ring->Events.Pop();
+      }
+    }
+  }
+
+  // Moves encoded output into the writer's blocks; the writer decides when it reaches the file.
+  void WriteBuffer(void) {
+    m_Writer.Append(m_Buffer);
+    m_Buffer.clear();
+  }
+
+private:
+  std::atomic_bool m_Active{false};
+  std::atomic_bool m_ResumeAfterFork{false};
+  std::atomic<std::uint32_t> m_NextSequence{2}; // 1 is the session's own sequence
+  std::atomic<std::int64_t> m_PollIntervalMs{10};
+  std::atomic<std::uint64_t> m_Dropped{0};
+  std::atomic<std::uint64_t> m_LastSessionDropped{0};
+
+  std::mutex m_SessionLock;
+  std::unique_ptr<std::thread> m_Thread;
+  TraceSessionInfo m_Info{};
+  std::string m_Path;
+  TraceFormat m_Format = TraceFormat::ChromeJson;
+  TraceWriterOptions m_WriterOptions;
+
+  std::mutex m_WakeLock;
+  std::condition_variable m_WakeCondition;
+  bool m_StopRequested{false};
+
+  std::mutex m_WriteLock;
+  std::unique_ptr<TraceEncoder> m_Encoder;
+  std::string m_Buffer;
+  TraceFileWriter m_Writer;
+  std::vector<std::string> m_ThreadNames;
+
+  std::mutex m_RingsLock;
+  std::vector<std::shared_ptr<TraceRing>> m_Rings;
+  CaptureMode m_CaptureMode = CaptureMode::PerThread;
+  std::unordered_map<std::uint64_t, std::string> m_CpuThreadNames; // every named thread
+  std::uint64_t m_CpuThreadNamesVersion = 0;
+
+  // Sized once, by the first per-CPU session, and read without a lock by Reserve() from then on.
+  std::vector<std::unique_ptr<CpuRing>> m_CpuRings;
+  std::atomic_bool m_CpuCapture{false};
+
+  // Writer side of per-CPU capture, guarded by m_WriteLock.
+  std::unordered_map<std::uint64_t, std::uint32_t> m_CpuSequences;
+  std::unordered_map<std::uint64_t, std::string> m_CpuThreadNamesCopy;
+  std::uint64_t m_CpuThreadNamesDrained = 0;
+
+  inline static SignalRegistry<TraceRing, TRACE_RING_THREADS> s_ThreadRings;
+  inline static thread_local std::uint32_t tl_ThreadID = 0;
+};
+#pragma endregion TraceCollector
+} // namespace trace
+} // namespace simperf
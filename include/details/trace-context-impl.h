@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+#include "process-impl.h"
+
+namespace simperf {
+#pragma region TraceContext
+// Which request the calling thread is working for. RequestID 0 means none.
+struct TraceContext {
+  std::uint64_t RequestID = 0;
+  std::uint64_t SpanID = 0;
+  std::uint64_t ParentSpanID = 0;
+  bool Recorded = true; // the session's RequestFilter, decided when the request was entered
+
+  // A new request with a random, non-zero ID, filtered by RequestFilter::Records().
+  static TraceContext NewRequest(void);
+
+  // Continues `request_id` from elsewhere, e.g. an ID received in an RPC header.
+  static TraceContext ForRequest(std::uint64_t request_id, std::uint64_t parent_span_id = 0);
+
+  // A new span of the current request whose parent is the current span.
+  static TraceContext ChildSpan(void) {
+    const TraceContext &current = Current();
+    if (current.RequestID == 0)
+      return current;
+    return {current.RequestID, NewID(), current.SpanID, current.Recorded};
+  }
+
+  static const TraceContext &Current(void) { return tl_Current; }
+
+  // For handing the current request to another thread; restore it there with TraceContextScope.
+  static TraceContext Capture(void) { return tl_Current; }
+
+  static std::uint64_t NewID(void) {
+    static const std::uint64_t seed = Mix(
+        static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+        (static_cast<std::uint64_t>(current_process_id()) << 32));
+    static std::atomic<std::uint64_t> counter{0};
+    std::uint64_t id;
+    do {
+      id = Mix(seed + counter.fetch_add(1, std::memory_order_relaxed) * 0x9e3779b97f4a7c15ull);
+    } while (id == 0);
+    return id;
+  }
+
+  // splitmix64's finalizer.
+  static std::uint64_t Mix(std::uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+  }
+
+private:
+  friend class TraceContextScope;
+  static thread_local TraceContext tl_Current;
+};
+
+inline thread_local TraceContext TraceContext::tl_Current{};
+
+// Makes `context` current until the end of the scope, then restores the previous one.
+class TraceContextScope {
+public:
+  explicit TraceContextScope(const TraceContext &context) : m_Previous(TraceContext::tl_Current) {
+    TraceContext::tl_Current = context;
+  }
+
+  TraceContextScope(const TraceContextScope &) = delete;
+  TraceContextScope &operator=(const TraceContextScope &) = delete;
+
+  ~TraceContextScope() { TraceContext::tl_Current = m_Previous; }
+
+private:
+  TraceContext m_Previous;
+};
+
+// Restricts a trace session to some requests: those selected by ID plus one in `SampleEvery` of
+// the rest, picked by hashing the ID so every thread and process agrees. Events recorded outside
+// of any request are kept unless KeepUnscoped is false.
+class RequestFilter {
+public:
+  static void Enable(std::uint32_t sample_every, bool keep_unscoped = true) {
+    std::lock_guard lock(s_Lock);
+    s_SampleEvery = sample_every;
+    s_KeepUnscoped.store(keep_unscoped, std::memory_order_relaxed);
+    s_Enabled.store(true, std::memory_order_release);
+  }
+
+  static void Disable(void) {
+    std::lock_guard lock(s_Lock);
+    s_Enabled.store(false, std::memory_order_release);
+    s_KeepUnscoped.store(true, std::memory_order_relaxed);
+    s_Selected.clear();
+  }
+
+  static void Select(std::uint64_t request_id) {
+    std::lock_guard lock(s_Lock);
+    s_Selected.insert(request_id);
+  }
+
+  static void Deselect(std::uint64_t request_id) {
+    std::lock_guard lock(s_Lock);
+    s_Selected.erase(request_id);
+  }
+
+  static bool KeepUnscoped(void) { return s_KeepUnscoped.load(std::memory_order_relaxed); }
+
+  static bool Records(std::uint64_t request_id) {
+    if (!s_Enabled.load(std::memory_order_acquire))
+      return true;
+    std::lock_guard lock(s_Lock);
+    if (s_Selected.contains(request_id))
+      return true;
+    return s_SampleEvery != 0 && TraceContext::Mix(request_id) % s_SampleEvery == 0;
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::atomic_bool s_Enabled{false};
+  inline static std::atomic_bool s_KeepUnscoped{true};
+  inline static std::uint32_t s_SampleEvery = 0;
+  inline static std::unordered_set<std::uint64_t> s_Selected;
+};
+
+inline TraceContext TraceContext::NewRequest(void) { return ForRequest(NewID()); }
+
+inline TraceContext TraceContext::ForRequest(std::uint64_t request_id,
+                                             std::uint64_t parent_span_id) {
+  return {request_id, NewID(), parent_span_id, RequestFilter::Records(request_id)};
+}
+#pragma endregion TraceContext
+} // namespace simperf
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "mpsc-ring-impl.h"
+#include "process-impl.h"
+#include "spsc-ring-impl.h"
+
+namespace simperf {
+namespace trace {
+#pragma region TraceEvent
+// Events are captured into fixed-size slots of a per-thread ring and encoded by the writer thread,
+// so the hot path never formats, allocates or takes a lock.
+static constexpr std::size_t TRACE_EVENT_SIZE = 320;
+static constexpr std::size_t TRACE_RING_CAPACITY = 2048; // must be a power of two
+static constexpr std::size_t TRACE_CPU_RING_CAPACITY = 4096; // shared by a core's threads
+static constexpr std::size_t TRACE_RING_THREADS = 512; // rings a crash dump can reach
+static constexpr std::size_t TRACE_MAX_ARGS = 6;
+
+enum class TraceEventType : std::uint8_t { Complete, Begin, End, Instant, Counter };
+
+enum class TraceArgKind : std::uint8_t { Int, Double, String };
+
+// `Key` must have static storage duration; it is read after the scope that recorded it is gone.
+struct TraceArg {
+  const char *Key;
+  TraceArgKind Kind;
+  union {
+    std::int64_t Int; // String arguments keep (offset << 8 | size) into TraceEvent::Text here
+    double Double;
+  };
+
+  static TraceArg Integer(const char *key, std::int64_t value) {
+    TraceArg arg{key, TraceArgKind::Int, {}};
+    arg.Int = value;
+    return arg;
+  }
+
+  static TraceArg Real(const char *key, double value) {
+    TraceArg arg{key, TraceArgKind::Double, {}};
+    arg.Double = value;
+    return arg;
+  }
+};
+
+struct TraceEventHeader {
+  std::int64_t StartNs;    // steady_clock
+  std::int64_t DurationNs; // Complete events only
+  double Value;            // Counter events only
+  const char *Category;    // static storage duration
+  std::uint64_t RequestID; // TraceContext at capture time, 0 outside of a request
+  std::uint64_t SpanID;
+  std::uint64_t ParentSpanID;
+  TraceEventType Type;
+  std::uint8_t ArgCount;
+  std::uint8_t NameSize;
+  std::uint8_t TextSize;
+  bool Filtered;          // excluded from the session by its RequestFilter
+  std::uint32_t ThreadID; // per-CPU capture only, where one ring carries many threads
+  TraceArg Args[TRACE_MAX_ARGS];
+};
+
+static constexpr std::size_t TRACE_TEXT_SIZE = TRACE_EVENT_SIZE - sizeof(TraceEventHeader);
+
+// The event name and string arguments are copied into Text, names first; whatever does not fit
+// is truncated.
+struct TraceEvent : TraceEventHeader {
+  char Text[TRACE_TEXT_SIZE];
+
+  void Reset(TraceEventType type, std::string_view name, const char *category) {
+    Type = type;
+    Category = category;
+    RequestID = SpanID = ParentSpanID = 0;
+    Filtered = false;
+    ArgCount = 0;
+    DurationNs = 0;
+    Value = 0.0;
+    NameSize = static_cast<std::uint8_t>(std::min(name.size(), TRACE_TEXT_SIZE));
+    std::memcpy(Text, name.data(), NameSize);
+    TextSize = NameSize;
+  }
+
+  bool AddArg(const TraceArg &arg) {
+    if (ArgCount == TRACE_MAX_ARGS)
+      return false;
+    Args[ArgCount++] = arg;
+    return true;
+  }
+
+  bool AddArg(const char *key, std::string_view value) {
+    if (ArgCount == TRACE_MAX_ARGS)
+      return false;
+    auto size = std::min(value.size(), TRACE_TEXT_SIZE - TextSize);
+    std::memcpy(Text + TextSize, value.data(), size);
+    TraceArg &arg = Args[ArgCount++];
+    arg.Key = key;
+    arg.Kind = TraceArgKind::String;
+    arg.Int = static_cast<std::int64_t>(TextSize) << 8 | static_cast<std::int64_t>(size);
+    TextSize = static_cast<std::uint8_t>(TextSize + size);
+    return true;
+  }
+
+  void AddArgs(std::initializer_list<TraceArg> args) {
+    for (const auto &arg : args)
+      AddArg(arg);
+  }
+
+  std::string_view Name(void) const { return {Text, NameSize}; }
+
+  std::string_view StringArg(const TraceArg &arg) const {
+    return {Text + (arg.Int >> 8), static_cast<std::size_t>(arg.Int & 0xff)};
+  }
+};
+
+static_assert(sizeof(TraceEvent) == TRACE_EVENT_SIZE, "TraceEvent must fill exactly one slot");
+
+inline std::uint64_t current_thread_id(void) {
+#if defined(__linux__)
+  return static_cast<std::uint64_t>(::syscall(SYS_gettid));
+#elif defined(_WIN32)
+  return static_cast<std::uint64_t>(::GetCurrentThreadId());
+#else
+  return static_cast<std::uint64_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#endif
+}
+
+// Which ring a per-CPU capture writes to. Threads may migrate right after the call; that only
+// costs locality, since the rings take any number of writers.
+inline std::uint32_t current_cpu(void) {
+#if defined(__linux__)
+  int cpu = ::sched_getcpu();
+  return cpu < 0 ? 0 : static_cast<std::uint32_t>(cpu);
+#elif defined(_WIN32)
+  return static_cast<std::uint32_t>(::GetCurrentProcessorNumber());
+#else
+  return static_cast<std::uint32_t>(current_thread_id());
+#endif
+}
+
+inline std::int64_t steady_nanoseconds(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// One ring per producing thread. Each ring is its own Perfetto packet sequence.
+struct TraceRing {
+  TraceRing(std::uint32_t sequence, std::uint64_t thread_id)
+      : Sequence(sequence), ThreadID(thread_id) {}
+
+  SpscRing<TraceEvent, TRACE_RING_CAPACITY> Events;
+  const std::uint32_t Sequence;
+  const std::uint64_t ThreadID;
+  std::string ThreadName; // guarded by the collector's rings lock
+  std::atomic<std::uint64_t> Dropped{0};
+};
+
+// PerThread gives every producing thread its own ring; PerCpu shares one ring per core, which
+// bounds memory by the core count for processes with many mostly idle threads.
+enum class CaptureMode { PerThread, PerCpu };
+
+inline CaptureMode parse_capture_mode(std::string_view name) {
+  return name == "per_cpu" ? CaptureMode::PerCpu : CaptureMode::PerThread;
+}
+
+struct CpuRing {
+  MpscRing<TraceEvent, TRACE_CPU_RING_CAPACITY> Events;
+  std::atomic<std::uint64_t> Dropped{0};
+};
+
+// A slot taken by TraceCollector::Reserve(), handed back to Commit().
+struct TraceReservation {
+  TraceEvent *Event = nullptr;
+  TraceRing *Ring = nullptr; // per-thread capture
+  CpuRing *Cpu = nullptr;    // per-CPU capture
+  std::uint64_t Position = 0;
+  std::uint32_t ThreadID = 0;
+};
+#pragma endregion TraceEvent
+
+#pragma region TraceEncoder
+enum class TraceFormat { ChromeJson, Perfetto };
+
+inline TraceFormat parse_trace_format(std::string_view name) {
+  return name == "perfetto" || name == "protobuf" ? TraceFormat::Perfetto : TraceFormat::ChromeJson;
+}
+
+struct TraceSessionInfo {
+  std::string Name;
+  std::uint32_t ProcessID;
+  std::uint32_t ParentProcessID; // Non zero for a session started by a forked child
+  ClockAnchor Anchor;
+};
+
+// What the writer knows about the thread an event came from.
+struct TraceThreadInfo {
+  std::uint32_t Sequence;
+  std::uint64_t ThreadID;
+  std::string_view ThreadName;
+  std::uint64_t DroppedBefore; // events lost on this thread since its previous encoded event
+};
+
+// Encoders run on the writer thread only and append their output to `out`.
+class TraceEncoder {
+public:
+  virtual ~TraceEncoder() = default;
+  virtual void Begin(const TraceSessionInfo &session, std::string &out) = 0;
+  virtual void Encode(const TraceThreadInfo &thread, const TraceEvent &event, std::string &out) = 0;
+  virtual void End(std::string &out) = 0;
+};
+#pragma endregion TraceEncoder
+} // namespace trace
+} // namespace simperf
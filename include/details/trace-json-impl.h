@@ -0,0 +1,138 @@
+#pragma once
+
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "trace-event-impl.h"
+
+namespace simperf {
+namespace trace {
+#pragma region ChromeJsonEncoder
+inline void append_json_escaped(std::string &out, std::string_view text) {
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<int>(c));
+      else
+        out += c;
+    }
+  }
+}
+
+// The Chrome trace event format, loadable by chrome://tracing, Perfetto UI and speedscope.
+class ChromeJsonEncoder : public TraceEncoder {
+public:
+  void Begin(const TraceSessionInfo &session, std::string &out) override {
+    m_ProcessID = session.ProcessID;
+    // The anchor lets tools map this process' steady "ts" values onto the wall clock.
+    out += "{\"otherData\": {\"session\":\"";
+    append_json_escaped(out, session.Name);
+    std::format_to(std::back_inserter(out),
+                   "\",\"pid\":{},\"ppid\":{},\"clock_anchor\":{{\"steady_us\":{},"
+                   "\"realtime_us\":{}}}}},\"traceEvents\":[{{}}",
+                   session.ProcessID, session.ParentProcessID, session.Anchor.SteadyMicroseconds,
+                   session.Anchor.RealtimeMicroseconds);
+  }
+
+  void Encode(const TraceThreadInfo &thread, const TraceEvent &event, std::string &out) override {
+    auto inserter = std::back_inserter(out);
+    if (!thread.ThreadName.empty() && m_NamedThreads.insert(thread.ThreadID).second) {
+      std::format_to(inserter, ",{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                               "\"args\":{{\"name\":\"",
+                     m_ProcessID, thread.ThreadID);
+      append_json_escaped(out, thread.ThreadName);
+      out += "\"}}";
+    }
+
+    out += ",{\"cat\":\"";
+    append_json_escaped(out, event.Category ? event.Category : "function");
+    out += "\",";
+    if (event.Type == TraceEventType::Complete)
+      std::format_to(inserter, "\"dur\":{:.3f},", event.DurationNs / 1000.0);
+    out += "\"name\":\"";
+    append_json_escaped(out, event.Name());
+    std::format_to(inserter, "\",\"ph\":\"{}\",", Phase(event.Type));
+    if (event.Type == TraceEventType::Instant)
+      out += "\"s\":\"t\",";
+    std::format_to(inserter, "\"pid\":{},\"tid\":{},\"ts\":{:.3f}", m_ProcessID, thread.ThreadID,
+                   event.StartNs / 1000.0);
+
+    if (event.Type == TraceEventType::Counter) {
+      std::format_to(inserter, ",\"args\":{{\"value\":{}}}", event.Value);
+    } else if (event.ArgCount > 0 || event.RequestID) {
+      out += ",\"args\":{";
+      // IDs are written as hex strings; JSON numbers lose precision past 2^53.
+      if (event.RequestID) {
+        std::format_to(inserter, "\"request_id\":\"{:016x}\",\"span_id\":\"{:016x}\"",
+                       event.RequestID, event.SpanID);
+        if (event.ParentSpanID)
+          std::format_to(inserter, ",\"parent_span_id\":\"{:016x}\"", event.ParentSpanID);
+      }
+      for (std::uint8_t i = 0; i < event.ArgCount; ++i) {
+        const TraceArg &arg = event.Args[i];
+        if (i || event.RequestID)
+          out += ',';
+        out += '"';
+        append_json_escaped(out, arg.Key);
+        out += "\":";
+        switch (arg.Kind) {
+        case TraceArgKind::Int:
+          std::format_to(inserter, "{}", arg.Int);
+          break;
+        case TraceArgKind::Double:
+          std::format_to(inserter, "{}", arg.Double);
+          break;
+        case TraceArgKind::String:
+          out += '"';
+          append_json_escaped(out, event.StringArg(arg));
+          out += '"';
+          break;
+        }
+      }
+      out += '}';
+    }
+    out += '}';
+  }
+
+  void End(std::string &out) override { out += "]}"; }
+
+private:
+  static std::string_view Phase(TraceEventType type) {
+    switch (type) {
+    case TraceEventType::Complete:
+      return "X";
+    case TraceEventType::Begin:
+      return "B";
+    case TraceEventType::End:
+      return "E";
+    case TraceEventType::Instant:
+      return "i";
+    case TraceEventType::Counter:
+      return "C";
+    }
+    return "X";
+  }
+
+private:
+  std::uint32_t m_ProcessID = 0;
+  std::unordered_set<std::uint64_t> m_NamedThreads;
+};
+#pragma endregion ChromeJsonEncoder
+} // namespace trace
+} // namespace simperf
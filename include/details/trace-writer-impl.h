@@ -0,0 +1,445 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define SIMPERF_HAS_IO_URING 1
+#endif
+#endif
+
+namespace simperf {
+namespace trace {
+#pragma region TraceWriterOptions
+static constexpr std::size_t TRACE_WRITE_BLOCK_SIZE = 1 << 16;
+static constexpr std::size_t TRACE_WRITE_BLOCK_ALIGNMENT = 4096;
+
+// Encoded output is batched into aligned blocks and handed to the kernel once FlushBytes are
+// pending or FlushInterval has passed since the last write, whichever comes first.
+struct TraceWriterOptions {
+  std::chrono::milliseconds FlushInterval{1000};
+  std::size_t FlushBytes = 4 << 20;
+  bool IoUring = false; // falls back to pwritev() when io_uring is unavailable
+
+  bool operator==(const TraceWriterOptions &) const = default;
+};
+#pragma endregion TraceWriterOptions
+
+#pragma region IoUring
+#if defined(SIMPERF_HAS_IO_URING)
+// Just enough of io_uring to keep one vectored write in flight, through the raw syscalls.
+class IoUring {
+public:
+  IoUring() = default;
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  ~IoUring() { Close(); }
+
+  bool Setup(unsigned entries) {
+    io_uring_params params{};
+    m_Fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (m_Fd < 0)
+      return false;
+
+    m_SqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_CqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      m_SqSize = m_CqSize = std::max(m_SqSize, m_CqSize);
+
+    m_SqRing = Map(m_SqSize, IORING_OFF_SQ_RING);
+    m_CqRing = single_mmap ? m_SqRing : Map(m_CqSize, IORING_OFF_CQ_RING);
+    m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_Sqes = static_cast<io_uring_sqe *>(Map(m_SqesSize, IORING_OFF_SQES));
+    if (m_SqRing == MAP_FAILED || m_CqRing == MAP_FAILED || m_Sqes == MAP_FAILED) {
+      Close();
+      return false;
+    }
+
+    auto *sq = static_cast<std::byte *>(m_SqRing);
+    m_SqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_SqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_SqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto *cq = static_cast<std::byte *>(m_CqRing);
+    m_CqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_CqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_CqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_Cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // `iov` must stay valid until the matching WaitCompletion() returns.
+  bool SubmitWritev(int fd, const iovec *iov, unsigned count, std::uint64_t offset) {
+    unsigned tail = *m_SqTail;
+    unsigned index = tail & *m_SqMask;
+    io_uring_sqe *sqe = &m_Sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(iov);
+    sqe->len = count;
+    sqe->off = offset;
+    m_SqArray[index] = index;
+    __atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;) {
+      auto submitted = ::syscall(__NR_io_uring_enter, m_Fd, 1, 0, 0, nullptr, 0);
+      if (submitted >= 0)
+        return submitted == 1;
+      if (errno != EINTR)
+        return false;
+    }
+  }
+
+  // Returns the completed write's result: bytes written, or a negative errno.
+  std::int64_t WaitCompletion(void) {
+    for (;;) {
+      unsigned head = *m_CqHead;
+      if (head != __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE)) {
+        std::int64_t result = m_Cqes[head & *m_CqMask].res;
+        __atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+        return result;
+      }
+      if (::syscall(__NR_io_uring_enter, m_Fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+          errno != EINTR)
+        return -errno;
+    }
+  }
+
+  void Close(void) {
+    if (m_Sqes && m_Sqes != MAP_FAILED)
+      ::munmap(m_Sqes, m_SqesSize);
+    if (m_CqRing && m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+      ::munmap(m_CqRing, m_CqSize);
+    if (m_SqRing && m_SqRing != MAP_FAILED)
+      ::munmap(m_SqRing, m_SqSize);
+    if (m_Fd >= 0)
+      ::close(m_Fd);
+    m_Sqes = nullptr;
+    m_CqRing = m_SqRing = nullptr;
+    m_Fd = -1;
+  }
+
+private:
+  void *Map(std::size_t size, std::uint64_t offset) {
+    return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd,
+                  static_cast<off_t>(offset));
+  }
+
+private:
+  int m_Fd = -1;
+  void *m_SqRing = nullptr;
+  void *m_CqRing = nullptr;
+  std::size_t m_SqSize = 0;
+  std::size_t m_CqSize = 0;
+  std::size_t m_SqesSize = 0;
+  io_uring_sqe *m_Sqes = nullptr;
+  unsigned *m_SqTail = nullptr;
+  unsigned *m_SqMask = nullptr;
+  unsigned *m_SqArray = nullptr;
+  unsigned *m_CqHead = nullptr;
+  unsigned *m_CqTail = nullptr;
+  unsigned *m_CqMask = nullptr;
+  io_uring_cqe *m_Cqes = nullptr;
+};
+#endif
+#pragma endregion IoUring
+
+#pragma region TraceFileWriter
+// Used by the collector's writer thread only.
+class TraceFileWriter {
+public:
+  TraceFileWriter() = default;
+  TraceFileWriter(const TraceFileWriter &) = delete;
+  TraceFileWriter &operator=(const TraceFileWriter &) = delete;
+
+  ~TraceFileWriter() { Close(); }
+
+  bool Open(const std::string &path, const TraceWriterOptions &options) {
+    Close();
+#if defined(_WIN32)
+    m_Stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_Stream.is_open())
+      return false;
+#else
+    m_Fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_Fd < 0)
+      return false;
+#endif
+    m_Options = options;
+    m_Offset = 0;
+    RecycleBlocks(m_Pending); // whatever a forked child abandoned
+#if !defined(_WIN32)
+    RecycleBlocks(m_InFlightBlocks);
+#endif
+    m_PendingBytes = 0;
+    m_Submissions = 0;
+    m_LastFlush = std::chrono::steady_clock::now();
+#if defined(SIMPERF_HAS_IO_URING)
+    m_UsingIoUring = options.IoUring && m_Ring.Setup(4);
+#endif
+    return true;
+  }
+
+  bool IsOpen(void) const {
+#if defined(_WIN32)
+    return m_Stream.is_open();
+#else
+    return m_Fd >= 0;
+#endif
+  }
+
+  bool UsingIoUring(void) const { return m_UsingIoUring; }
+
+  // Write submissions made since Open(); one per pwritev() or io_uring submission.
+  std::uint64_t Submissions(void) const { return m_Submissions; }
+
+  void Append(std::string_view data) {
+    while (!data.empty()) {
+      if (m_Pending.empty() || m_Pending.back().Size == TRACE_WRITE_BLOCK_SIZE)
+        m_Pending.push_back(TakeBlock());
+      Block &block = m_Pending.back();
+      auto size = std::min(data.size(), TRACE_WRITE_BLOCK_SIZE - block.Size);
+      std::memcpy(block.Data.get() + block.Size, data.data(), size);
+      block.Size += size;
+      m_PendingBytes += size;
+      data.remove_prefix(size);
+    }
+  }
+
+  bool ShouldFlush(std::chrono::steady_clock::time_point now) const {
+    return m_PendingBytes >= m_Options.FlushBytes ||
+           (m_PendingBytes > 0 && now - m_LastFlush >= m_Options.FlushInterval);
+  }
+
+  // Hands every pending block to the kernel. With io_uring the last batch may still be in flight
+  // when this returns; the next Flush() or Close() waits for it.
+  void Flush(void) {
+    m_LastFlush = std::chrono::steady_clock::now();
+    if (m_Pending.empty())
+      return;
+#if defined(_WIN32)
+    for (const auto &block : m_Pending)
+      m_Stream.write(reinterpret_cast<const char *>(block.Data.get()),
+                     static_cast<std::streamsize>(block.Size));
+    m_Stream.flush();
+    ++m_Submissions;
+    RecycleBlocks(m_Pending);
+#else
+    WaitInFlight();
+    std::vector<iovec> iov;
+    iov.reserve(m_Pending.size());
+    for (const auto &block : m_Pending)
+      iov.push_back({block.Data.get(), block.Size});
+
+    for (std::size_t first = 0; first < iov.size(); first += IOV_MAX) {
+      auto count = std::min<std::size_t>(IOV_MAX, iov.size() - first);
+#if defined(SIMPERF_HAS_IO_URING)
+      if (m_UsingIoUring) {
+        WaitInFlight();
+        m_InFlightIov.assign(iov.begin() + first, iov.begin() + first + count);
+        m_InFlightBytes = 0;
+        for (const auto &entry : m_InFlightIov)
+          m_InFlightBytes += entry.iov_len;
+        if (m_Ring.SubmitWritev(m_Fd, m_InFlightIov.data(), static_cast<unsigned>(count),
+                                m_Offset)) {
+          ++m_Submissions;
+          m_InFlightOffset = m_Offset;
+          m_Offset += m_InFlightBytes;
+          m_InFlight = true;
+          continue;
+        }
+        m_UsingIoUring = false; // the ring is unusable; stay on pwritev() for the session
+      }
+#endif
+      WriteAll(iov.data() + first, count);
+    }
+
+    if (m_InFlight)
+      m_InFlightBlocks.swap(m_Pending);
+    RecycleBlocks(m_Pending);
+#endif
+    m_PendingBytes = 0;
+  }
+
+  // Writes everything appended so far and closes the file.
+  void Close(void) {
+    if (!IsOpen())
+      return;
+    Flush();
+#if defined(_WIN32)
+    m_Stream.close();
+#else
+    WaitInFlight();
+    ::close(m_Fd);
+    m_Fd = -1;
+#endif
+#if defined(SIMPERF_HAS_IO_URING)
+    m_Ring.Close();
+#endif
+    m_UsingIoUring = false;
+  }
+
+  // For a forked child: forgets the parent's pending output without writing it. Frees nothing,
+  // so it may run in a fork handler; the next Open() reuses the blocks.
+  void Abandon(void) {
+#if defined(_WIN32)
+    m_Stream.close();
+#else
+    if (m_Fd >= 0)
+      ::close(m_Fd);
+    m_Fd = -1;
+    m_InFlight = false;
+#endif
+#if defined(SIMPERF_HAS_IO_URING)
+    m_Ring.Close();
+#endif
+    m_UsingIoUring = false;
+    m_PendingBytes = 0;
+  }
+
+private:
+  struct BlockDeleter {
+    void operator()(std::byte *data) const {
+      ::operator delete[](data, std::align_val_t(TRACE_WRITE_BLOCK_ALIGNMENT));
+    }
+  };
+
+  struct Block {
+    std::unique_ptr<std::byte[], BlockDeleter> Data;
+    std::size_t Size = 0;
+  };
+
+  Block TakeBlock(void) {
+    if (m_Free.empty())
+      return {std::unique_ptr<std::byte[], BlockDeleter>(static_cast<std::byte *>(
+                  ::operator new[](TRACE_WRITE_BLOCK_SIZE,
+                                   std::align_val_t(TRACE_WRITE_BLOCK_ALIGNMENT)))),
+              0};
+    Block block = std::move(m_Free.back());
+    m_Free.pop_back();
+    block.Size = 0;
+    return block;
+  }
+
+  void RecycleBlocks(std::vector<Block> &blocks) {
+    for (auto &block : blocks)
+      m_Free.push_back(std::move(block));
+    blocks.clear();
+  }
+
+#if !defined(_WIN32)
+  // Retries short and interrupted writes; an I/O error drops the rest of the batch. Writes at
+  // m_Offset like the ring does, since io_uring writes never move the file position.
+  void WriteAll(iovec *iov, std::size_t count) {
+    while (count > 0) {
+      ++m_Submissions;
+      auto written =
+          ::pwritev(m_Fd, iov, static_cast<int>(count), static_cast<off_t>(m_Offset));
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        ReportError(errno);
+        return;
+      }
+      m_Offset += static_cast<std::uint64_t>(written);
+      Advance(iov, count, static_cast<std::size_t>(written));
+    }
+  }
+
+  static void Advance(iovec *&iov, std::size_t &count, std::size_t written) {
+    while (count > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<std::byte *>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  void WaitInFlight(void) {
+#if defined(SIMPERF_HAS_IO_URING)
+    if (!m_InFlight)
+      return;
+    m_InFlight = false;
+    auto result = m_Ring.WaitCompletion();
+    if (result < 0) {
+      ReportError(static_cast<int>(-result));
+    } else if (static_cast<std::size_t>(result) < m_InFlightBytes) {
+      // Finish a short write synchronously at the offset the ring was writing to.
+      iovec *iov = m_InFlightIov.data();
+      std::size_t count = m_InFlightIov.size();
+      auto offset = m_InFlightOffset + static_cast<std::uint64_t>(result);
+      Advance(iov, count, static_cast<std::size_t>(result));
+      while (count > 0) {
+        auto written = ::pwritev(m_Fd, iov, static_cast<int>(count), static_cast<off_t>(offset));
+        if (written < 0) {
+          if (errno == EINTR)
+            continue;
+          ReportError(errno);
+          break;
+        }
+        offset += static_cast<std::uint64_t>(written);
+        Advance(iov, count, static_cast<std::size_t>(written));
+      }
+    }
+    RecycleBlocks(m_InFlightBlocks);
+#endif
+  }
+
+  static void ReportError(int error) {
+    spdlog::default_logger_raw()->warn("simperf: trace write failed: {}", std::strerror(error));
+  }
+#endif
+
+private:
+  TraceWriterOptions m_Options;
+  std::vector<Block> m_Pending;
+  std::vector<Block> m_Free;
+  std::size_t m_PendingBytes = 0;
+  std::uint64_t m_Offset = 0;
+  std::uint64_t m_Submissions = 0;
+  std::chrono::steady_clock::time_point m_LastFlush;
+  bool m_UsingIoUring = false;
+#if defined(_WIN32)
+  std::ofstream m_Stream;
+#else
+  int m_Fd = -1;
+  bool m_InFlight = false;
+  std::vector<Block> m_InFlightBlocks;
+  std::vector<iovec> m_InFlightIov;
+  std::size_t m_InFlightBytes = 0;
+  std::uint64_t m_InFlightOffset = 0;
+#endif
+#if defined(SIMPERF_HAS_IO_URING)
+  IoUring m_Ring;
+#endif
+};
+#pragma endregion TraceFileWriter
+} // namespace trace
+} // namespace simperf
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "logger-registry-impl.h"
+#include "trace-collector-impl.h"
+
+namespace simperf {
+#pragma region ValueSite
+struct ValueTrackOptions {
+  std::chrono::nanoseconds Window{std::chrono::seconds(1)};
+  std::size_t WindowHistory = 64;          // windows kept per site for Windows()
+  std::size_t MaxBytesPerWindow = 64 << 10; // encoded samples per thread; later ones only count
+};
+
+// Aggregates over one window, aligned to multiples of the window length.
+struct ValueWindow {
+  std::int64_t StartNs; // steady_clock
+  std::uint64_t Count = 0;
+  double Min = std::numeric_limits<double>::infinity();
+  double Max = -std::numeric_limits<double>::infinity();
+  double Sum = 0.0;
+
+  double Mean(void) const { return Count ? Sum / static_cast<double>(Count) : 0.0; }
+
+  void Add(double value) {
+    ++Count;
+    Min = std::min(Min, value);
+    Max = std::max(Max, value);
+    Sum += value;
+  }
+
+  void Merge(const ValueWindow &other) {
+    Count += other.Count;
+    Min = std::min(Min, other.Min);
+    Max = std::max(Max, other.Max);
+    Sum += other.Sum;
+  }
+};
+
+struct ValueSiteStats {
+  std::string_view Name;
+  std::string_view File;
+  std::uint32_t Line;
+  ValueWindow Total;
+  std::uint64_t Unencoded; // samples past MaxBytesPerWindow, in the stats but not the trace
+  std::uint64_t Unwritten; // encoded, but lost to a full trace ring
+};
+
+class ValueSite;
+
+class ValueSiteRegistry {
+public:
+  static void Register(ValueSite &site) {
+    std::lock_guard lock(s_Lock);
+    s_Sites.push_back(&site);
+  }
+
+  // Applies to every site, including those registered later.
+  static void SetOptions(const ValueTrackOptions &options) {
+    std::lock_guard lock(s_Lock);
+    s_Options = options;
+  }
+
+  static ValueTrackOptions Options(void) {
+    std::lock_guard lock(s_Lock);
+    return s_Options;
+  }
+
+  static std::vector<ValueSiteStats> Stats(void);
+
+  template <typename Fn> static void ForEach(Fn &&fn) {
+    std::lock_guard lock(s_Lock);
+    for (ValueSite *site : s_Sites)
+      fn(*site);
+  }
+
+private:
+  inline static std::mutex s_Lock;
+  inline static std::vector<ValueSite *> s_Sites;
+  inline static ValueTrackOptions s_Options;
+};
+
+// One static ValueSite per SIMPERF_TRACK_VALUE expansion, fed window by window by the per-thread
+// ValueSeries of every thread that passes through it.
+class ValueSite {
+public:
+  explicit ValueSite(const char *name,
+                     std::source_location location = std::source_location::current())
+      : m_Name(name), m_Location(location) {
+    ValueSiteRegistry::Register(*this);
+  }
+
+  ValueSite(const ValueSite &) = delete;
+  ValueSite &operator=(const ValueSite &) = delete;
+
+  const char *Name(void) const { return m_Name; }
+  const std::source_location &Location(void) const { return m_Location; }
+
+  // Folds one thread's finished window into the site's window of the same start.
+  void Complete(const ValueWindow &window, std::uint64_t unencoded, std::uint64_t unwritten,
+                std::size_t history) {
+    std::lock_guard lock(m_Lock);
+    m_Total.Merge(window);
+    m_Unencoded += unencoded;
+    m_Unwritten += unwritten;
+    auto found = std::find_if(m_Windows.begin(), m_Windows.end(), [&](const ValueWindow &w) {
+      return w.StartNs == window.StartNs;
+    });
+    if (found != m_Windows.end()) {
+      found->Merge(window);
+      return;
+    }
+    auto at = std::upper_bound(
+        m_Windows.begin(), m_Windows.end(), window.StartNs,
+        [](std::int64_t start, const ValueWindow &w) { return start < w.StartNs; });
+    m_Windows.insert(at, window);
+    while (m_Windows.size() > history)
+      m_Windows.pop_front();
+  }
+
+  void CountUnwritten(std::uint64_t unwritten) {
+    std::lock_guard lock(m_Lock);
+    m_Unwritten += unwritten;
+  }
+
+  // Oldest first. A window is only complete once every thread has moved past it.
+  std::vector<ValueWindow> Windows(void) {
+    std::lock_guard lock(m_Lock);
+    return {m_Windows.begin(), m_Windows.end()};
+  }
+
+  ValueSiteStats Stats(void) {
+    std::lock_guard lock(m_Lock);
+    return {m_Name, m_Location.file_name(), m_Location.line(), m_Total, m_Unencoded, m_Unwritten};
+  }
+
+private:
+  const char *m_Name;
+  std::source_location m_Location;
+  std::mutex m_Lock;
+  ValueWindow m_Total{0};
+  std::uint64_t m_Unencoded = 0;
+  std::uint64_t m_Unwritten = 0;
+  std::deque<ValueWindow> m_Windows;
+};
+
+inline std::vector<ValueSiteStats> ValueSiteRegistry::Stats(void) {
+  std::lock_guard lock(s_Lock);
+  std::vector<ValueSiteStats> stats;
+  stats.reserve(s_Sites.size());
+  for (ValueSite *site : s_Sites)
+    stats.push_back(site->Stats());
+  return stats;
+}
+#pragma endregion ValueSite
+
+#pragma region ValueSeries
+// The calling thread's samples of one site for the current window. Each sample is appended as a
+// varint timestamp delta plus a varint value delta: zigzag encoded for integers, and for floating
+// point the XOR with the previous value's bits, byte swapped so that equal exponents and round
+// mantissas both come out short. Nothing is formatted until the window closes, when the samples
+// are decoded into counter events and the window is folded into the site.
+//
+// A trace session that ends while a window is open also writes that window's samples so far (see
+// FlushAll()), so a thread that stops recording does not keep them out of the trace. Record() takes
+// no lock for that: it publishes each sample with a release store of m_Committed, and the encoding
+// buffer never moves under a reader, since a grown buffer replaces it and the old one is kept until
+// the window closes. m_Lock is only taken when a window closes and by FlushAll().
+class ValueSeries {
+public:
+  explicit ValueSeries(ValueSite &site) : m_Site(site) {
+    // The series is a thread_local that writes trace events from its destructor; constructing the
+    // ring holder first makes sure it is destroyed after the series.
+    trace::TraceCollector::Get().PrepareThread();
+    std::lock_guard lock(s_LiveLock);
+    s_Live.push_back(this);
+  }
+
+  ValueSeries(const ValueSeries &) = delete;
+  ValueSeries &operator=(const ValueSeries &) = delete;
+
+  ~ValueSeries() {
+    {
+      std::lock_guard lock(s_LiveLock);
+      s_Live.erase(std::find(s_Live.begin(), s_Live.end(), this));
+    }
+    std::lock_guard lock(m_Lock);
+    Flush();
+  }
+
+  // Writes out the samples every thread's series has recorded so far in its open window; call it
+  // before ending a session. The windows stay open and are folded into their sites as usual.
+  static void FlushAll(void) {
+    if (!trace::TraceCollector::Get().Active())
+      return;
+    std::lock_guard live(s_LiveLock);
+    for (ValueSeries *series : s_Live) {
+      std::lock_guard lock(series->m_Lock);
+      series->m_Site.CountUnwritten(series->WriteCounters());
+    }
+  }
+
+  template <typename T> void Record(T value) {
+    static_assert(std::is_arithmetic_v<T>, "SIMPERF_TRACK_VALUE needs a number");
+    auto now = trace::steady_nanoseconds(std::chrono::steady_clock::now());
+    if (now >= m_WindowEndNs) [[unlikely]]
+      StartWindow(now, std::is_integral_v<T>);
+
+    m_Window.Add(static_cast<double>(value));
+    if (m_Size >= m_Options.MaxBytesPerWindow) [[unlikely]] {
+      ++m_Unencoded;
+      return;
+    }
+    if (m_Size + MAX_SAMPLE_SIZE > m_Capacity) [[unlikely]]
+      Grow();
+    PutVarint(static_cast<std::uint64_t>(now - m_LastNs));
+    m_LastNs = now;
+    if constexpr (std::is_integral_v<T>) {
+      auto current = static_cast<std::int64_t>(value);
+      auto delta = static_cast<std::uint64_t>(current) - static_cast<std::uint64_t>(m_LastInt);
+      PutVarint(delta << 1 ^ (static_cast<std::int64_t>(delta) < 0 ? ~std::uint64_t(0) : 0));
+      m_LastInt = current;
+    } else {
+      auto current = static_cast<double>(value);
+      std::uint64_t bits;
+      std::memcpy(&bits, &current, sizeof(bits));
+      PutVarint(SwapBytes(bits ^ m_LastBits));
+      m_LastBits = bits;
+    }
+    m_Committed.store(m_Size, std::memory_order_release);
+  }
+
+private:
+  static constexpr std::size_t MAX_SAMPLE_SIZE = 20; // two varints
+  static constexpr std::size_t INITIAL_CAPACITY = 256;
+
+  // Writes out the current window, if any.
+  // Note: you must already own m_Lock before calling Flush()
+  void Flush(void) {
+    if (m_Window.Count == 0)
+      return;
+    std::uint64_t unwritten = 0;
+    if (trace::TraceCollector::Get().Active())
+      unwritten = WriteCounters();
+    LogWindow();
+    m_Site.Complete(m_Window, m_Unencoded, unwritten, m_Options.WindowHistory);
+    m_Window = ValueWindow{m_Window.StartNs};
+    m_Unencoded = 0;
+  }
+
+  void StartWindow(std::int64_t now, bool integral) {
+    std::lock_guard lock(m_Lock);
+    Flush();
+    m_Options = ValueSiteRegistry::Options();
+    auto window = std::max<std::int64_t>(m_Options.Window.count(), 1);
+    auto start = now - now % window;
+    m_Window = ValueWindow{start};
+    m_WindowEndNs = start + window;
+    m_LastNs = m_FirstNs = start;
+    m_LastInt = m_FirstInt = 0;
+    m_LastBits = m_FirstBits = 0;
+    m_Integral = integral;
+    m_Size = 0;
+    m_Written = 0;
+    m_Committed.store(0, std::memory_order_relaxed);
+    m_Retired.clear();
+  }
+
+  // Only the owning thread grows the buffer; a reader holding m_Lock may still be decoding the
+  // old one, which is released when the window closes.
+  void Grow(void) {
+    auto capacity = std::max(m_Capacity * 2, INITIAL_CAPACITY);
+    auto grown = std::make_unique<std::uint8_t[]>(capacity);
+    if (m_Size != 0)
+      std::memcpy(grown.get(), m_Encoded.get(), m_Size);
+    if (m_Encoded)
+      m_Retired.push_back(std::move(m_Encoded));
+    m_Encoded = std::move(grown);
+    m_Capacity = capacity;
+    m_Buffer.store(m_Encoded.get(), std::memory_order_release);
+  }
+
+  void PutVarint(std::uint64_t value) {
+    while (value >= 0x80) {
+      m_Encoded[m_Size++] = static_cast<std::uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    m_Encoded[m_Size++] = static_cast<std::uint8_t>(value);
+  }
+
+  static std::uint64_t GetVarint(const std::uint8_t *&at) {
+    std::uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      std::uint8_t byte = *at++;
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+  }
+
+  static std::uint64_t SwapBytes(std::uint64_t value) {
+    std::uint64_t swapped = 0;
+    for (int i = 0; i < 8; ++i, value >>= 8)
+      swapped = swapped << 8 | (value & 0xff);
+    return swapped;
+  }
+
+  // Writes the committed samples not written yet and returns how many of them a full ring kept
+  // out of the trace. Those are also counted as dropped on the ring, so the trace and the
+  // session's drop warning show the gap.
+  // Note: you must already own m_Lock before calling WriteCounters()
+  std::uint64_t WriteCounters(void) {
+    auto committed = m_Committed.load(std::memory_order_acquire);
+    const std::uint8_t *buffer = m_Buffer.load(std::memory_order_acquire);
+    const std::uint8_t *at = buffer + m_Written;
+    const std::uint8_t *end = buffer + committed;
+    auto &collector = trace::TraceCollector::Get();
+    std::uint64_t unwritten = 0;
+    trace::TraceReservation failed;
+    while (at < end) {
+      m_FirstNs += static_cast<std::int64_t>(GetVarint(at));
+      if (m_Integral) {
+        auto zigzag = GetVarint(at);
+        m_FirstInt += static_cast<std::int64_t>(zigzag >> 1 ^ (~(zigzag & 1) + 1));
+      } else {
+        m_FirstBits ^= SwapBytes(GetVarint(at));
+      }
+      if (unwritten != 0) {
+        ++unwritten;
+        continue;
+      }
+      double value;
+      if (m_Integral)
+        value = static_cast<double>(m_FirstInt);
+      else
+        std::memcpy(&value, &m_FirstBits, sizeof(value));
+
+      trace::TraceReservation reservation;
+      trace::TraceEvent *event = collector.Reserve(reservation);
+      if (event == nullptr) {
+        unwritten = 1; // Reserve() counted this one
+        failed = reservation;
+        continue;
+      }
+      event->Reset(trace::TraceEventType::Counter, m_Site.Name(), "value");
+      event->StartNs = m_FirstNs;
+      event->Value = value;
+      collector.Commit(reservation);
+    }
+    if (unwritten > 1)
+      collector.CountDropped(failed, unwritten - 1);
+    m_Written = committed;
+    return unwritten;
+  }
+
+  // At the ScopeValueTracking level of the default logger's profiling targets.
+  void LogWindow(void) {
+    static constexpr std::string_view logger_name = "simperf";
+    auto targets = s_LogLevelTargets.find(std::string(logger_name));
+    auto level = targets == s_LogLevelTargets.end()
+                     ? sp_log_level::debug
+                     : targets->second.first.at(ProfilingLogSource::ScopeValueTracking);
+    spdlog::logger *logger = LoggerRegistry::Resolve(logger_name);
+    if (logger == nullptr || !logger->should_log(level))
+      return;
+    logger->log(level, "{} [{}:{}] n={} min={} max={} mean={}", m_Site.Name(),
+                m_Site.Location().file_name(), m_Site.Location().line(), m_Window.Count,
+                m_Window.Min, m_Window.Max, m_Window.Mean());
+  }
+
+private:
+  ValueSite &m_Site;
+  std::mutex m_Lock;
+
+  // Owned by the recording thread.
+  ValueTrackOptions m_Options;
+  ValueWindow m_Window{0};
+  std::int64_t m_WindowEndNs = std::numeric_limits<std::int64_t>::min();
+  std::int64_t m_LastNs = 0;
+  std::int64_t m_LastInt = 0;
+  std::uint64_t m_LastBits = 0;
+  std::uint64_t m_Unencoded = 0;
+  std::unique_ptr<std::uint8_t[]> m_Encoded;
+  std::vector<std::unique_ptr<std::uint8_t[]>> m_Retired;
+  std::size_t m_Capacity = 0;
+  std::size_t m_Size = 0;
+
+  // Shared with FlushAll(). The decoder state is where the unwritten samples start; it and
+  // m_Written only change under m_Lock.
+  std::atomic<const std::uint8_t *> m_Buffer{nullptr};
+  std::atomic<std::size_t> m_Committed{0};
+  std::size_t m_Written = 0;
+  std::int64_t m_FirstNs = 0;
+  std::int64_t m_FirstInt = 0;
+  std::uint64_t m_FirstBits = 0;
+  bool m_Integral = false;
+
+  inline static std::mutex s_LiveLock;
+  inline static std::vector<ValueSeries *> s_Live;
+};
+#pragma endregion ValueSeries
+} // namespace simperf
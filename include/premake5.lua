@@ -1,3 +1,38 @@
+newoption
+{
+    trigger = "instrument-functions",
+    value = "PROJECTS",
+    description = "Comma separated projects to build with -finstrument-functions, e.g. tests"
+}
+
+-- Call from a project script, after its project(), to compile it with the simperf function hooks
+-- when that project was named in --instrument-functions. The hooks themselves live in the simperf
+-- library, which is never instrumented.
+function simperf_instrument_functions()
+    local selected = _OPTIONS["instrument-functions"]
+    if not selected then
+        return
+    end
+    local name = project().name
+    for candidate in string.gmatch(selected, "[^,]+") do
+        if candidate == name and name ~= "simperf" then
+            filter "toolset:gcc or clang"
+                buildoptions
+                {
+                    "-finstrument-functions",
+                    "-fno-omit-frame-pointer"
+                }
+            filter "toolset:gcc"
+                buildoptions
+                {
+                    "-finstrument-functions-exclude-file-list=/usr/include,include/details,simperf2.hpp,spdlog"
+                }
+            filter {}
+            return
+        end
+    end
+end
+
 project "simperf"
     kind "StaticLib"
     language "C++"
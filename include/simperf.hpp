@@ -6,7 +6,6 @@
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <regex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -14,6 +13,10 @@
 #include <unordered_map>
 #include <vector>
 
+#if defined(__linux__)
+#include <signal.h>
+#endif
+
 #if defined(SIMPERF_LIB)
 #include <spdlog/spdlog.h>
 #include <spdlog/common.h>
@@ -28,6 +31,9 @@
 #include "../external/spdlog/include/spdlog/sinks/stdout_color_sinks.h"
 #endif
 
+#include "details/expression-impl.h"
+#include "details/log-site-impl.h"
+
 namespace simperf {
 template <typename... Args>
 std::string Format(const std::string_view message, Args... formatItems) {
@@ -53,10 +59,10 @@ std::string Format(const std::string_view message, Args... formatItems) {
 #endif
 #elif defined(__linux__)
 #include <signal.h>
-#define SIMPERF_DEBUGBREAK() raise(SIGTRAP)
+#define SIMPERF_DEBUGBREAK(...) ::raise(SIGTRAP)
 #else
 #include <stdlib.h>
-#define SIMPERF_DEBUGBREAK() abort()
+#define SIMPERF_DEBUGBREAK(...) ::abort()
 #endif
 
 #if (defined(_DEBUG) && !defined(SIMPERF_DISABLE)) || defined(SIMPERF_ENABLE)
@@ -64,31 +70,6 @@ std::string Format(const std::string_view message, Args... formatItems) {
 #define SIMPERF_STRINGIFY_MACRO(x) #x
 #define REVERSE_STRINGIFY(str) #str[0]
 #define SIMPERF_GEN_ID(empty, id) empty##id
-#define SIMPERF_SPLIT_EXPR(str)                                                                    \
-  [&]() -> std::vector<std::string> {                                                              \
-    std::regex re("==|!=|>=|<=|!|\\|\\||&&|&|\\^");                                                \
-    std::string expr{str};                                                                         \
-    std::sregex_token_iterator iter(expr.begin(), expr.end(), re, -1);                             \
-    std::sregex_token_iterator end;                                                                \
-    std::vector<std::string> parsed{iter, end};                                                    \
-    std::vector<std::string> tokens;                                                               \
-    for (std::string & t : parsed) {                                                               \
-      std::string::iterator end_pos = std::remove(t.begin(), t.end(), ' ');                        \
-      t.erase(end_pos, t.end());                                                                   \
-      if (!t.empty())                                                                              \
-        tokens.push_back(t);                                                                       \
-    }                                                                                              \
-    return tokens;                                                                                 \
-  }()
-#define SIMPERF_UNPACK_TOKENS(tokens)                                                              \
-  [&]() -> std::string {                                                                           \
-    std::ostringstream os;                                                                         \
-    for (const auto val : tokens) {                                                                \
-      os << typeid(SIMPERF_GEN_ID(, val)).name() << ' ' << val << ": " << SIMPERF_GEN_ID(, val)    \
-         << std::endl;                                                                             \
-    }                                                                                              \
-    return os.str();                                                                               \
-  }()
 // need to attach with default error logger
 #define SIMPERF_INTERNAL_ASSERT_IMPL(type, check, msg, ...)                                        \
   {                                                                                                \
@@ -117,13 +98,25 @@ std::string Format(const std::string_view message, Args... formatItems) {
 
 #define SIMPERF_ASSERT(...)                                                                        \
   SIMPERF_EXPAND_MACRO(SIMPERF_INTERNAL_ASSERT_GET_MACRO(__VA_ARGS__)(_, __VA_ARGS__))
+// Operands are captured by ::simperf::ExpressionDecomposer and their spellings are split out of
+// the stringified check at compile time, so a passing check costs only its own evaluation.
 #define SIMPERF_ASSERT_WARGS(...)                                                                  \
-  SIMPERF_EXPAND_MACRO(SIMPERF_INTERNAL_ASSERT_GET_MACRO(__VA_ARGS__)(_, __VA_ARGS__))
-// #define SIMPERF_ASSERT_WARGS(...)
-// SIMPERF_UNPACK_TOKENS(SIMPERF_SPLIT_EXPR(SIMPERF_STRINGIFY_MACRO(__VA_ARGS__)))
+  SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_BEGIN                                                      \
+  [&](const auto &simperf_expr_) {                                                                 \
+    static constexpr ::simperf::ExpressionOperands simperf_operands_ =                             \
+        ::simperf::SplitExpression(#__VA_ARGS__);                                                  \
+    if (!simperf_expr_.Result()) {                                                                 \
+      SIMPERF_LOG_ASSERT("Assertion '{0}' failed at {1}:{2}\n{3}", #__VA_ARGS__,                   \
+                         std::filesystem::path(__FILE__).filename().string(), __LINE__,            \
+                         simperf_expr_.Describe(simperf_operands_));                               \
+      SIMPERF_DEBUGBREAK();                                                                        \
+    }                                                                                              \
+  }(::simperf::ExpressionDecomposer{} <= __VA_ARGS__);                                             \
+  SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_END
 
 #else
 #define SIMPERF_ASSERT(...)
+#define SIMPERF_ASSERT_WARGS(...)
 #define SIMPERF_NON(...)
 #endif
 
@@ -150,11 +143,12 @@ constexpr inline std::string_view TestFormat = "Test {} {}."sv;
 class Log {
 public:
   template <typename... Args>
-  static void LogIt(const std::string &logger_name, const std::string_view fmt, Args... args) {
-    ::simperf::Log::GetLogger(logger_name)->trace(std::forward<Args>(args)...);
+  static void LogIt(const std::string &logger_name, const std::string_view /*fmt*/,
+                    Args... args) {
+    LoggerRegistry::Resolve(logger_name)->trace(std::forward<Args>(args)...);
   }
 
-  static register_result RegisterFromConfig(const std::filesystem::path &config_path) {
+  static register_result RegisterFromConfig(const std::filesystem::path & /*config_path*/) {
     return register_result::failed;
   }
 
@@ -173,7 +167,7 @@ public:
             if (s_ErrorLogger.empty()) {
               s_ErrorLogger = logger->name();
             }
-            s_StaticLoggerRegistry.insert({logger->name(), logger});
+            LoggerRegistry::Publish(logger);
           }
         }
       }
@@ -181,38 +175,24 @@ public:
     return register_result::ok;
   }
 
+  // spdlog's registry goes first, or a lookup in between would resolve the logger from it again.
   static void Unregister(const std::string &name) {
-    if (s_StaticLoggerRegistry.erase(name)) {
-      spdlog::drop(name);
-    } else {
-      spdlog::drop(name);
-    }
+    spdlog::drop(name);
+    LoggerRegistry::Drop(name);
   }
 
   static logger GetLogger(const std::string &logger_name) {
-    auto static_found = s_StaticLoggerRegistry.find(logger_name);
-    if (static_found != s_StaticLoggerRegistry.end()) {
-      return static_found->second;
-    } else {
-      auto dynamic_found = spdlog::get(logger_name);
-      if (dynamic_found) {
-        return dynamic_found;
-      } else {
-        return spdlog::default_logger();
-      }
-    }
+    return LoggerRegistry::Get(logger_name);
   }
 
   static void SetDebugLogger(const std::string &logger_name) {
-    auto found = s_StaticLoggerRegistry.find(logger_name);
-    if (found != s_StaticLoggerRegistry.end()) {
+    if (LoggerRegistry::Contains(logger_name)) {
       s_DebugLogger = logger_name;
     }
   }
 
   static void SetErrorLogger(const std::string &logger_name) {
-    auto found = s_StaticLoggerRegistry.find(logger_name);
-    if (found != s_StaticLoggerRegistry.end()) {
+    if (LoggerRegistry::Contains(logger_name)) {
       s_ErrorLogger = logger_name;
     }
   }
@@ -237,12 +217,13 @@ private:
   inline static std::string s_ErrorLogger;
   inline static std::mutex s_RegisterLock;
   inline static std::atomic_bool s_StaticRegistryInitialized;
-  inline static std::unordered_map<std::string, logger> s_StaticLoggerRegistry;
 };
 
 #define SIMPERF_LOG_IT_(logger_name, log_level, ...)                                               \
   {                                                                                                \
-    simperf::logger logger_ = simperf::Log::GetLogger(logger_name);                                \
+    static ::simperf::LogSite simperf_log_site_(__FILE__, __LINE__, #logger_name, log_level);      \
+    spdlog::logger *logger_ =                                                                      \
+        simperf_log_site_.IsEnabled() ? simperf_log_site_.Handle.Resolve(logger_name) : nullptr;   \
     logger_ == nullptr                       ? ((void)0)                                           \
     : log_level == ::spdlog::level::trace    ? logger_->trace(__VA_ARGS__)                         \
     : log_level == ::spdlog::level::debug    ? logger_->debug(__VA_ARGS__)                         \
@@ -256,18 +237,42 @@ private:
 #define SIMPERF_LOG_IT__(logger_name, ...) ::simperf::Log::TestLog(logger_name, __VA_ARGS__);
 
 #if (defined(_DEBUG) && !defined(SIMPERF_DISABLE)) || defined(SIMPERF_ENABLE)
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_TRACE
 #define SIMPERF_TRACE(logger_name, ...)                                                            \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::trace, __VA_ARGS__)
+#else
+#define SIMPERF_TRACE(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_DEBUG
 #define SIMPERF_DEBUG(logger_name, ...)                                                            \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::debug, __VA_ARGS__)
+#else
+#define SIMPERF_DEBUG(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_INFO
 #define SIMPERF_INFO(logger_name, ...)                                                             \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::info, __VA_ARGS__)
+#else
+#define SIMPERF_INFO(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_WARN
 #define SIMPERF_WARN(logger_name, ...)                                                             \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::warn, __VA_ARGS__)
+#else
+#define SIMPERF_WARN(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_ERROR
 #define SIMPERF_ERROR(logger_name, ...)                                                            \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::err, __VA_ARGS__)
+#else
+#define SIMPERF_ERROR(logger_name, ...)
+#endif
+#if SIMPERF_ACTIVE_LEVEL <= SIMPERF_LEVEL_CRITICAL
 #define SIMPERF_CRITICAL(logger_name, ...)                                                         \
   SIMPERF_LOG_IT_(logger_name, spdlog::level::critical, __VA_ARGS__)
+#else
+#define SIMPERF_CRITICAL(logger_name, ...)
+#endif
 
 #define SIMPERF_LOG_PROFILE(...) SIMPERF_DEBUG(::simperf::Log::GetDebugLoggerName(), __VA_ARGS__)
 #define SIMPERF_LOG_ASSERT(...) SIMPERF_ERROR(::simperf::Log::GetErrorLoggerName(), __VA_ARGS__)
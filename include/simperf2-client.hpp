@@ -0,0 +1,77 @@
+#pragma once
+
+// The thin way into simperf for hot translation units: no spdlog, no formatting, no Instrumentor.
+// A scope costs two stores and a clock read on entry and one call into the simperf library on exit,
+// where sampling, frames, request filtering and the trace session are handled out of line. Link
+// the simperf library. Scopes here take a name only; use simperf2.hpp for scopes with arguments.
+//
+// Both headers may be included in the same translation unit; the macros of simperf2.hpp win.
+#define SIMPERF_CLIENT_HEADER
+
+#include <chrono>
+#include <cstdint>
+
+#include "details/scope-stack-impl.h"
+
+namespace simperf {
+namespace client {
+#pragma region ClientApi
+// Implemented in simperf2.cpp. EndScope runs on every scope exit, so it is not marked cold.
+void EndScope(const char *name, std::int64_t start_ns) noexcept;
+void BeginSession(const char *name, const char *path);
+void EndSession(void);
+void SetThreadName(const char *name);
+
+// `name` must have static storage duration.
+class ScopeTimer {
+public:
+  explicit ScopeTimer(const char *name) noexcept
+      : m_Name(name), m_StartNs(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now().time_since_epoch())
+                                    .count()) {
+    ScopeStack::Local().Push(name, m_StartNs);
+  }
+
+  ScopeTimer(const ScopeTimer &) = delete;
+  ScopeTimer &operator=(const ScopeTimer &) = delete;
+
+  // EndScope() runs while this scope is still the innermost one, as TailLatency expects.
+  ~ScopeTimer() {
+    EndScope(m_Name, m_StartNs);
+    ScopeStack::Local().Pop();
+  }
+
+private:
+  const char *m_Name;
+  std::int64_t m_StartNs;
+};
+#pragma endregion ClientApi
+} // namespace client
+} // namespace simperf
+
+#pragma region clientmacros
+#if !defined(SIMPERF_PROFILE_SCOPE)
+#if (defined(_DEBUG) && !defined(SIMPERF_DISABLE)) || defined(SIMPERF_ENABLE)
+#if defined(_MSC_VER)
+#define SIMPERF_CLIENT_FUNC_SIG __FUNCSIG__
+#else
+#define SIMPERF_CLIENT_FUNC_SIG __PRETTY_FUNCTION__
+#endif
+
+#define SIMPERF_PROFILE_BEGIN_SESSION(name, filepath)                                              \
+  ::simperf::client::BeginSession(name, filepath)
+#define SIMPERF_PROFILE_END_SESSION() ::simperf::client::EndSession()
+#define SIMPERF_PROFILE_THREAD_NAME(name) ::simperf::client::SetThreadName(name)
+#define SIMPERF_PROFILE_SCOPE_LINE2(name, line) ::simperf::client::ScopeTimer timer##line(name)
+#define SIMPERF_PROFILE_SCOPE_LINE(name, line) SIMPERF_PROFILE_SCOPE_LINE2(name, line)
+#define SIMPERF_PROFILE_SCOPE(name) SIMPERF_PROFILE_SCOPE_LINE(name, __LINE__)
+#define SIMPERF_PROFILE_FUNCTION() SIMPERF_PROFILE_SCOPE(SIMPERF_CLIENT_FUNC_SIG)
+#else
+#define SIMPERF_PROFILE_BEGIN_SESSION(name, filepath)
+#define SIMPERF_PROFILE_END_SESSION()
+#define SIMPERF_PROFILE_THREAD_NAME(name)
+#define SIMPERF_PROFILE_SCOPE(name)
+#define SIMPERF_PROFILE_FUNCTION()
+#endif
+#endif
+#pragma endregion clientmacros
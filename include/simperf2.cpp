@@ -1 +1,54 @@
 #include "simperf2.hpp"
+#include "simperf2-client.hpp"
+
+#pragma region ClientApi
+// The out of line half of simperf2-client.hpp.
+namespace simperf {
+namespace client {
+// Client scopes have no site, so TailLatency filters them against the global threshold, like
+// timers constructed directly.
+void EndScope(const char *name, std::int64_t start_ns) noexcept {
+  auto &instrumentor = Instrumentor::Get();
+  if (!instrumentor.SessionActive() || !instrumentor.ShouldSample()) {
+    if (TailLatency::Enabled()) [[unlikely]]
+      TailLatency::Skip();
+    return;
+  }
+  auto duration = trace::steady_nanoseconds(std::chrono::steady_clock::now()) - start_ns;
+  if (TailLatency::Enabled()) [[unlikely]] {
+    if (!TailLatency::Keep(duration, TailLatency::ThresholdNs())) {
+      TailLatency::CountDropped();
+      return;
+    }
+  }
+  instrumentor.WriteComplete(name, start_ns, duration);
+}
+
+void BeginSession(const char *name, const char *path) {
+  Instrumentor::Get().BeginSession(name, path);
+}
+
+void EndSession(void) { Instrumentor::Get().EndSession(); }
+
+void SetThreadName(const char *name) { Instrumentor::Get().SetThreadName(name); }
+} // namespace client
+} // namespace simperf
+#pragma endregion ClientApi
+
+// Called by every function of a project built with -finstrument-functions, see
+// simperf_instrument_functions() in premake5.lua. The hooks do nothing until
+// FunctionTracer::Enable().
+extern "C" {
+SIMPERF_NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *call_site) {
+  ::simperf::FunctionTracer::Enter(function, call_site);
+}
+
+SIMPERF_NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *call_site) {
+  (void)call_site;
+  ::simperf::FunctionCall call;
+  if (!::simperf::FunctionTracer::Exit(function, call))
+    return;
+  ::simperf::Instrumentor::Get().WriteFunctionCall(call);
+  ::simperf::FunctionTracer::EndReport();
+}
+}
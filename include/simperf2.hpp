@@ -3,13 +3,16 @@
 #include <any>
 #include <array>
 #include <atomic>
+#include <charconv>
 #include <filesystem>
 #include <format>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <source_location>
+#include <span>
 #include <sstream>
 #include <stack>
 #include <string>
@@ -17,7 +20,9 @@
 #include <unordered_map>
 #include <utility>
 #include <variant>
+#if defined(_WIN32)
 #include <windows.h>
+#endif
 
 #if defined(SIMPERF_LIB)
 // #include <spdlog/spdlog.h>
@@ -40,11 +45,30 @@
 #include <spdlog/fmt/fmt.h>
 
 #include "details/assert-impl.h"
+#include "details/assert-site-impl.h"
 #include "details/log-impl.h"
+#include "details/logger-registry-impl.h"
+#include "details/async-log-impl.h"
+#include "details/config-watch-impl.h"
+#include "details/scope-site-impl.h"
+#include "details/lock-site-impl.h"
+#include "details/resource-usage-impl.h"
+#include "details/frame-impl.h"
+#include "details/trace-context-impl.h"
+#include "details/process-impl.h"
+#include "details/trace-collector-impl.h"
+#include "details/scope-stack-impl.h"
+#include "details/sampler-impl.h"
+#include "details/func-trace-impl.h"
+#include "details/value-track-impl.h"
+#include "details/tail-latency-impl.h"
+#include "details/governor-impl.h"
+#include "details/crash-dump-impl.h"
+#include "details/metrics-exporter-impl.h"
 
 namespace simperf {
-inline void default_initialize(std::string default_logger_name);
-inline void initialize_from_config(const char *path);
+inline void default_initialize(std::string default_logger_name, bool async);
+inline void initialize_from_config(const char *path, bool watch);
 inline void initialize_from_log_specs();
 
 #pragma region ctx
@@ -54,24 +78,81 @@ public:
   inline static void LogIt(const std::string &logger_name, const sp_log_level &log_level,
                            const T &msg) {
     bool use_default = sm_LogToDefaultLogger.load(std::memory_order_acquire);
-    auto logger = (use_default) ? spdlog::default_logger() : spdlog::get(logger_name);
+    auto logger =
+        (use_default) ? spdlog::default_logger_raw() : LoggerRegistry::Resolve(logger_name);
     assert(logger != nullptr);
-    logger->log(log_level, msg);
+    LogTo(logger, log_level, msg);
+  }
+
+  // Call site overload: the logger is resolved once into `handle` and only re-resolved when the
+  // name changes or the registry generation moves.
+  template <typename T>
+  inline static void LogIt(LoggerHandle &handle, std::string_view logger_name,
+                           const sp_log_level &log_level, const T &msg) {
+    bool use_default = sm_LogToDefaultLogger.load(std::memory_order_acquire);
+    auto logger = (use_default) ? spdlog::default_logger_raw() : handle.Resolve(logger_name);
+    assert(logger != nullptr);
+    LogTo(logger, log_level, msg);
   }
 
   template <typename... Args>
   inline static void FormattedLogIt(const std::string &logger_name,
                                     const spdlog::level::level_enum &log_level,
                                     const std::string_view fmt, Args... args) {
+    if (sm_AsyncLogging.load(std::memory_order_relaxed)) {
+      bool use_default = sm_LogToDefaultLogger.load(std::memory_order_relaxed);
+      if (TryEnqueueAsync(use_default ? std::string_view{} : std::string_view(logger_name),
+                          log_level, fmt, args...))
+        return;
+    }
     ctx::LogIt(logger_name, log_level,
                std::vformat(fmt, std::make_format_args(std::forward<Args>(args)...)));
   }
 
+  template <typename... Args>
+  inline static void FormattedLogIt(LoggerHandle &handle, std::string_view logger_name,
+                                    const spdlog::level::level_enum &log_level,
+                                    const std::string_view fmt, Args... args) {
+    if (sm_AsyncLogging.load(std::memory_order_relaxed)) {
+      bool use_default = sm_LogToDefaultLogger.load(std::memory_order_relaxed);
+      if (TryEnqueueAsync(use_default ? std::string_view{} : logger_name, log_level, fmt,
+                          args...))
+        return;
+    }
+    ctx::LogIt(handle, logger_name, log_level,
+               std::vformat(fmt, std::make_format_args(std::forward<Args>(args)...)));
+  }
+
   template <typename... Args>
   inline static void AutoFormattedLogIt(const std::string &logger_name,
                                         const spdlog::level::level_enum &log_level,
                                         const std::string_view fmt, Args... args) {}
 
+  // Defers formatting and sink I/O of FormattedLogIt to a backend thread. Records below
+  // `min_level` are discarded on the calling thread before anything is copied.
+  inline static void EnableAsyncLogging(sp_log_level min_level = sp_log_level::trace,
+                                        std::chrono::milliseconds poll_interval =
+                                            std::chrono::milliseconds(1)) {
+    async::AsyncLogBackend::Get().SetLevel(min_level);
+    async::AsyncLogBackend::Get().Start(poll_interval);
+    sm_AsyncLogging.store(true, std::memory_order_release);
+  }
+
+  inline static void DisableAsyncLogging(void) {
+    sm_AsyncLogging.store(false, std::memory_order_release);
+    async::AsyncLogBackend::Get().Stop();
+  }
+
+  inline static bool AsyncLoggingEnabled(void) {
+    return sm_AsyncLogging.load(std::memory_order_acquire);
+  }
+
+  inline static void SetAsyncLogLevel(sp_log_level min_level) {
+    async::AsyncLogBackend::Get().SetLevel(min_level);
+  }
+
+  inline static void FlushAsyncLogging(void) { async::AsyncLogBackend::Get().Flush(); }
+
   inline static bool VariableShouldThrow(void) {
     return sm_VariableNoThrowActive.load(std::memory_order_acquire);
   }
@@ -105,6 +186,28 @@ public:
 
   inline static std::string_view GetDefaultTag(void) { return sm_DefaultTag.val; }
 
+  // Resource usage sampling is opt-in per tag, independently of the tag's instrument status.
+  inline static void SetResourceUsageTagStatus(std::string_view tag, bool enabled = true) {
+    UsageSiteRegistry::SetTagEnabled(tag, enabled);
+  }
+
+  inline static bool GetResourceUsageTagStatus(std::string_view tag) {
+    return UsageSiteRegistry::TagEnabled(tag);
+  }
+
+  inline static std::vector<UsageSiteStats> GetUsageSiteStats(void) {
+    return UsageSiteRegistry::Stats();
+  }
+
+  inline static std::vector<ValueSiteStats> GetValueSiteStats(void) {
+    return ValueSiteRegistry::Stats();
+  }
+
+  // Every SIMPERF_PROFILE_SCOPE site with its call rate and how much of it is still timed.
+  inline static std::vector<GovernedSiteStats> GetGovernorReport(void) {
+    return Governor::Report();
+  }
+
   inline static void SetAssertionTypeStatus(const AssertionType &type, bool enabled = true) {
     std::unique_lock<std::mutex> guard(sm_CtxDataLock);
     auto it = sm_AssertionTypeStatusMap.find(type);
@@ -134,7 +237,26 @@ public:
     return it->second;
   }
 
-  void SetGlobalAssertionStatus(bool enabled = true) {
+  inline static void SetAssertionRateLimit(const AssertionRateLimit &limit) {
+    std::unique_lock<std::mutex> guard(sm_CtxDataLock);
+    sm_AssertionRateLimit.Store(limit);
+  }
+
+  // Lock free; read by every rate limited failure.
+  inline static AssertionRateLimit GetAssertionRateLimit(void) {
+    return sm_AssertionRateLimit.Load();
+  }
+
+  // Total failures recorded at `file` (a path suffix) and `line`, for dashboards.
+  inline static std::uint64_t GetAssertionFailureCount(std::string_view file, std::uint32_t line) {
+    return AssertionSiteRegistry::FailureCount(file, line);
+  }
+
+  inline static std::vector<AssertionSiteStats> GetAssertionSiteStats(void) {
+    return AssertionSiteRegistry::Stats();
+  }
+
+  inline static void SetGlobalAssertionStatus(bool enabled = true) {
     sm_GlobalAssertionSwitch.store(enabled, std::memory_order_release);
   }
 
@@ -151,12 +273,38 @@ public:
   }
 
 private:
+  // Messages logged while a request is current carry its ID, to find them again in the trace.
+  template <typename T>
+  inline static void LogTo(spdlog::logger *logger, const sp_log_level &log_level, const T &msg) {
+    if (!logger->should_log(log_level))
+      return;
+    LoggerRegistry::CountMessage(*logger, log_level);
+    if (auto request = TraceContext::Current().RequestID) [[unlikely]] {
+      if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        logger->log(log_level,
+                    std::format("[request {:016x}] {}", request, std::string_view(msg)));
+        return;
+      }
+    }
+    logger->log(log_level, msg);
+  }
+
+  // The request ID travels in the record; the backend writes the same prefix as LogTo.
+  template <typename... Args>
+  inline static bool TryEnqueueAsync(std::string_view logger_name, sp_log_level log_level,
+                                     std::string_view fmt, const Args &...args) {
+    return async::TryEnqueue(logger_name, log_level, TraceContext::Current().RequestID, fmt,
+                             args...);
+  }
+
   inline static void _Initialize(void) {
-    sm_AssertionTypeStatusMap = {{AssertionType::ExplicitNoThrow, true},
+    sm_AssertionTypeStatusMap = {{AssertionType::ValueCheck, true},
+                                 {AssertionType::ExplicitNoThrow, true},
                                  {AssertionType::VariableThrow, true},
                                  {AssertionType::Throw, true},
                                  {AssertionType::Fatal, true}};
     AddTag("simperf");
+    AddTag("budget");
   }
 
 private:
@@ -165,6 +313,7 @@ private:
   inline static std::mutex sm_CtxDataLock;
   inline static std::atomic_bool sm_LogToDefaultLogger{true};
   inline static std::atomic_bool sm_VariableNoThrowActive{false};
+  inline static std::atomic_bool sm_AsyncLogging{false};
 
   inline static std::stack<LoggerTag> sm_LoggerTagStack;
   inline static std::stack<InstrumentTag> sm_InstrumentTagStack;
@@ -173,6 +322,7 @@ private:
   inline static std::string sm_DefaultLoggerName;
   inline static std::atomic_bool sm_GlobalAssertionSwitch{true};
   inline static std::unordered_map<AssertionType, bool> sm_AssertionTypeStatusMap;
+  inline static AtomicAssertionRateLimit sm_AssertionRateLimit;
   inline static std::unordered_map<InstrumentTag, bool, std::hash<InstrumentTag>> sm_TagStatusMap;
 };
 #pragma endregion ctx
@@ -182,30 +332,63 @@ inline void rename_default_logger(const char *new_name) {
   auto old_default_logger = spdlog::default_logger();
   auto new_default_logger = old_default_logger->clone(new_name);
   spdlog::set_default_logger(new_default_logger);
+  LoggerRegistry::Invalidate();
 }
 
-inline static void default_initialize(std::string default_logger_name = "simperf") {
+inline void default_initialize(std::string default_logger_name = "simperf",
+                                      bool async = false) {
   ctx::Initialize(default_logger_name.c_str());
 
   // we need to rename default logger
   rename_default_logger(default_logger_name.c_str());
 
-  auto file_log = std::make_shared<spdlog::sinks::basic_file_sink_st>((default_logger_name + ".log").c_str());
+  auto file_name = default_logger_name + ".log";
+  spdlog::sink_ptr file_log =
+      async ? spdlog::sink_ptr(std::make_shared<spdlog::sinks::basic_file_sink_mt>(file_name))
+            : spdlog::sink_ptr(std::make_shared<spdlog::sinks::basic_file_sink_st>(file_name));
 
   spdlog::default_logger()->sinks().push_back(file_log);
 
   spdlog::default_logger()->set_level(sp_log_level::trace);
-  spdlog::default_logger()->flush_on(sp_log_level::trace);
+  if (async) {
+    // The backend flushes once per drain pass, so only errors need an immediate flush.
+    spdlog::default_logger()->flush_on(sp_log_level::err);
+    ctx::EnableAsyncLogging();
+  } else {
+    spdlog::default_logger()->flush_on(sp_log_level::trace);
+  }
 }
 
-inline static void initialize_from_config(const char *path) {
+inline void watch_config(const char *path);
+
+// With `watch`, the runtime section of the file is applied immediately and re-applied whenever the
+// file changes; see RuntimeConfig for what can be reloaded.
+inline void initialize_from_config(const char *path, bool watch = false) {
   ctx::Initialize("simperf"); // Initialize ctx
   spdlog_setup::from_file(path);
+  LoggerRegistry::Invalidate();
+  if (watch)
+    watch_config(path);
 }
 
 inline void initialize_from_log_specs() { 
     ctx::Initialize("simperf"); 
 }
+// Emits the pending summary of every rate limited assertion site, e.g. before shutdown when the
+// failures have stopped and no failing call is left to trigger it.
+inline void flush_assertion_summaries() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  AssertionSiteRegistry::ForEach([&](AssertionSite &site) {
+    std::chrono::nanoseconds window{};
+    auto suppressed = site.TakeSuppressedSinceSummary(now_ns, window);
+    if (suppressed == 0)
+      return;
+    ctx::FormattedLogIt(std::string(ctx::GetDefaultLoggerName()), sp_log_level::warn,
+                        ASSERT_SUMMARY_NOARGS_FMTMSG, suppressed, site.File(), site.Line(),
+                        std::chrono::duration_cast<std::chrono::seconds>(window).count());
+  });
+}
 #pragma endregion inlinehelpers
 
 #pragma region Assertions
@@ -244,31 +427,56 @@ template <typename T1 = std::any, typename T2 = std::any> struct AssertionSpec {
                                              AssertionControlFlags::Tag,
       AssertionMsgSpec<> msg_spec = {},
       AssertionLogLevelTargets log_level_targets = get_default_assertion_log_level_targets(),
-      std::function<bool(const T1&, const T2&)> _override = [](const T1 &lhs, const T2 &rhs) -> bool {
+      std::function<bool(const T1&, const T2&)> _override = [](const T1 &, const T2 &) -> bool {
         return false;
       })
-      : Type(type), ControlFilter(control_filter), LogLevelTargets(log_level_targets),
-        Override(_override) {}
+      : Type(type), MsgSpec(msg_spec), ControlFilter(control_filter),
+        LogLevelTargets(log_level_targets), Override(_override) {}
 };
 
 template <typename T1 = std::any, typename T2 = std::any>
 AssertionSpec(AssertionType, AssertionControlFlags, AssertionLogLevelTargets,
               std::function<bool(T1, T2)>) -> AssertionSpec<T1, T2>;
 
+// Defaults live in function-local statics so a passing assertion never builds a spec or tags.
+inline const AssertionSpec<> &default_assertion_spec(void) {
+  static const AssertionSpec<> spec{};
+  return spec;
+}
+
+inline const std::array<SmartString<std::string>, 1> &default_assertion_tags(void) {
+  static const auto tags = make_array(std::string(::simperf::ctx::GetDefaultTag()));
+  return tags;
+}
+
+// An optional by-reference argument. Its default is a null pointer, so evaluating it on every call
+// costs nothing; the failure path substitutes the default_assertion_*() value.
+template <typename T> class AssertionArg {
+public:
+  AssertionArg(void) = default;
+  AssertionArg(const T &value) : m_Value(&value) {}
+
+  const T *Get(void) const { return m_Value; }
+
+private:
+  const T *m_Value = nullptr;
+};
+
 template <typename T1 = std::any, typename T2 = std::any, size_t N = 1> class AssertionBase {
 public:
   explicit operator bool() const {
     return m_FailedCheck;
   }
 
-  void Flush(const T1& lhs, const T2& rhs, std::string_view lhsID, std::string_view rhsID) {
-    for (const auto& logger_name : m_AssertionSpec.Loggers) {
-      auto type = m_AssertionSpec.Type;
-      auto level = m_AssertionSpec.LogLevelTargets.find(type);
-      assert(level != m_AssertionSpec.LogLevelTargets.end());
+  void Flush(const T1 &lhs, const T2 &rhs, std::string_view lhsID, std::string_view rhsID,
+             const AssertionSpec<> &spec) {
+    for (const auto& logger_name : spec.Loggers) {
+      auto type = spec.Type;
+      auto level = spec.LogLevelTargets.find(type);
+      assert(level != spec.LogLevelTargets.end());
       
-      auto prefix = m_AssertionSpec.MsgSpec.m_MsgPrefix;
-      auto msg = m_AssertionSpec.MsgSpec.m_Msg;
+      auto prefix = spec.MsgSpec.m_MsgPrefix;
+      auto msg = spec.MsgSpec.m_Msg;
       auto expression = m_Expression;
       auto line = m_SourceLocation.line();
       auto file = m_SourceLocation.file_name();
@@ -278,89 +486,137 @@ public:
     }
   }
 
-  ~AssertionBase() {
-    auto logger = spdlog::get("simperf");
-    logger->warn("assertion destructor called");
-  }
-
 protected:
+  // The passing path only stores a few trivially copyable members and takes one branch; specs and
+  // tags default to null and are only resolved by the out-of-line failure path.
   AssertionBase(bool check = false, 
                 const T1 &lhs = {}, 
                 const T2 &rhs = {},
                 std::string_view expr = {}, 
                 std::string_view lhsID = {}, 
                 std::string_view rhsID = {},
-                std::array<SmartString<std::string>, N> tags =
-                    make_array(std::string(::simperf::ctx::GetDefaultTag())),
-                AssertionSpec<> spec = {},
+                AssertionArg<std::array<SmartString<std::string>, N>> tags = {},
+                AssertionArg<AssertionSpec<>> spec = {},
                 std::source_location source_loc = std::source_location::current())
-      : m_Check(check), m_Expression(expr), m_FailedCheck(false), m_Tags(tags), m_AssertionSpec(spec), m_SourceLocation(source_loc) {
+      : m_Expression(expr), m_SourceLocation(source_loc), m_FailedCheck(false) {
+    if (check) [[likely]]
+      return;
+    m_FailedCheck = OnFailedCheck(lhs, rhs, lhsID, rhsID, tags, spec);
+  }
 
+  std::string_view m_Expression;
+  std::source_location m_SourceLocation;
+
+private:
+  SIMPERF_NOINLINE SIMPERF_COLD bool
+  OnFailedCheck(const T1 &lhs, const T2 &rhs, std::string_view lhsID, std::string_view rhsID,
+                AssertionArg<std::array<SmartString<std::string>, N>> tags_arg,
+                AssertionArg<AssertionSpec<>> spec_arg) {
     using acf = AssertionControlFlags;
 
-    if (!check) {
-      if (!!(m_AssertionSpec.ControlFilter & acf::Override)) {
-        m_FailedCheck = m_AssertionSpec.Override(lhs, rhs);
-      }
+    std::span<const SmartString<std::string>> tags;
+    if (tags_arg.Get())
+      tags = *tags_arg.Get();
+    else
+      tags = default_assertion_tags();
+    const AssertionSpec<> &spec = spec_arg.Get() ? *spec_arg.Get() : default_assertion_spec();
 
-      else if (!!(m_AssertionSpec.ControlFilter & acf::Global)) {
-        bool global_assertions = ::simperf::ctx::GetGlobalAssertionStatus();
-        if (global_assertions) {
-          bool listens_to_type = !!(m_AssertionSpec.ControlFilter & acf::Type);
-          bool listens_to_tag = !!(m_AssertionSpec.ControlFilter & acf::Tag);
-          bool all_tags_are_active = true;
-          if (listens_to_tag) {
-            for (const auto &tag : m_Tags) {
-              all_tags_are_active = ctx::GetInstrumentTagStatus(tag);
-              if (!all_tags_are_active)
-                break;
-            }
-          }
-          if (listens_to_type && listens_to_tag) {
-            bool type_is_active = ::simperf::ctx::GetAssertionTypeStatus(m_AssertionSpec.Type);
-            m_FailedCheck = type_is_active;
-            if (m_FailedCheck) {
-              m_FailedCheck = all_tags_are_active;
-            }
-          }
-          else if (listens_to_type) {
-            bool type_is_active = ::simperf::ctx::GetAssertionTypeStatus(m_AssertionSpec.Type);
-            m_FailedCheck = type_is_active;
-          } else if (listens_to_tag) {
-            m_FailedCheck = !all_tags_are_active;
+    bool failed_check = false;
+    if (!!(spec.ControlFilter & acf::Override)) {
+      failed_check = spec.Override(lhs, rhs);
+    }
+
+    else if (!!(spec.ControlFilter & acf::Global)) {
+      bool global_assertions = ::simperf::ctx::GetGlobalAssertionStatus();
+      if (global_assertions) {
+        bool listens_to_type = !!(spec.ControlFilter & acf::Type);
+        bool listens_to_tag = !!(spec.ControlFilter & acf::Tag);
+        bool all_tags_are_active = true;
+        if (listens_to_tag) {
+          for (const auto &tag : tags) {
+            all_tags_are_active = ctx::GetInstrumentTagStatus(tag);
+            if (!all_tags_are_active)
+              break;
           }
-          else {
-            m_FailedCheck = global_assertions;
+        }
+        if (listens_to_type && listens_to_tag) {
+          bool type_is_active = ::simperf::ctx::GetAssertionTypeStatus(spec.Type);
+          failed_check = type_is_active;
+          if (failed_check) {
+            failed_check = all_tags_are_active;
           }
         }
+        else if (listens_to_type) {
+          bool type_is_active = ::simperf::ctx::GetAssertionTypeStatus(spec.Type);
+          failed_check = type_is_active;
+        } else if (listens_to_tag) {
+          failed_check = !all_tags_are_active;
+        }
         else {
-          m_FailedCheck = global_assertions;
+          failed_check = global_assertions;
         }
       }
+      else {
+        failed_check = global_assertions;
+      }
     }
-    if (m_FailedCheck) {
-      this->Flush(lhs, rhs, lhsID, rhsID);
+    if (failed_check) {
+      if (!IsRateLimited(spec.Type)) {
+        this->Flush(lhs, rhs, lhsID, rhsID, spec);
+      } else {
+        auto &site = AssertionSiteRegistry::Get(m_SourceLocation, spec.Type);
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        std::uint64_t suppressed = 0;
+        std::chrono::nanoseconds window{};
+        switch (site.Admit(::simperf::ctx::GetAssertionRateLimit(),
+                           std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+                           suppressed, window)) {
+        case AssertionAdmission::Log:
+          this->Flush(lhs, rhs, lhsID, rhsID, spec);
+          break;
+        case AssertionAdmission::Summarize:
+          this->FlushSummary(lhs, rhs, lhsID, rhsID, spec, suppressed, window);
+          break;
+        case AssertionAdmission::Suppress:
+          break;
+        }
+      }
     }
+    return failed_check;
   }
 
-  std::function<bool()> m_ThrowIf;
-  std::string m_Logger;
+  static bool IsRateLimited(AssertionType type) {
+    switch (type) {
+    case AssertionType::ValueCheck:
+    case AssertionType::ExplicitNoThrow:
+      return true;
+    case AssertionType::VariableThrow:
+      return !::simperf::ctx::VariableShouldThrow();
+    default:
+      return false;
+    }
+  }
 
-  std::string_view m_Expression;
-  AssertionSpec<> m_AssertionSpec;
-  std::source_location m_SourceLocation;
-  std::array<SmartString<std::string>, N> m_Tags;
+  void FlushSummary(const T1 &lhs, const T2 &rhs, std::string_view lhsID, std::string_view rhsID,
+                    const AssertionSpec<> &spec, std::uint64_t suppressed,
+                    std::chrono::nanoseconds window) {
+    auto level = spec.LogLevelTargets.find(spec.Type);
+    assert(level != spec.LogLevelTargets.end());
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(window).count();
+    for (const auto &logger_name : spec.Loggers) {
+      ::simperf::ctx::FormattedLogIt(logger_name, level->second, ASSERT_SUMMARY_FMTMSG,
+                                     suppressed, m_Expression, m_SourceLocation.file_name(),
+                                     m_SourceLocation.line(), seconds, lhsID, rhsID, lhs, rhs);
+    }
+  }
 
-private:
-  bool m_Check;
   bool m_FailedCheck;
 };
 
 template <typename T1 = std::any, typename T2 = std::any, size_t N = 1>
-AssertionBase(
-    bool, const T1 &lhs = {}, const T2 &rhs = {},
-    std::string_view expr = {}, std::array<SmartString<std::string>, N>,
-              AssertionSpec<>, std::source_location) -> AssertionBase<T1, T2, N>;
+AssertionBase(bool, const T1 &, const T2 &, std::string_view, std::string_view, std::string_view,
+              const std::array<SmartString<std::string>, N> &, const AssertionSpec<> &,
+              std::source_location) -> AssertionBase<T1, T2, N>;
 
 template <typename T1, typename T2, size_t N> class Assertion : public AssertionBase<T1, T2, N> {
 public:
@@ -369,19 +625,17 @@ public:
             const T2 &rhs, 
             std::string_view expr = {},
             std::string_view lhsID = {"lhs"}, std::string_view rhsID = {"rhs"},
-            std::array<SmartString<std::string>, N> tags =
-                make_array(std::string(::simperf::ctx::GetDefaultTag())),
-            AssertionSpec<> spec = {},
+            AssertionArg<std::array<SmartString<std::string>, N>> tags = {},
+            AssertionArg<AssertionSpec<>> spec = {},
             std::source_location source_loc = std::source_location::current())
       : AssertionBase<T1, T2, N>(check, lhs, rhs, expr, lhsID, rhsID, tags, spec, source_loc) {}
 };
 
 template <typename T1, typename T2, size_t N>
-Assertion(bool check, const T1 &lhs, const T2 &rhs, std::string_view expr = {},
-          std::string_view lhsID = {"lhs"}, std::string_view rhsID = {"rhs"},
-          std::array<SmartString<std::string>, N> tags =
-              make_array(std::string(::simperf::ctx::GetDefaultTag())),
-          AssertionSpec<T1, T2> spec = {},
+Assertion(bool check, const T1 &lhs, const T2 &rhs, std::string_view expr,
+          std::string_view lhsID, std::string_view rhsID,
+          const std::array<SmartString<std::string>, N> &tags,
+          const AssertionSpec<> &spec = default_assertion_spec(),
           std::source_location source_loc = std::source_location::current())
     -> Assertion<T1, T2, N>;
 
@@ -397,6 +651,18 @@ Assertion(bool check, const T1 &lhs, const T2 &rhs, std::string_view expr = {},
           std::string_view lhsID = {"lhs"}, std::string_view rhsID = {"rhsID"})
     -> Assertion<T1, T2, 1>;
 
+// Per call site statics for tags and specs, built on first use only.
+#define SIMPERF_ASSERTION_TAGS(...)                                                                \
+  []() -> const auto & {                                                                           \
+    static const auto tags = ::simperf::make_array(__VA_ARGS__);                                   \
+    return tags;                                                                                   \
+  }()
+#define SIMPERF_ASSERTION_SPEC(...)                                                                \
+  []() -> const ::simperf::AssertionSpec<> & {                                                     \
+    static const ::simperf::AssertionSpec<> spec(__VA_ARGS__);                                     \
+    return spec;                                                                                   \
+  }()
+
 #pragma endregion Assertions
 
 // template <typename T, typename... Ts>
@@ -435,11 +701,9 @@ struct ProfileResult {
 
   FloatingPointMicroseconds Start;
   std::chrono::microseconds ElapsedTime;
-  std::thread::id ThreadID;
-};
-
-struct InstrumentationSession {
-  std::string Name;
+  std::thread::id ThreadID; // Unused; events are recorded on the calling thread's track
+  const char *Category = "function";
+  std::vector<trace::TraceArg> Args;
 };
 
 class Instrumentor {
@@ -447,118 +711,263 @@ public:
   Instrumentor(const Instrumentor &) = delete;
   Instrumentor(Instrumentor &&) = delete;
 
-  void BeginSession(const std::string &name, const std::string &filepath = "results.json") {
-    std::lock_guard lock(m_Mutex);
-    if (m_CurrentSession) {
-      // If there is already a current session, then close it before beginning new one.
-      // Subsequent profiling output meant for the original session will end up in the
-      // newly opened session instead.  That's better than having badly formatted
-      // profiling output.
-      // if (mcctt::core::Log::GetCoreLogger()) // Edge case: BeginSession() might be before
-      // Log::Init()
-      //{
-      //	MCCTT_CORE_ERROR("Instrumentor::BeginSession('{0}') when session '{1}' already
-      //open.", name, m_CurrentSession->Name);
-      //}
-      InternalEndSession();
+  void BeginSession(const std::string &name, const std::string &filepath = "results.json",
+                    trace::TraceFormat format = trace::TraceFormat::ChromeJson) {
+    // If there is already a current session, then close it before beginning new one.
+    // Subsequent profiling output meant for the original session will end up in the
+    // newly opened session instead.  That's better than having badly formatted
+    // profiling output.
+    trace::TraceCollector::Get().BeginSession({name, current_process_id(), 0,
+                                               ClockAnchor::Capture()},
+                                              filepath, format);
+    if (FunctionTracer::Enabled())
+      FunctionTracer::SnapshotMaps(FunctionTracer::MapsPath(filepath));
+  }
+
+  void EndSession() {
+    ValueSeries::FlushAll();
+    trace::TraceCollector::Get().EndSession();
+  }
+
+  void WriteProfile(const ProfileResult &result) {
+    auto start = std::chrono::duration_cast<std::chrono::nanoseconds>(result.Start);
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(result.ElapsedTime);
+    WriteComplete(result.Name, start.count(), elapsed.count(), result.Category,
+                  std::span<const trace::TraceArg>(result.Args));
+  }
+
+  // Captures a complete event into the calling thread's ring; encoding and I/O happen on the
+  // session's writer thread.
+  void WriteComplete(std::string_view name, std::int64_t start_ns, std::int64_t duration_ns,
+                     const char *category = "function",
+                     std::span<const trace::TraceArg> args = {}) {
+    if (FrameThread *frame = FrameThread::Current()) [[unlikely]] {
+      if (CaptureInFrame(*frame, name, start_ns, duration_ns, category, args))
+        return;
     }
-    m_OutputStream.open(filepath);
+    if (!ContextRecorded(TraceContext::Current()))
+      return;
+    auto &collector = trace::TraceCollector::Get();
+    trace::TraceReservation reservation;
+    trace::TraceEvent *event = collector.Reserve(reservation);
+    if (event == nullptr)
+      return;
+    FillComplete(*event, name, start_ns, duration_ns, category, args);
+    collector.Commit(reservation);
+  }
+
+  // A call kept by the -finstrument-functions hooks. It is named by its address, which
+  // simperf-symbolize resolves against the session's maps snapshot.
+  SIMPERF_NO_INSTRUMENT void WriteFunctionCall(const FunctionCall &call) {
+    char name[2 + 2 * sizeof(std::uintptr_t)] = {'0', 'x'};
+    auto end = std::to_chars(name + 2, name + sizeof(name), call.Function, 16).ptr;
+    const trace::TraceArg args[] = {
+        trace::TraceArg::Integer("call_site", static_cast<std::int64_t>(call.CallSite))};
+    WriteComplete(std::string_view(name, end), call.StartNs, call.DurationNs, "function,auto",
+                  args);
+  }
+
+  // Writes an already captured event into the calling thread's ring.
+  void WriteEvent(const trace::TraceEvent &captured) {
+    if (captured.Filtered)
+      return;
+    auto &collector = trace::TraceCollector::Get();
+    trace::TraceReservation reservation;
+    trace::TraceEvent *event = collector.Reserve(reservation);
+    if (event == nullptr)
+      return;
+    std::memcpy(static_cast<void *>(event), &captured, sizeof(trace::TraceEvent));
+    collector.Commit(reservation);
+  }
 
-    if (m_OutputStream.is_open()) {
-      m_CurrentSession = new InstrumentationSession({name});
-      WriteHeader();
+  // Ends the calling thread's current frame of `series`, if any, and starts the next one. The
+  // frame itself is written as a "frame" event spanning the iteration.
+  void MarkFrame(FrameSeries &series) {
+    auto now = trace::steady_nanoseconds(std::chrono::steady_clock::now());
+    FrameThread &frame = FrameThread::Local();
+    if (frame.Series == &series) {
+      auto duration = std::chrono::nanoseconds(now - frame.StartNs);
+      bool worst = series.Complete(frame, duration);
+      if (worst && frame.Options.RetainOnly) {
+        for (const auto &event : frame.Events)
+          WriteEvent(event);
+      }
+      FrameThread::SetCurrent(nullptr);
+      const trace::TraceArg args[] = {
+          trace::TraceArg::Integer("frame", static_cast<std::int64_t>(frame.Index))};
+      WriteComplete(series.Name(), frame.StartNs, duration.count(), "frame", args);
+      ++frame.Index;
     } else {
-      // if (mcctt::core::Log::GetCoreLogger()) // Edge case: BeginSession() might be before
-      // Log::Init()
-      //{
-      //	MCCTT_CORE_ERROR("Instrumentor could not open results file '{0}'.", filepath);
-      // }
+      frame.Series = &series;
+      frame.Index = 0;
     }
+    frame.StartNs = now;
+    frame.Options = series.Options();
+    frame.Events.clear();
+    frame.SiteTimes.clear();
+    FrameThread::SetCurrent(&frame);
   }
 
-  void EndSession() {
-    std::lock_guard lock(m_Mutex);
-    InternalEndSession();
+  // Also true in a forked child whose session starts with its first event.
+  bool SessionActive(void) const {
+    auto &collector = trace::TraceCollector::Get();
+    return collector.Active() || collector.ResumePending();
   }
 
-  void WriteProfile(const ProfileResult &result) {
-    std::stringstream json;
-
-    json << std::setprecision(3) << std::fixed;
-    json << ",{";
-    json << "\"cat\":\"function\",";
-    json << "\"dur\":" << (result.ElapsedTime.count()) << ',';
-    json << "\"name\":\"" << result.Name << "\",";
-    json << "\"ph\":\"X\",";
-    json << "\"pid\":0,";
-    json << "\"tid\":" << result.ThreadID << ",";
-    json << "\"ts\":" << result.Start.count();
-    json << "}";
-
-    std::lock_guard lock(m_Mutex);
-    if (m_CurrentSession) {
-      m_OutputStream << json.str();
-      m_OutputStream.flush();
-    }
+  // Leaves the calling thread's frame without counting it, e.g. when its loop exits.
+  void EndFrames(void) {
+    FrameThread::SetCurrent(nullptr);
+    FrameThread::Local().Series = nullptr;
+  }
+
+  // Per-thread or per-CPU event buffers for the next session.
+  void SetCaptureMode(trace::CaptureMode mode) {
+    trace::TraceCollector::Get().SetCaptureMode(mode);
+  }
+
+  // Controls how the next session batches its file writes.
+  void SetTraceWriterOptions(const trace::TraceWriterOptions &options) {
+    trace::TraceCollector::Get().SetWriterOptions(options);
   }
 
+  // Names the calling thread's track in every session from now on.
+  void SetThreadName(std::string_view name) { trace::TraceCollector::Get().SetThreadName(name); }
+
   static Instrumentor &Get() {
     static Instrumentor instance;
     return instance;
   }
 
+  // Records one in every `every` scopes on each thread; 1 records all of them.
+  void SetSampleEvery(std::uint32_t every) {
+    m_SampleEvery.store(every > 1 ? every : 1, std::memory_order_relaxed);
+  }
+
+  std::uint32_t GetSampleEvery(void) const { return m_SampleEvery.load(std::memory_order_relaxed); }
+
+  bool ShouldSample(void) {
+    auto every = m_SampleEvery.load(std::memory_order_relaxed);
+    if (every == 1) [[likely]]
+      return true;
+    thread_local std::uint32_t counter = 0;
+    return ++counter % every == 0;
+  }
+
+  // Budget overruns are written to the trace as marked events, sampled out or not.
+  void SetMarkBudgetOverruns(bool enabled = true) {
+    m_MarkBudgetOverruns.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool MarkBudgetOverruns(void) const {
+    return m_MarkBudgetOverruns.load(std::memory_order_relaxed);
+  }
+
 private:
-  Instrumentor() : m_CurrentSession(nullptr) {}
+  static void FillComplete(trace::TraceEvent &event, std::string_view name, std::int64_t start_ns,
+                           std::int64_t duration_ns, const char *category,
+                           std::span<const trace::TraceArg> args) {
+    event.Reset(trace::TraceEventType::Complete, name, category);
+    event.StartNs = start_ns;
+    event.DurationNs = duration_ns;
+    const TraceContext &context = TraceContext::Current();
+    event.RequestID = context.RequestID;
+    event.SpanID = context.SpanID;
+    event.ParentSpanID = context.ParentSpanID;
+    event.Filtered = !ContextRecorded(context);
+    for (const auto &arg : args)
+      event.AddArg(arg);
+  }
 
-  ~Instrumentor() { EndSession(); }
+  static bool ContextRecorded(const TraceContext &context) {
+    return context.RequestID ? context.Recorded : RequestFilter::KeepUnscoped();
+  }
 
-  void WriteHeader() {
-    m_OutputStream << "{\"otherData\": {},\"traceEvents\":[{}";
-    m_OutputStream.flush();
+  // Returns true when the event has been dealt with; false leaves it to the caller to write.
+  bool CaptureInFrame(FrameThread &frame, std::string_view name, std::int64_t start_ns,
+                      std::int64_t duration_ns, const char *category,
+                      std::span<const trace::TraceArg> args) {
+    frame.AddSiteTime(name, std::chrono::nanoseconds(duration_ns));
+    if (frame.Events.size() == frame.Options.MaxEventsPerFrame)
+      return frame.Options.RetainOnly;
+    FillComplete(frame.Events.emplace_back(), name, start_ns, duration_ns, category, args);
+    if (!frame.Options.RetainOnly)
+      WriteEvent(frame.Events.back());
+    return true;
   }
 
-  void WriteFooter() {
-    m_OutputStream << "]}";
-    m_OutputStream.flush();
+  // The collector is constructed first so that it outlives this instance.
+  Instrumentor() {
+    (void)trace::TraceCollector::Get();
+#if !defined(_WIN32)
+    pthread_atfork(&Instrumentor::PrepareFork, &Instrumentor::AfterForkInParent,
+                   &Instrumentor::AfterForkInChild);
+#endif
   }
 
-  // Note: you must already own lock on m_Mutex before
-  // calling InternalEndSession()
-  void InternalEndSession() {
-    if (m_CurrentSession) {
-      WriteFooter();
-      m_OutputStream.close();
-      delete m_CurrentSession;
-      m_CurrentSession = nullptr;
-    }
+  ~Instrumentor() { EndSession(); }
+
+#if !defined(_WIN32)
+  static void PrepareFork(void) { trace::TraceCollector::Get().PrepareFork(); }
+
+  static void AfterForkInParent(void) { trace::TraceCollector::Get().AfterForkInParent(); }
+
+  // A forked child continues in a session of its own next to the parent's file, from its first
+  // event on; see TraceCollector::ResumeAfterFork().
+  static void AfterForkInChild(void) {
+    ScopeStack::AfterForkInChild();
+    trace::TraceCollector::Get().AfterForkInChild();
   }
+#endif
 
 private:
-  std::mutex m_Mutex;
-  InstrumentationSession *m_CurrentSession;
-  std::ofstream m_OutputStream;
+  std::atomic<std::uint32_t> m_SampleEvery{1};
+  std::atomic_bool m_MarkBudgetOverruns{true};
 };
 
 class InstrumentationTimer {
 public:
   template <typename... Args>
-  InstrumentationTimer(const char *name, Args &&...args) : m_Name(name), m_Stopped(false) {
+  InstrumentationTimer(const char *name, Args &&...args)
+      : m_Name(name), m_Stopped(!Instrumentor::Get().ShouldSample()) {
+    if (m_Stopped) {
+      ScopeStack::Local().Push(name);
+      return;
+    }
     m_StartTimepoint = std::chrono::steady_clock::now();
+    ScopeStack::Local().Push(name, trace::steady_nanoseconds(m_StartTimepoint));
     AddArgs(std::forward<Args>(args)...);
   }
 
+  // Counted against `site`, and only timed when the governor currently lets the site through.
+  template <typename... Args>
+  InstrumentationTimer(GovernedSite &site, GovernorTally &tally, const char *name, Args &&...args)
+      : m_Name(name), m_Site(&site), m_Tally(&tally),
+        m_Stopped(!site.Admit(tally) || !Instrumentor::Get().ShouldSample()) {
+    if (m_Stopped) {
+      ScopeStack::Local().Push(name);
+      return;
+    }
+    m_StartTimepoint = std::chrono::steady_clock::now();
+    ScopeStack::Local().Push(name, trace::steady_nanoseconds(m_StartTimepoint));
+    AddArgs(std::forward<Args>(args)...);
+  }
+
+  InstrumentationTimer(const InstrumentationTimer &) = delete;
+  InstrumentationTimer &operator=(const InstrumentationTimer &) = delete;
+
   ~InstrumentationTimer() {
     if (!m_Stopped)
       Stop();
+    else if (TailLatency::Enabled()) [[unlikely]]
+      TailLatency::Skip();
+    ScopeStack::Local().Pop();
   }
 
   template <typename... Args> void AddArgs(Args &&...inputs) {
-    int i = 0;
-    auto logger = spdlog::get("test");
+    [[maybe_unused]] int i = 0;
     (
         [&] {
           ++i;
-          logger->trace("Arg: {0} val: {1}", i, inputs);
           m_ProfiledArgs.insert(
               {std::to_string(i),
                std::make_shared<
@@ -567,38 +976,159 @@ public:
         ...);
   }
 
-  void Stop() {
-    auto endTimepoint = std::chrono::steady_clock::now();
-    auto highResStart = FloatingPointMicroseconds{m_StartTimepoint.time_since_epoch()};
-    auto elapsedTime =
-        std::chrono::time_point_cast<std::chrono::microseconds>(endTimepoint).time_since_epoch() -
-        std::chrono::time_point_cast<std::chrono::microseconds>(m_StartTimepoint)
-            .time_since_epoch();
-
-    auto logger = spdlog::get("test");
-    // logger->trace("{0} on thread {1} took {2}", m_Name, std::this_thread::get_id(), elapsedTime);
-    // SIMPERF_LOG_PROFILE("{0} on thread {1} took {2}", m_Name, std::this_thread::get_id(),
-    // elapsedTime);
-    Instrumentor::Get().WriteProfile(
-        {m_Name, highResStart, elapsedTime, std::this_thread::get_id()});
-    m_Stopped = true;
-    std::stringstream ss;
-    ss << std::this_thread::get_id();
-    uint64_t id = std::stoull(ss.str());
-    logger->trace("{0} on thread {1} took {2}", m_Name, id, elapsedTime);
-    for (const auto &kv : m_ProfiledArgs) {
+  void Stop() { Stop(std::chrono::steady_clock::now()); }
 
-      logger->trace("Arg: {0} val: {1}", kv.first, kv.second->to_string());
+protected:
+  void Stop(std::chrono::steady_clock::time_point endTimepoint,
+            const char *category = "function", std::initializer_list<trace::TraceArg> args = {}) {
+    auto duration =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(endTimepoint - m_StartTimepoint)
+            .count();
+    m_Stopped = true;
+    if (m_Tally)
+      GovernedSite::AddTimed(*m_Tally, duration);
+    if (m_Site && GovernedSite::LatencyRecording()) [[unlikely]]
+      m_Site->RecordLatency(duration);
+    if (TailLatency::Enabled()) [[unlikely]] {
+      auto threshold = m_Site ? m_Site->TailThresholdNs() : TailLatency::ThresholdNs();
+      if (!TailLatency::Keep(duration, threshold)) {
+        if (m_Tally)
+          GovernedSite::AddFastDropped(*m_Tally);
+        else
+          TailLatency::CountDropped();
+        return;
+      }
     }
+    Instrumentor::Get().WriteComplete(m_Name, trace::steady_nanoseconds(m_StartTimepoint),
+                                      duration, category, args);
   }
 
-private:
+protected:
   const char *m_Name;
   std::chrono::time_point<std::chrono::steady_clock> m_StartTimepoint;
   std::map<std::string, std::shared_ptr<ProfiledArgBase>> m_ProfiledArgs;
+  GovernedSite *m_Site = nullptr;
+  GovernorTally *m_Tally = nullptr;
   bool m_Stopped;
 };
 
+inline const AssertionSpec<> &default_budget_spec(void) {
+  static const AssertionSpec<> spec(
+      AssertionType::ExplicitNoThrow,
+      AssertionControlFlags::Global | AssertionControlFlags::Type | AssertionControlFlags::Tag,
+      AssertionMsgSpec<>(ASSERT_FMTMSG, BUDGET_PREFIX));
+  return spec;
+}
+
+inline const std::array<SmartString<std::string>, 2> &default_budget_tags(void) {
+  static const auto tags = make_array(std::string(::simperf::ctx::GetDefaultTag()), "budget");
+  return tags;
+}
+
+// An InstrumentationTimer that always times its scope, even when sampled out, and reports an
+// overrun of its site's budget as an assertion failure of default_budget_spec().
+class InstrumentationBudgetTimer : public InstrumentationTimer {
+public:
+  template <typename... Args>
+  InstrumentationBudgetTimer(ScopeSite &site, Args &&...args)
+      : InstrumentationTimer(site.Name(), std::forward<Args>(args)...), m_Site(site),
+        m_BudgetChecked(false) {
+    if (m_Stopped)
+      m_StartTimepoint = std::chrono::steady_clock::now();
+  }
+
+  ~InstrumentationBudgetTimer() {
+    if (!m_BudgetChecked)
+      Stop();
+  }
+
+  void Stop() {
+    auto endTimepoint = std::chrono::steady_clock::now();
+    m_BudgetChecked = true;
+    auto elapsed = endTimepoint - m_StartTimepoint;
+    if (elapsed <= m_Site.Budget()) [[likely]] {
+      if (!m_Stopped)
+        InstrumentationTimer::Stop(endTimepoint);
+      return;
+    }
+    OnOverrun(endTimepoint, elapsed);
+  }
+
+private:
+  SIMPERF_NOINLINE SIMPERF_COLD void
+  OnOverrun(std::chrono::steady_clock::time_point endTimepoint,
+            std::chrono::steady_clock::duration elapsed) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto overrun = duration_cast<std::chrono::nanoseconds>(elapsed) - m_Site.Budget();
+    m_Site.RecordOverrun(overrun);
+
+    auto overrun_us = duration_cast<microseconds>(overrun);
+    auto budget_us = duration_cast<microseconds>(m_Site.Budget());
+    auto a = Assertion(false, overrun_us, budget_us, m_Site.Name(), "overrun", "budget",
+                       default_budget_tags(), default_budget_spec(), m_Site.Location());
+    (void)a;
+
+    if (Instrumentor::Get().MarkBudgetOverruns()) {
+      InstrumentationTimer::Stop(endTimepoint, "function,budget_overrun",
+                                 {trace::TraceArg::Integer("budget_us", budget_us.count()),
+                                  trace::TraceArg::Integer("overrun_us", overrun_us.count())});
+    } else if (!m_Stopped) {
+      InstrumentationTimer::Stop(endTimepoint);
+    }
+  }
+
+private:
+  ScopeSite &m_Site;
+  bool m_BudgetChecked;
+};
+
+// An InstrumentationTimer that, while its site's tag is enabled, also samples the thread's CPU
+// time, context switches, page faults and core at both ends of the scope. The deltas are added to
+// the site and attached to the trace event.
+class InstrumentationUsageTimer : public InstrumentationTimer {
+public:
+  template <typename... Args>
+  InstrumentationUsageTimer(UsageSite &site, Args &&...args)
+      : InstrumentationTimer(site.Name(), std::forward<Args>(args)...), m_Site(site),
+        m_Sampling(!m_Stopped && site.Enabled()) {
+    if (m_Sampling)
+      m_BeginUsage = ResourceUsage::Capture();
+  }
+
+  ~InstrumentationUsageTimer() {
+    if (!m_Stopped)
+      Stop();
+  }
+
+  void Stop() {
+    if (!m_Sampling) {
+      InstrumentationTimer::Stop();
+      return;
+    }
+    auto delta = ResourceUsageDelta::Between(m_BeginUsage, ResourceUsage::Capture());
+    auto endTimepoint = std::chrono::steady_clock::now();
+    m_Sampling = false;
+    m_Site.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(endTimepoint -
+                                                                       m_StartTimepoint),
+                  delta);
+    InstrumentationTimer::Stop(
+        endTimepoint, "function",
+        {trace::TraceArg::Integer("cpu_ns", delta.CpuNs),
+         trace::TraceArg::Integer("voluntary_switches", delta.VoluntarySwitches),
+         trace::TraceArg::Integer("involuntary_switches", delta.InvoluntarySwitches),
+         trace::TraceArg::Integer("minor_faults", delta.MinorFaults),
+         trace::TraceArg::Integer("major_faults", delta.MajorFaults),
+         trace::TraceArg::Integer("migrated", delta.Migrated)});
+  }
+
+private:
+  UsageSite &m_Site;
+  bool m_Sampling;
+  ResourceUsage m_BeginUsage;
+};
+
 namespace InstrumentorUtils {
 
 template <size_t N> struct ChangeResult {
@@ -624,6 +1154,279 @@ constexpr auto CleanupOutputString(const char (&expr)[N], const char (&remove)[K
   return result;
 }
 } // namespace InstrumentorUtils
+#pragma endregion profiling
+
+#pragma region locks
+// Shared by the instrumented locks below. Members other than m_Site are only touched by the thread
+// that owns the lock exclusively. Construction only keeps the name and location, so a lock can be
+// constant-initialized; the site is looked up on the first contended or sampled acquisition, and
+// `name` must outlive the lock until then.
+template <typename Mutex> class InstrumentedLock {
+public:
+  constexpr explicit InstrumentedLock(const std::source_location &location)
+      : m_Location(location) {}
+
+  constexpr InstrumentedLock(const char *name, const std::source_location &location)
+      : m_Name(name), m_Location(location) {}
+
+  InstrumentedLock(const InstrumentedLock &) = delete;
+  InstrumentedLock &operator=(const InstrumentedLock &) = delete;
+
+  ~InstrumentedLock() {
+    if (m_Acquisitions)
+      ResolvedSite().AddAcquisitions(m_Acquisitions);
+  }
+
+  // Uncontended, this is a try_lock() and a counter bump; the clock is only read once the lock
+  // turns out to be taken, or for the sampled holds.
+  void lock() {
+    if (m_Mutex.try_lock()) [[likely]] {
+      if (CountAcquisition()) [[unlikely]]
+        StartTimedHold(std::chrono::steady_clock::now());
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    m_Mutex.lock();
+    auto acquired = std::chrono::steady_clock::now();
+    CountAcquisition();
+    // The wait is recorded by unlock(), so the hold does not include the profiler's own work.
+    StartTimedHold(acquired);
+    m_WaitSince = start;
+    m_ContendedHold = true;
+  }
+
+  bool try_lock() {
+    if (!m_Mutex.try_lock())
+      return false;
+    if (CountAcquisition()) [[unlikely]]
+      StartTimedHold(std::chrono::steady_clock::now());
+    return true;
+  }
+
+  void unlock() {
+    if (!m_TimedHold) [[likely]] {
+      m_Mutex.unlock();
+      return;
+    }
+    auto released = std::chrono::steady_clock::now();
+    auto held_since = m_HeldSince;
+    auto wait_since = m_WaitSince;
+    bool contended = m_ContendedHold;
+    m_TimedHold = m_ContendedHold = false;
+    m_Mutex.unlock();
+
+    auto hold = std::chrono::duration_cast<std::chrono::nanoseconds>(released - held_since);
+    auto &site = ResolvedSite();
+    site.RecordHold(hold);
+    if (contended) {
+      RecordWait(wait_since, held_since);
+      Instrumentor::Get().WriteComplete(site.Name(), trace::steady_nanoseconds(held_since),
+                                        hold.count(), "lock_held");
+    }
+  }
+
+  const LockSite &Site(void) const { return ResolvedSite(); }
+
+protected:
+  // Racing resolutions find the same site, so whichever store lands last is as good as the first.
+  LockSite &ResolvedSite(void) const {
+    LockSite *site = m_Site.load(std::memory_order_acquire);
+    if (site == nullptr) [[unlikely]] {
+      site = &LockSiteRegistry::Resolve(m_Name, m_Location);
+      m_Site.store(site, std::memory_order_release);
+    }
+    return *site;
+  }
+
+  // Returns true once every LOCK_SAMPLE_PERIOD acquisitions, when the batch is handed to the site.
+  bool CountAcquisition(void) {
+    if (++m_Acquisitions < LOCK_SAMPLE_PERIOD)
+      return false;
+    ResolvedSite().AddAcquisitions(m_Acquisitions);
+    m_Acquisitions = 0;
+    return true;
+  }
+
+  void StartTimedHold(std::chrono::steady_clock::time_point now) {
+    m_HeldSince = now;
+    m_TimedHold = true;
+  }
+
+  void RecordWait(std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point acquired) {
+    auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - start);
+    auto &site = ResolvedSite();
+    site.RecordWait(wait);
+    Instrumentor::Get().WriteComplete(site.Name(), trace::steady_nanoseconds(start),
+                                      wait.count(), "lock_wait");
+  }
+
+protected:
+  Mutex m_Mutex;
+  const char *m_Name = nullptr;
+  std::source_location m_Location;
+  mutable std::atomic<LockSite *> m_Site{nullptr};
+  std::uint32_t m_Acquisitions = 0;
+  bool m_TimedHold = false;
+  bool m_ContendedHold = false;
+  std::chrono::steady_clock::time_point m_HeldSince;
+  std::chrono::steady_clock::time_point m_WaitSince; // contended holds only
+};
+
+// Drop-in for std::mutex. Waits and contended holds are written to the trace, and every lock
+// declared at the same place adds to the same LockSiteRegistry entry.
+class mutex : public InstrumentedLock<std::mutex> {
+public:
+  constexpr mutex(std::source_location location = std::source_location::current())
+      : InstrumentedLock(location) {}
+
+  constexpr mutex(const char *name,
+                  std::source_location location = std::source_location::current())
+      : InstrumentedLock(name, location) {}
+};
+
+// Drop-in for std::shared_mutex. Readers keep no per-holder state, so a shared wait is recorded
+// as soon as the read lock is taken; hold times are only tracked for exclusive ownership.
+class shared_mutex : public InstrumentedLock<std::shared_mutex> {
+public:
+  shared_mutex(std::source_location location = std::source_location::current())
+      : InstrumentedLock(location) {}
+
+  shared_mutex(const char *name, std::source_location location = std::source_location::current())
+      : InstrumentedLock(name, location) {}
+
+  ~shared_mutex() {
+    auto remainder = m_SharedAcquisitions.load(std::memory_order_relaxed) % LOCK_SAMPLE_PERIOD;
+    if (remainder)
+      ResolvedSite().AddAcquisitions(remainder);
+  }
+
+  void lock_shared() {
+    if (m_Mutex.try_lock_shared()) [[likely]] {
+      CountSharedAcquisition();
+      return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    m_Mutex.lock_shared();
+    CountSharedAcquisition();
+    RecordWait(start, std::chrono::steady_clock::now());
+  }
+
+  bool try_lock_shared() {
+    if (!m_Mutex.try_lock_shared())
+      return false;
+    CountSharedAcquisition();
+    return true;
+  }
+
+  void unlock_shared() { m_Mutex.unlock_shared(); }
+
+private:
+  // Readers already write the shared_mutex's own cache line; this counter sits next to it.
+  void CountSharedAcquisition(void) {
+    auto count = m_SharedAcquisitions.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (count % LOCK_SAMPLE_PERIOD == 0)
+      ResolvedSite().AddAcquisitions(LOCK_SAMPLE_PERIOD);
+  }
+
+private:
+  std::atomic<std::uint32_t> m_SharedAcquisitions{0};
+};
+#pragma endregion locks
+
+#pragma region runtimeconfig
+// Every setting is swapped in through an atomic or a short critical section that instrumented
+// threads only touch on their slow paths, so reloading never stalls them.
+inline void apply_runtime_config(const RuntimeConfig &config) {
+  static std::mutex s_ApplyLock;
+  static std::optional<SessionConfig> s_AppliedSession;
+  static std::optional<MetricsConfig> s_AppliedMetrics;
+  std::lock_guard lock(s_ApplyLock);
+
+  for (const auto &[name, level] : config.LoggerLevels) {
+    if (auto logger = spdlog::get(name))
+      logger->set_level(level);
+  }
+  if (config.GlobalAssertions)
+    ctx::SetGlobalAssertionStatus(*config.GlobalAssertions);
+  if (config.AsyncLogLevel)
+    ctx::SetAsyncLogLevel(*config.AsyncLogLevel);
+  for (const auto &[tag, enabled] : config.Tags) {
+    ctx::AddTag(tag, enabled);
+    ctx::SetInstrumentTagStatus(tag, enabled);
+  }
+  for (const auto &[type, enabled] : config.AssertionTypes)
+    ctx::SetAssertionTypeStatus(type, enabled);
+  // The config file owns the pattern rules; file and tag rules set from code are kept.
+  LogSiteRegistry::ReplaceRules(LogSiteRegistry::RuleKind::Pattern, config.LogSitePatterns);
+  if (config.SampleEvery)
+    Instrumentor::Get().SetSampleEvery(*config.SampleEvery);
+  if (config.GovernorBudget) {
+    auto options = Governor::Options();
+    options.Enabled = *config.GovernorBudget > 0.0;
+    options.Budget = *config.GovernorBudget;
+    Governor::SetOptions(options);
+  }
+  for (const auto &[tag, enabled] : config.ResourceUsageTags)
+    ctx::SetResourceUsageTagStatus(tag, enabled);
+
+  // Sessions are only touched when their settings actually change.
+  if (config.Session && config.Session != s_AppliedSession) {
+    if (config.Session->Enabled) {
+      trace::TraceWriterOptions options;
+      options.FlushInterval = std::chrono::milliseconds(config.Session->FlushIntervalMs);
+      options.FlushBytes =
+          static_cast<std::size_t>(std::max<std::int64_t>(config.Session->FlushBytes, 0));
+      options.IoUring = config.Session->IoUring;
+      Instrumentor::Get().SetTraceWriterOptions(options);
+      Instrumentor::Get().SetCaptureMode(trace::parse_capture_mode(config.Session->Capture));
+      auto tail = TailLatency::Options();
+      tail.Enabled = config.Session->TailThresholdUs > 0;
+      if (tail.Enabled)
+        tail.Threshold = std::chrono::microseconds(config.Session->TailThresholdUs);
+      TailLatency::SetOptions(tail);
+      Instrumentor::Get().BeginSession(config.Session->Name, config.Session->Path,
+                                       trace::parse_trace_format(config.Session->Format));
+    } else if (s_AppliedSession && s_AppliedSession->Enabled) {
+      Instrumentor::Get().EndSession();
+    }
+    s_AppliedSession = config.Session;
+  }
+
+  if (config.Metrics && config.Metrics != s_AppliedMetrics) {
+    if (config.Metrics->Enabled)
+      MetricsExporter::Get().Start(
+          {config.Metrics->Path,
+           std::chrono::milliseconds(std::max<std::int64_t>(config.Metrics->IntervalMs, 1))});
+    else
+      MetricsExporter::Get().Stop();
+    s_AppliedMetrics = config.Metrics;
+  }
+}
+
+// Applies the runtime section of `path` now and again whenever the file changes. Malformed
+// revisions are reported on the default logger and leave the previous settings in place.
+inline void watch_config(const char *path) {
+  auto &watcher = ConfigWatcher::Get();
+  watcher.Start(path, [](const RuntimeConfig &config) { apply_runtime_config(config); });
+  watcher.Reload();
+}
+
+inline void stop_watching_config(void) { ConfigWatcher::Get().Stop(); }
+#pragma endregion runtimeconfig
+
+#pragma region profilingmacros
+
+// simperf2-client.hpp's name-only forms give way to the full ones.
+#if defined(SIMPERF_CLIENT_HEADER)
+#undef SIMPERF_PROFILE_BEGIN_SESSION
+#undef SIMPERF_PROFILE_END_SESSION
+#undef SIMPERF_PROFILE_THREAD_NAME
+#undef SIMPERF_PROFILE_SCOPE_LINE2
+#undef SIMPERF_PROFILE_SCOPE_LINE
+#undef SIMPERF_PROFILE_SCOPE
+#undef SIMPERF_PROFILE_FUNCTION
+#endif
 
 #if (defined(_DEBUG) && !defined(SIMPERF_DISABLE)) || defined(SIMPERF_ENABLE)
 // Resolve which function signature macro will be used. Note that this only
@@ -651,23 +1454,92 @@ constexpr auto CleanupOutputString(const char (&expr)[N], const char (&remove)[K
 
 #define SIMPERF_PROFILE_BEGIN_SESSION(name, filepath)                                              \
   ::simperf::Instrumentor::Get().BeginSession(name, filepath)
+#define SIMPERF_PROFILE_BEGIN_SESSION_PERFETTO(name, filepath)                                     \
+  ::simperf::Instrumentor::Get().BeginSession(name, filepath,                                      \
+                                              ::simperf::trace::TraceFormat::Perfetto)
 #define SIMPERF_PROFILE_END_SESSION() ::simperf::Instrumentor::Get().EndSession()
+#define SIMPERF_PROFILE_THREAD_NAME(name) ::simperf::Instrumentor::Get().SetThreadName(name)
 #define SIMPERF_PROFILE_SCOPE_LINE2(name, line, ...)                                               \
-  constexpr auto fixedName##line =                                                                 \
+  static constexpr auto fixedName##line =                                                          \
       ::simperf::InstrumentorUtils::CleanupOutputString(name, "__cdecl ");                         \
-  ::simperf::InstrumentationTimer timer##line(fixedName##line.Data, __VA_ARGS__)
+  static ::simperf::GovernedSite governedSite##line(fixedName##line.Data);                         \
+  thread_local ::simperf::GovernorTally governorTally##line{};                                     \
+  ::simperf::InstrumentationTimer timer##line(governedSite##line, governorTally##line,             \
+                                              fixedName##line.Data __VA_OPT__(, ) __VA_ARGS__)
 
 #define SIMPERF_PROFILE_SCOPE_LINE(name, line, ...)                                                \
   SIMPERF_PROFILE_SCOPE_LINE2(name, line, __VA_ARGS__)
 #define SIMPERF_PROFILE_SCOPE(name, ...) SIMPERF_PROFILE_SCOPE_LINE(name, __LINE__, __VA_ARGS__)
 #define SIMPERF_PROFILE_FUNCTION(...) SIMPERF_PROFILE_SCOPE(SIMPERF_FUNC_SIG, __VA_ARGS__)
 
+// `budget` is any std::chrono duration, e.g. std::chrono::microseconds(200).
+#define SIMPERF_PROFILE_SCOPE_BUDGET_LINE2(name, budget, line, ...)                                \
+  static constexpr auto fixedName##line =                                                          \
+      ::simperf::InstrumentorUtils::CleanupOutputString(name, "__cdecl ");                         \
+  static ::simperf::ScopeSite scopeSite##line(fixedName##line.Data, budget);                       \
+  ::simperf::InstrumentationBudgetTimer timer##line(scopeSite##line __VA_OPT__(, ) __VA_ARGS__)
+
+#define SIMPERF_PROFILE_SCOPE_BUDGET_LINE(name, budget, line, ...)                                 \
+  SIMPERF_PROFILE_SCOPE_BUDGET_LINE2(name, budget, line, __VA_ARGS__)
+#define SIMPERF_PROFILE_SCOPE_BUDGET(name, budget, ...)                                            \
+  SIMPERF_PROFILE_SCOPE_BUDGET_LINE(name, budget, __LINE__, __VA_ARGS__)
+
+// Marks the end of one iteration of a loop and the start of the next; see FrameSeries.
+#define SIMPERF_FRAME_MARK_LINE2(name, line)                                                       \
+  static ::simperf::FrameSeries &frameSeries##line = ::simperf::FrameRegistry::Get(name);          \
+  ::simperf::Instrumentor::Get().MarkFrame(frameSeries##line)
+
+#define SIMPERF_FRAME_MARK_LINE(name, line) SIMPERF_FRAME_MARK_LINE2(name, line)
+#define SIMPERF_FRAME_MARK(name) SIMPERF_FRAME_MARK_LINE(name, __LINE__)
+
+// Records `expr`, any number, into the calling thread's series for `name`. Samples become
+// counter events in the trace session and min/max/mean windows, see ValueSiteRegistry.
+#define SIMPERF_TRACK_VALUE_LINE2(name, expr, line)                                                \
+  static ::simperf::ValueSite valueSite##line(name);                                               \
+  thread_local ::simperf::ValueSeries valueSeries##line(valueSite##line);                          \
+  valueSeries##line.Record(expr)
+
+#define SIMPERF_TRACK_VALUE_LINE(name, expr, line) SIMPERF_TRACK_VALUE_LINE2(name, expr, line)
+#define SIMPERF_TRACK_VALUE(name, expr) SIMPERF_TRACK_VALUE_LINE(name, expr, __LINE__)
+
+// SIGPROF sampling of the calling thread, written into the session as "sample" instant events
+// tagged with the enclosing SIMPERF scope. Start the sampler once, then mark each thread to sample.
+#define SIMPERF_PROFILE_SAMPLER_START(interval) ::simperf::Sampler::Get().Start(interval)
+#define SIMPERF_PROFILE_SAMPLER_STOP() ::simperf::Sampler::Get().Stop()
+#define SIMPERF_PROFILE_SAMPLE_THREAD() ::simperf::Sampler::Get().RegisterThread()
+
+// Writes every thread's open scopes and unwritten events to `path` on SIGSEGV, SIGBUS or SIGABRT.
+#define SIMPERF_PROFILE_CRASH_DUMP(path) ::simperf::CrashHandler::Install(path)
+
+// Samples CPU time, context switches, page faults and core migration for the scope while `tag` is
+// enabled with ctx::SetResourceUsageTagStatus.
+#define SIMPERF_PROFILE_SCOPE_USAGE_LINE2(name, tag, line, ...)                                    \
+  static constexpr auto fixedName##line =                                                          \
+      ::simperf::InstrumentorUtils::CleanupOutputString(name, "__cdecl ");                         \
+  static ::simperf::UsageSite usageSite##line(fixedName##line.Data, tag);                          \
+  ::simperf::InstrumentationUsageTimer timer##line(usageSite##line __VA_OPT__(, ) __VA_ARGS__)
+
+#define SIMPERF_PROFILE_SCOPE_USAGE_LINE(name, tag, line, ...)                                     \
+  SIMPERF_PROFILE_SCOPE_USAGE_LINE2(name, tag, line, __VA_ARGS__)
+#define SIMPERF_PROFILE_SCOPE_USAGE(name, tag, ...)                                                \
+  SIMPERF_PROFILE_SCOPE_USAGE_LINE(name, tag, __LINE__, __VA_ARGS__)
+
 #else
 #define SIMPERF_PROFILE_BEGIN_SESSION(name, filepath)
+#define SIMPERF_PROFILE_BEGIN_SESSION_PERFETTO(name, filepath)
 #define SIMPERF_PROFILE_END_SESSION()
+#define SIMPERF_PROFILE_THREAD_NAME(name)
 #define SIMPERF_PROFILE_SCOPE(name)
 #define SIMPERF_PROFILE_FUNCTION()
+#define SIMPERF_PROFILE_SCOPE_BUDGET(name, budget, ...)
+#define SIMPERF_PROFILE_SCOPE_USAGE(name, tag, ...)
+#define SIMPERF_FRAME_MARK(name)
+#define SIMPERF_TRACK_VALUE(name, expr)
+#define SIMPERF_PROFILE_SAMPLER_START(interval)
+#define SIMPERF_PROFILE_SAMPLER_STOP()
+#define SIMPERF_PROFILE_SAMPLE_THREAD()
+#define SIMPERF_PROFILE_CRASH_DUMP(path)
 #endif
 
 } // namespace simperf
-#pragma endregion profiling
+#pragma endregion profilingmacros
@@ -24,6 +24,8 @@ project "tests"
         "simperf",
     }
 
+    simperf_instrument_functions()
+
     targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
     objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
 
@@ -1,22 +1,913 @@
 #define SIMPERF_ENABLE
 #include "../include/simperf2.hpp"
+#include "../include/simperf2-client.hpp"
+
+#include <spdlog/sinks/ostream_sink.h>
+
+#include <cstdlib>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sys/wait.h>
+#endif
 
 void test_default_initialize();
 void test_default_asserts();
+void test_async_logging();
+void test_log_sites();
+void test_assertion_pass_cost();
+void test_assertion_rate_limit();
+void test_config_reload();
+void test_scope_budget();
+void test_fork_session();
+void test_perfetto_session();
+void test_batched_trace_writer();
+void test_instrumented_locks();
+void test_resource_usage();
+void test_frame_marks();
+void test_request_context();
+void test_sampling_profiler();
+void test_function_instrumentation();
+void test_client_header();
+void test_per_cpu_capture();
+void test_track_value();
+void test_overhead_governor();
+void test_crash_dump();
+void test_tail_latency();
+void test_metrics_exporter();
+void test_logger_registry_retention();
+
+static int s_Failures = 0;
+
+// Records a failed expectation and carries on; main() reports the count in its exit status.
+void expect(bool condition, const char *what, int line) {
+  if (condition)
+    return;
+  ++s_Failures;
+  std::cout << "FAILED (line " << line << "): " << what << std::endl;
+}
+
+#define EXPECT(condition) expect((condition), #condition, __LINE__)
+
+#if defined(__linux__)
+// Reaps `child`, killing it if it is still running after five seconds; true if it exited with 0.
+bool wait_for_clean_exit(pid_t child) {
+  int status = 0;
+  pid_t reaped = 0;
+  for (int i = 0; i < 500 && (reaped = waitpid(child, &status, WNOHANG)) == 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  if (reaped == 0) {
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+  }
+  return reaped == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+#endif
 
 int main() {
   try {
     test_default_initialize();
     test_default_asserts();
+    test_async_logging();
+    test_log_sites();
+    test_assertion_pass_cost();
+    test_assertion_rate_limit();
+    test_config_reload();
+    test_scope_budget();
+    test_fork_session();
+    test_perfetto_session();
+    test_batched_trace_writer();
+    test_instrumented_locks();
+    test_resource_usage();
+    test_frame_marks();
+    test_request_context();
+    test_sampling_profiler();
+    test_function_instrumentation();
+    test_client_header();
+    test_per_cpu_capture();
+    test_track_value();
+    test_overhead_governor();
+    test_crash_dump();
+    test_tail_latency();
+    test_metrics_exporter();
+    test_logger_registry_retention();
   } catch (std::exception &e) {
     std::cout << e.what() << std::endl;
+    ++s_Failures;
   }
+  if (s_Failures != 0)
+    std::cout << s_Failures << " expectation(s) failed" << std::endl;
+  return s_Failures == 0 ? 0 : 1;
 }
 
 void test_default_initialize() { 
     ::simperf::default_initialize();
 }
 
+void test_async_logging() {
+  ::simperf::ctx::EnableAsyncLogging();
+  for (int i = 0; i < 8; ++i) {
+    SIMPERF_INFO("simperf", "async record {0} of {1}", i, "test_async_logging");
+  }
+  ::simperf::ctx::FlushAsyncLogging();
+  ::simperf::ctx::DisableAsyncLogging();
+
+  // The backend sleeps through the burst, so the ring fills; errors past it are written in place.
+  std::ostringstream output;
+  auto previous = spdlog::default_logger();
+  spdlog::set_default_logger(std::make_shared<spdlog::logger>(
+      "async burst", std::make_shared<spdlog::sinks::ostream_sink_mt>(output)));
+  ::simperf::ctx::EnableAsyncLogging(::simperf::sp_log_level::trace, std::chrono::hours(1));
+  auto dropped = ::simperf::async::AsyncLogBackend::Get().DroppedCount();
+  for (int i = 0; i < 2000; ++i) {
+    SIMPERF_ERROR("simperf", "burst record {0}", i);
+  }
+  ::simperf::ctx::FlushAsyncLogging();
+  auto text = output.str();
+  EXPECT(std::count(text.begin(), text.end(), '\n') == 2000);
+  EXPECT(::simperf::async::AsyncLogBackend::Get().DroppedCount() == dropped);
+
+  // The backend prefixes the request ID; the caller's manually indexed format string is unchanged.
+  output.str("");
+  auto request = ::simperf::TraceContext::NewID();
+  {
+    ::simperf::TraceContextScope scope(::simperf::TraceContext::ForRequest(request));
+    SIMPERF_INFO("simperf", "request record {0}", 7);
+  }
+  ::simperf::ctx::FlushAsyncLogging();
+  EXPECT(output.str().find(std::format("[request {:016x}] request record 7", request)) !=
+         std::string::npos);
+
+  // A format error on the backend thread is written as a record instead of ending the process.
+  output.str("");
+  SIMPERF_INFO("simperf", "unmatched {0} {1}", 1);
+  ::simperf::ctx::FlushAsyncLogging();
+  EXPECT(output.str().find("failed to format async log record \"unmatched {0} {1}\"") !=
+         std::string::npos);
+
+#if defined(__linux__)
+  // A child has no backend thread; it logs in place and exits through the normal teardown.
+  pid_t child = fork();
+  if (child == 0) {
+    SIMPERF_INFO("simperf", "logged by the child");
+    ::simperf::ctx::FlushAsyncLogging();
+    std::exit(0);
+  }
+  EXPECT(wait_for_clean_exit(child));
+#endif
+  ::simperf::ctx::DisableAsyncLogging();
+  spdlog::set_default_logger(previous);
+  spdlog::drop("async burst");
+}
+
+void test_log_sites() {
+  int tagged_line = 0, other_line = 0;
+  auto log_both = [&] {
+    tagged_line = __LINE__ + 1;
+    SIMPERF_WARN("simperf", "logged while the simperf tag is enabled");
+    other_line = __LINE__ + 1;
+    SIMPERF_WARN("other", "logged while the other tag is enabled");
+  };
+  auto site = [](int line) {
+    for (const auto &info : ::simperf::LogSiteRegistry::Sites()) {
+      if (info.Line == line && info.File.ends_with("simperf2_test.cpp"))
+        return info;
+    }
+    return ::simperf::LogSiteInfo{};
+  };
+  auto expect_sites = [&](bool tagged_enabled, std::uint64_t tagged_messages, bool other_enabled,
+                          std::uint64_t other_messages, int line) {
+    auto tagged = site(tagged_line), other = site(other_line);
+    expect(tagged.Enabled == tagged_enabled, "tagged.Enabled", line);
+    expect(tagged.Messages == tagged_messages, "tagged.Messages", line);
+    expect(other.Enabled == other_enabled, "other.Enabled", line);
+    expect(other.Messages == other_messages, "other.Messages", line);
+  };
+
+  log_both();
+  expect_sites(true, 1, true, 1, __LINE__);
+  ::simperf::LogSiteRegistry::SetPatternStatus("simperf2_test.cpp:*", false);
+  log_both();
+  expect_sites(false, 1, false, 1, __LINE__);
+  ::simperf::LogSiteRegistry::SetTagStatus("simperf", true);
+  log_both();
+  expect_sites(true, 2, false, 1, __LINE__);
+  ::simperf::LogSiteRegistry::ResetStatus();
+  log_both();
+  expect_sites(true, 3, true, 2, __LINE__);
+}
+
+void test_assertion_pass_cost() {
+  constexpr int iterations = 10'000'000;
+  volatile int source = 0;
+  int failures = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    int x = source;
+    int y = source;
+    auto a = ::simperf::Assertion(x == y, x, y, "x == y");
+    if (a) {
+      ++failures;
+    }
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+
+  std::cout << "passing assertion: " << elapsed.count() / iterations << " ns/op" << std::endl;
+  EXPECT(failures == 0);
+}
+
+void test_assertion_rate_limit() {
+  int x = 1;
+  int y = 2;
+  const auto &tags = SIMPERF_ASSERTION_TAGS("simperf");
+  const auto &spec = SIMPERF_ASSERTION_SPEC(::simperf::AssertionType::ExplicitNoThrow);
+  std::uint32_t line = 0;
+  for (int i = 0; i < 1000; ++i) {
+    line = __LINE__ + 1;
+    auto a = ::simperf::Assertion(x == y, x, y, "x == y", "x", "y", tags, spec);
+    (void)a;
+  }
+  ::simperf::flush_assertion_summaries();
+  EXPECT(::simperf::ctx::GetAssertionFailureCount("simperf2_test.cpp", line) == 1000);
+}
+
+void test_config_reload() {
+  const char *path = "simperf_reload.conf";
+  auto write_config = [&](const char *text) {
+    std::ofstream(path, std::ios::trunc) << text;
+  };
+  auto wait_for = [](auto &&done) {
+    for (int i = 0; i < 40 && !done(); ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return done();
+  };
+
+  write_config("[simperf]\nassertions = true\n[simperf.tags]\nreload = true\n");
+  ::simperf::watch_config(path);
+  EXPECT(::simperf::ctx::GetInstrumentTagStatus("reload"));
+
+  write_config("[simperf]\nassertions = false\n[simperf.tags]\nreload = false\n"
+               "[simperf.profiling]\nsample_every = 4\n");
+  bool reloaded = wait_for([] { return !::simperf::ctx::GetGlobalAssertionStatus(); });
+  EXPECT(reloaded);
+  EXPECT(!::simperf::ctx::GetInstrumentTagStatus("reload"));
+  EXPECT(::simperf::Instrumentor::Get().GetSampleEvery() == 4);
+
+  // A malformed revision keeps the previous settings.
+  write_config("[simperf\nassertions = true\n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT(!::simperf::ctx::GetGlobalAssertionStatus());
+
+#if defined(__linux__)
+  // The child is left with a stopped watcher, so exiting does not wait on the parent's thread.
+  pid_t child = fork();
+  if (child == 0)
+    std::exit(::simperf::ConfigWatcher::Get().Running() ? 1 : 0);
+  EXPECT(wait_for_clean_exit(child));
+#endif
+
+  ::simperf::stop_watching_config();
+  ::simperf::ctx::SetGlobalAssertionStatus(true);
+  ::simperf::Instrumentor::Get().SetSampleEvery(1);
+  std::filesystem::remove(path);
+}
+
+void test_scope_budget() {
+  for (int i = 0; i < 4; ++i) {
+    SIMPERF_PROFILE_SCOPE_BUDGET("budgeted stage", std::chrono::microseconds(500));
+    if (i % 2)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (const auto &stats : ::simperf::ScopeSiteRegistry::Stats()) {
+    if (stats.Name == "budgeted stage")
+      EXPECT(stats.Overruns == 2);
+  }
+}
+
+void test_fork_session() {
+#if defined(__linux__)
+  SIMPERF_PROFILE_BEGIN_SESSION("fork", "fork.json");
+  pid_t child = fork();
+  {
+    ::simperf::InstrumentationTimer timer(child == 0 ? "child" : "parent");
+  }
+  if (child == 0) {
+    SIMPERF_PROFILE_END_SESSION();
+    std::exit(0); // through the exit-time teardown, as a real child would
+  }
+  EXPECT(wait_for_clean_exit(child));
+
+  // A child that records nothing writes no file of its own, and still exits cleanly.
+  pid_t quiet = fork();
+  if (quiet == 0)
+    std::exit(0);
+  EXPECT(wait_for_clean_exit(quiet));
+  SIMPERF_PROFILE_END_SESSION();
+
+  auto child_trace = ::simperf::per_process_path("fork.json", static_cast<std::uint32_t>(child));
+  std::ifstream file(child_trace);
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  EXPECT(contents.find("\"child\"") != std::string::npos);
+  EXPECT(contents.find("\"parent\"") == std::string::npos);
+  EXPECT(!std::filesystem::exists(
+      ::simperf::per_process_path("fork.json", static_cast<std::uint32_t>(quiet))));
+  std::filesystem::remove(child_trace);
+  std::filesystem::remove("fork.json");
+#endif
+}
+
+void test_perfetto_session() {
+  SIMPERF_PROFILE_BEGIN_SESSION_PERFETTO("perfetto", "trace.perfetto-trace");
+  std::thread worker([] {
+    SIMPERF_PROFILE_THREAD_NAME("worker");
+    for (int i = 0; i < 8; ++i) {
+      ::simperf::InstrumentationTimer timer("worker stage");
+    }
+  });
+  for (int i = 0; i < 8; ++i) {
+    ::simperf::InstrumentationTimer timer("main stage");
+  }
+  worker.join();
+  SIMPERF_PROFILE_END_SESSION();
+
+  EXPECT(std::filesystem::file_size("trace.perfetto-trace") > 0);
+  std::filesystem::remove("trace.perfetto-trace");
+}
+
+void test_batched_trace_writer() {
+  for (bool io_uring : {false, true}) {
+    ::simperf::trace::TraceWriterOptions options;
+    options.FlushInterval = std::chrono::hours(1);
+    options.IoUring = io_uring;
+    ::simperf::Instrumentor::Get().SetTraceWriterOptions(options);
+
+    SIMPERF_PROFILE_BEGIN_SESSION("batched", "batched.json");
+    for (int i = 0; i < 10000; ++i) {
+      ::simperf::InstrumentationTimer timer("batched scope");
+      if (i % 1000 == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    SIMPERF_PROFILE_END_SESSION();
+
+    std::ifstream file("batched.json");
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::size_t events = 0;
+    for (auto at = contents.find("\"batched scope\""); at != std::string::npos;
+         at = contents.find("\"batched scope\"", at + 1))
+      ++events;
+    auto submissions = ::simperf::trace::TraceCollector::Get().WriteSubmissions();
+    EXPECT(contents.ends_with("]}"));
+    EXPECT(events + ::simperf::trace::TraceCollector::Get().LastSessionDropped() == 10000);
+    EXPECT(submissions > 0 && submissions < 100);
+  }
+  ::simperf::Instrumentor::Get().SetTraceWriterOptions({});
+  std::filesystem::remove("batched.json");
+}
+
+// Constant-initialized, so it is usable from other static initializers in any order.
+constinit ::simperf::mutex s_ConstantLock("constant lock");
+
+void test_instrumented_locks() {
+  auto constant_site = [] {
+    for (const auto &stats : ::simperf::LockSiteRegistry::Stats()) {
+      if (stats.Name == "constant lock")
+        return true;
+    }
+    return false;
+  };
+  // The site is only looked up once a batch of acquisitions is handed over.
+  for (std::uint32_t i = 0; i + 1 < ::simperf::LOCK_SAMPLE_PERIOD; ++i)
+    std::lock_guard lock(s_ConstantLock);
+  EXPECT(!constant_site());
+  { std::lock_guard lock(s_ConstantLock); }
+  EXPECT(constant_site());
+  EXPECT(s_ConstantLock.Site().Stats().Acquisitions == ::simperf::LOCK_SAMPLE_PERIOD);
+
+  ::simperf::mutex counter_lock("counter lock");
+  ::simperf::shared_mutex table_lock;
+  int counter = 0;
+
+  std::atomic_bool go{false};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; ++t) {
+    workers.emplace_back([&] {
+      while (!go)
+        std::this_thread::yield();
+      for (int i = 0; i < 1000; ++i) {
+        {
+          std::lock_guard lock(counter_lock);
+          ++counter;
+        }
+        std::shared_lock read(table_lock);
+      }
+      std::unique_lock write(table_lock);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    });
+  }
+  go = true;
+  for (auto &worker : workers)
+    worker.join();
+
+  EXPECT(counter == 4000);
+  std::uint64_t table_contentions = 0;
+  for (const auto &stats : ::simperf::LockSiteRegistry::Stats()) {
+    if (stats.Name.starts_with("lock simperf2_test.cpp")) {
+      table_contentions += stats.Contentions;
+      EXPECT(stats.Contentions == 0 || stats.WaitTime.count() > 0);
+    }
+  }
+  // Every writer sleeps with the lock held while the others are running.
+  EXPECT(table_contentions > 0);
+}
+
+void test_resource_usage() {
+  ::simperf::ctx::SetResourceUsageTagStatus("io");
+  for (int i = 0; i < 2; ++i) {
+    SIMPERF_PROFILE_SCOPE_USAGE("touch pages", "io");
+    std::vector<char> pages(1 << 22);
+    for (std::size_t offset = 0; offset < pages.size(); offset += 4096)
+      pages[offset] = 1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  {
+    SIMPERF_PROFILE_SCOPE_USAGE("not sampled", "render");
+  }
+  ::simperf::ctx::SetResourceUsageTagStatus("io", false);
+
+  for (const auto &stats : ::simperf::ctx::GetUsageSiteStats()) {
+    if (stats.Name == "touch pages") {
+      EXPECT(stats.Samples == 2);
+      EXPECT(stats.MinorFaults > 0);
+      EXPECT(stats.VoluntarySwitches > 0);
+    } else if (stats.Name == "not sampled") {
+      EXPECT(stats.Samples == 0);
+    }
+  }
+}
+
+void test_frame_marks() {
+  ::simperf::FrameOptions options;
+  options.WorstFrames = 2;
+  options.RetainOnly = true;
+  ::simperf::FrameRegistry::Get("tick").SetOptions(options);
+
+  for (int i = 0; i < 10; ++i) {
+    SIMPERF_FRAME_MARK("tick");
+    ::simperf::InstrumentationTimer update("update");
+    if (i == 3 || i == 7)
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  SIMPERF_FRAME_MARK("tick");
+  ::simperf::Instrumentor::Get().EndFrames();
+
+  auto &series = ::simperf::FrameRegistry::Get("tick");
+  auto stats = series.Stats();
+  EXPECT(stats.Frames == 10);
+  std::vector<std::uint64_t> worst;
+  for (const auto &frame : series.WorstFrames()) {
+    worst.push_back(frame.Index);
+    EXPECT(frame.Events.size() == 1);
+  }
+  std::sort(worst.begin(), worst.end());
+  EXPECT((worst == std::vector<std::uint64_t>{3, 7}));
+}
+
+void test_request_context() {
+  ::simperf::RequestFilter::Enable(0, false);
+  auto selected = ::simperf::TraceContext::NewID();
+  ::simperf::RequestFilter::Select(selected);
+
+  SIMPERF_PROFILE_BEGIN_SESSION("requests", "requests.json");
+  {
+    ::simperf::InstrumentationTimer unscoped("unscoped");
+  }
+  for (auto request : {selected, ::simperf::TraceContext::NewID()}) {
+    ::simperf::TraceContextScope scope(::simperf::TraceContext::ForRequest(request));
+    ::simperf::InstrumentationTimer timer("handle request");
+    ::simperf::ctx::LogIt(std::string(::simperf::ctx::GetDefaultLoggerName()),
+                          ::simperf::sp_log_level::info, std::string("handling request"));
+
+    auto handoff = ::simperf::TraceContext::Capture();
+    std::thread([handoff] {
+      ::simperf::TraceContextScope restored(handoff);
+      ::simperf::TraceContextScope child(::simperf::TraceContext::ChildSpan());
+      ::simperf::InstrumentationTimer timer("background work");
+    }).join();
+  }
+  SIMPERF_PROFILE_END_SESSION();
+  ::simperf::RequestFilter::Disable();
+
+  std::ifstream file("requests.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  auto count = [&](std::string_view needle) {
+    std::size_t found = 0;
+    for (auto at = contents.find(needle); at != std::string::npos;
+         at = contents.find(needle, at + 1))
+      ++found;
+    return found;
+  };
+  EXPECT(count("\"handle request\"") == 1);
+  EXPECT(count("\"background work\"") == 1);
+  EXPECT(count("parent_span_id") == 1);
+  EXPECT(count("\"unscoped\"") == 0);
+  std::filesystem::remove("requests.json");
+}
+
+void test_sampling_profiler() {
+  SIMPERF_PROFILE_BEGIN_SESSION("sampling", "sampling.json");
+  bool started = SIMPERF_PROFILE_SAMPLER_START(std::chrono::microseconds(500));
+  {
+    ::simperf::InstrumentationTimer timer("spin");
+    volatile std::uint64_t sink = 0;
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    while (std::chrono::steady_clock::now() < until)
+      sink = sink + 1;
+  }
+#if defined(__linux__)
+  // The child inherits a running sampler without its thread or timers; it can start afresh, and
+  // stops without waiting on the parent's backend thread at exit.
+  pid_t child = fork();
+  if (child == 0) {
+    bool restarted = ::simperf::Sampler::Get().Start(std::chrono::microseconds(500));
+    ::simperf::Sampler::Get().Stop();
+    std::exit(restarted ? 0 : 1);
+  }
+  EXPECT(wait_for_clean_exit(child));
+#endif
+  SIMPERF_PROFILE_SAMPLER_STOP();
+  SIMPERF_PROFILE_END_SESSION();
+
+  std::ifstream file("sampling.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  EXPECT(started);
+  EXPECT(::simperf::Sampler::Get().SampleCount() > 0);
+  EXPECT(contents.find("\"scope\":\"spin\"") != std::string::npos);
+  std::filesystem::remove("sampling.json");
+
+  // Restarted, the sampler picks up the threads it already knew.
+  auto samples = ::simperf::Sampler::Get().SampleCount();
+  EXPECT(SIMPERF_PROFILE_SAMPLER_START(std::chrono::microseconds(500)));
+  {
+    volatile std::uint64_t sink = 0;
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    while (std::chrono::steady_clock::now() < until)
+      sink = sink + 1;
+  }
+  SIMPERF_PROFILE_SAMPLER_STOP();
+  EXPECT(::simperf::Sampler::Get().SampleCount() > samples);
+}
+
+// Drives the hooks by hand; a project built with -finstrument-functions calls them itself.
+void test_function_instrumentation() {
+  ::simperf::FunctionTraceOptions options;
+  options.MinDuration = std::chrono::microseconds(100);
+  options.IncludeModule("");
+  options.ExcludeRange({0x1000, 0x2000});
+  ::simperf::FunctionTracer::Configure(options);
+  ::simperf::FunctionTracer::Enable();
+  SIMPERF_PROFILE_BEGIN_SESSION("functions", "functions.json");
+
+  auto call = [](void *function, std::chrono::microseconds duration) {
+    ::simperf::FunctionTracer::Enter(function, nullptr);
+    std::this_thread::sleep_for(duration);
+    ::simperf::FunctionCall record;
+    if (!::simperf::FunctionTracer::Exit(function, record))
+      return;
+    ::simperf::Instrumentor::Get().WriteFunctionCall(record);
+    ::simperf::FunctionTracer::EndReport();
+  };
+  call(reinterpret_cast<void *>(&test_function_instrumentation), std::chrono::milliseconds(1));
+  call(reinterpret_cast<void *>(&test_default_asserts), std::chrono::microseconds(0));
+  call(reinterpret_cast<void *>(std::uintptr_t(0x1800)), std::chrono::milliseconds(1));
+
+  SIMPERF_PROFILE_END_SESSION();
+  ::simperf::FunctionTracer::Disable();
+
+  std::ifstream file("functions.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::size_t kept = 0;
+  for (auto at = contents.find("function,auto"); at != std::string::npos;
+       at = contents.find("function,auto", at + 1))
+    ++kept;
+  EXPECT(kept == 1);
+  EXPECT(std::filesystem::exists("functions.json.maps"));
+  std::filesystem::remove("functions.json");
+  std::filesystem::remove("functions.json.maps");
+}
+
+void test_client_header() {
+  ::simperf::client::BeginSession("client", "client.json");
+  for (int i = 0; i < 3; ++i) {
+    ::simperf::client::ScopeTimer timer("client scope");
+  }
+  ::simperf::client::EndSession();
+
+  std::ifstream file("client.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::size_t scopes = 0;
+  for (auto at = contents.find("\"client scope\""); at != std::string::npos;
+       at = contents.find("\"client scope\"", at + 1))
+    ++scopes;
+  EXPECT(scopes == 3);
+  std::filesystem::remove("client.json");
+}
+
+void test_per_cpu_capture() {
+  ::simperf::Instrumentor::Get().SetCaptureMode(::simperf::trace::CaptureMode::PerCpu);
+  SIMPERF_PROFILE_BEGIN_SESSION("per cpu", "per_cpu.json");
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 64; ++t) {
+    threads.emplace_back([t] {
+      if (t == 0)
+        SIMPERF_PROFILE_THREAD_NAME("first worker");
+      for (int i = 0; i < 10; ++i)
+        ::simperf::InstrumentationTimer timer("connection");
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  SIMPERF_PROFILE_END_SESSION();
+  ::simperf::Instrumentor::Get().SetCaptureMode(::simperf::trace::CaptureMode::PerThread);
+
+  std::ifstream file("per_cpu.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::size_t events = 0;
+  for (auto at = contents.find("\"connection\""); at != std::string::npos;
+       at = contents.find("\"connection\"", at + 1))
+    ++events;
+  EXPECT(::simperf::trace::TraceCollector::Get().CpuRingCount() > 0);
+  EXPECT(events + ::simperf::trace::TraceCollector::Get().LastSessionDropped() == 640);
+  EXPECT(contents.find("first worker") != std::string::npos);
+  std::filesystem::remove("per_cpu.json");
+}
+
+void test_track_value() {
+  ::simperf::ValueTrackOptions options;
+  options.Window = std::chrono::milliseconds(5);
+  ::simperf::ValueSiteRegistry::SetOptions(options);
+
+  SIMPERF_PROFILE_BEGIN_SESSION("values", "values.json");
+  std::thread([] {
+    for (int i = 0; i < 200; ++i) {
+      SIMPERF_TRACK_VALUE("batch size", 100 + i % 7 - 3);
+      SIMPERF_TRACK_VALUE("hit rate", 0.5 + (i % 4) * 0.125);
+      if (i % 50 == 49)
+        std::this_thread::sleep_for(std::chrono::milliseconds(6));
+    }
+  }).join();
+  SIMPERF_PROFILE_END_SESSION();
+  ::simperf::ValueSiteRegistry::SetOptions({});
+
+  std::ifstream file("values.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::size_t counters = 0;
+  for (auto at = contents.find("\"ph\":\"C\""); at != std::string::npos;
+       at = contents.find("\"ph\":\"C\"", at + 1))
+    ++counters;
+  EXPECT(counters > 0);
+  ::simperf::ValueSiteRegistry::ForEach([](::simperf::ValueSite &site) {
+    auto stats = site.Stats();
+    if (stats.Name == "batch size") {
+      EXPECT(stats.Total.Count == 200);
+      EXPECT(stats.Total.Min == 97 && stats.Total.Max == 103);
+    } else if (stats.Name == "hit rate") {
+      EXPECT(stats.Total.Count == 200);
+      EXPECT(stats.Total.Min == 0.5 && stats.Total.Max == 0.875);
+    }
+    EXPECT(site.Windows().size() > 1);
+  });
+
+  // Windows still open when the session ends go into it, written out or counted as lost.
+  options.Window = std::chrono::hours(1);
+  ::simperf::ValueSiteRegistry::SetOptions(options);
+  SIMPERF_PROFILE_BEGIN_SESSION("values", "values.json");
+  std::atomic_bool recorded{false}, done{false};
+  std::thread live([&] {
+    for (int i = 0; i < 5000; ++i) {
+      SIMPERF_TRACK_VALUE("open window", i);
+    }
+    recorded = true;
+    while (!done)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  });
+  while (!recorded)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  SIMPERF_PROFILE_END_SESSION();
+  done = true;
+  live.join();
+  ::simperf::ValueSiteRegistry::SetOptions({});
+
+  file = std::ifstream("values.json");
+  contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  std::uint64_t written = 0;
+  for (auto at = contents.find("\"open window\""); at != std::string::npos;
+       at = contents.find("\"open window\"", at + 1))
+    ++written;
+  EXPECT(written > 0);
+  ::simperf::ValueSiteRegistry::ForEach([&](::simperf::ValueSite &site) {
+    auto stats = site.Stats();
+    if (stats.Name == "open window")
+      EXPECT(written + stats.Unwritten == 5000);
+  });
+  std::filesystem::remove("values.json");
+}
+
+void test_overhead_governor() {
+  ::simperf::GovernorOptions options;
+  options.EvaluateEvery = std::chrono::milliseconds(5);
+  ::simperf::Governor::SetOptions(options);
+
+  SIMPERF_PROFILE_BEGIN_SESSION("governor", "governor.json");
+  // Reports are taken while the hot site flushes and evaluates; neither may wait on the other.
+  std::atomic_bool reporting{true};
+  std::thread reporter([&] {
+    while (reporting)
+      (void)::simperf::ctx::GetGovernorReport();
+  });
+  volatile int sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(50)) {
+    SIMPERF_PROFILE_SCOPE("tiny scope");
+    sink = sink + 1;
+  }
+  reporting = false;
+  reporter.join();
+  for (int i = 0; i < 5; ++i) {
+    SIMPERF_PROFILE_SCOPE("slow scope");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  SIMPERF_PROFILE_END_SESSION();
+  ::simperf::Governor::SetOptions({});
+
+  for (const auto &stats : ::simperf::ctx::GetGovernorReport()) {
+    if (stats.Name == "tiny scope") {
+      EXPECT(stats.SampleEvery != 1);
+      EXPECT(stats.Demotions >= 1);
+    } else if (stats.Name == "slow scope") {
+      EXPECT(stats.SampleEvery == 1);
+    }
+  }
+  std::filesystem::remove("governor.json");
+}
+
+void test_crash_dump() {
+#if defined(__linux__)
+  pid_t child = fork();
+  if (child == 0) {
+    SIMPERF_PROFILE_CRASH_DUMP("crash.txt");
+    std::atomic_bool ready{false};
+    std::thread([&ready] {
+      SIMPERF_PROFILE_SCOPE("waiting worker");
+      ready = true;
+      for (;;)
+        pause();
+    }).detach();
+    while (!ready)
+      std::this_thread::yield();
+    SIMPERF_PROFILE_SCOPE("request");
+    SIMPERF_PROFILE_SCOPE("crashing step");
+    std::raise(SIGSEGV);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+
+  std::ifstream file("crash.txt");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  auto has = [&](const char *text) { return contents.find(text) != std::string::npos; };
+  EXPECT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+  EXPECT(has("(crashed): 2 open scope(s)"));
+  EXPECT(has("#0 waiting worker"));
+  std::filesystem::remove("crash.txt");
+#endif
+}
+
+void test_tail_latency() {
+  ::simperf::TailLatencyOptions options;
+  options.Enabled = true;
+  options.Threshold = std::chrono::milliseconds(2);
+  options.SiteThresholds = {{"request", std::chrono::hours(1)}};
+  ::simperf::TailLatency::SetOptions(options);
+
+  auto unsited = ::simperf::TailLatency::UnsitedDropped();
+  SIMPERF_PROFILE_BEGIN_SESSION("tail", "tail.json");
+  for (int i = 0; i < 1100; ++i) {
+    SIMPERF_PROFILE_SCOPE("fast call");
+  }
+  for (int i = 0; i < 100; ++i) {
+    ::simperf::client::ScopeTimer fast("fast client call");
+  }
+  {
+    SIMPERF_PROFILE_SCOPE("request");
+    {
+      SIMPERF_PROFILE_SCOPE("fast sibling");
+    }
+    {
+      ::simperf::client::ScopeTimer wrapper("client wrapper");
+      SIMPERF_PROFILE_SCOPE("slow call");
+      std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+  }
+  SIMPERF_PROFILE_END_SESSION();
+  unsited = ::simperf::TailLatency::UnsitedDropped() - unsited;
+  ::simperf::TailLatency::SetOptions({});
+
+  std::ifstream file("tail.json");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  auto count = [&](const char *name) {
+    std::size_t found = 0;
+    for (auto at = contents.find(name); at != std::string::npos; at = contents.find(name, at + 1))
+      ++found;
+    return found;
+  };
+  std::uint64_t dropped = 0;
+  for (const auto &stats : ::simperf::ctx::GetGovernorReport()) {
+    if (stats.Name == "fast call")
+      dropped = stats.FastDropped;
+  }
+  EXPECT(count("\"fast call\"") == 0);
+  EXPECT(count("\"fast sibling\"") == 0);
+  EXPECT(count("\"slow call\"") == 1);
+  EXPECT(count("\"request\"") == 1);
+  EXPECT(dropped >= 1000);
+  EXPECT(count("\"fast client call\"") == 0);
+  EXPECT(count("\"client wrapper\"") == 1);
+  EXPECT(unsited == 100);
+  std::filesystem::remove("tail.json");
+}
+
+void test_metrics_exporter() {
+  auto &exporter = ::simperf::MetricsExporter::Get();
+  auto exported_scope = [] {
+    for (int i = 0; i < 20; ++i) {
+      SIMPERF_PROFILE_SCOPE("exported scope");
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  };
+  // Messages are counted under the logger that wrote them, whichever way they were logged.
+  auto &node = ::simperf::LoggerRegistry::Intern(spdlog::default_logger()->name());
+  auto traces = node.Messages[spdlog::level::trace].load();
+  auto warnings = node.Messages[spdlog::level::warn].load();
+  exporter.Start({"simperf_test.prom", std::chrono::milliseconds(20)});
+  SIMPERF_TRACE("simperf", "counted by the exporter");
+  ::simperf::ctx::LogIt("exporter test", spdlog::level::warn, "counted by the exporter");
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  EXPECT(std::filesystem::exists("simperf_test.prom"));
+  // Restarted with an interval that never elapses, the next window holds only these calls.
+  exporter.Start({"simperf_test.prom", std::chrono::hours(1)});
+#if defined(__linux__)
+  // The child is left with a stopped exporter, so exiting does not wait on the parent's thread.
+  pid_t child = fork();
+  if (child == 0)
+    std::exit(exporter.Running() ? 1 : 0);
+  EXPECT(wait_for_clean_exit(child));
+#endif
+  exported_scope();
+  exporter.WriteNow("simperf_test.prom");
+  std::ifstream file("simperf_test.prom");
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  exporter.Stop();
+  EXPECT(!::simperf::GovernedSite::LatencyRecording());
+
+  auto has = [&](const char *text) { return contents.find(text) != std::string::npos; };
+  EXPECT(has("simperf_scope_calls_total{site=\"exported scope\",file=\"simperf2_test.cpp\""));
+  // Each call sleeps at least 100us; only the timer's overshoot varies.
+  auto p99 = contents.find(",quantile=\"0.99\"} ",
+                           contents.find("simperf_scope_seconds{site=\"exported scope\""));
+  EXPECT(p99 != std::string::npos);
+  if (p99 != std::string::npos)
+    EXPECT(std::strtod(contents.c_str() + contents.find("} ", p99) + 2, nullptr) >= 0.0001);
+  EXPECT(has("# TYPE simperf_scope_seconds summary\n"));
+  EXPECT(has("simperf_scope_seconds_count{site=\"exported scope\",file=\"simperf2_test.cpp\""));
+  EXPECT(has("simperf_scope_seconds_sum{site=\"exported scope\",file=\"simperf2_test.cpp\""));
+  auto messages = [&](const char *level, std::uint64_t count) {
+    return has(std::format("simperf_log_messages_total{{logger=\"{}\",level=\"{}\"}} {}\n",
+                           node.Name, level, count)
+                   .c_str());
+  };
+  EXPECT(messages("trace", traces + 1));
+  EXPECT(messages("warning", warnings + 1));
+  EXPECT(!std::filesystem::exists("simperf_test.prom.tmp"));
+  std::filesystem::remove("simperf_test.prom");
+}
+
+void test_logger_registry_retention() {
+  std::weak_ptr<spdlog::logger> dropped;
+  {
+    auto logger = std::make_shared<spdlog::logger>(
+        "short lived", std::make_shared<spdlog::sinks::ostream_sink_mt>(std::cout));
+    ::simperf::LoggerRegistry::Publish(logger);
+    EXPECT(::simperf::LoggerRegistry::Resolve("short lived") == logger.get());
+    dropped = logger;
+  }
+  EXPECT(::simperf::LoggerRegistry::Drop("short lived"));
+  ::simperf::LoggerRegistry::Drop("short lived");
+  // Another thread may still be using what it resolved, however many drops later.
+  EXPECT(!dropped.expired());
+  EXPECT(::simperf::LoggerRegistry::Resolve("short lived") != dropped.lock().get());
+}
+
 void test_default_asserts() {
   int x = 1;
   int y = 2;
@@ -34,7 +925,7 @@ void test_default_asserts() {
     auto a = ::simperf::Assertion(check, left, right,                                              \
                                   _STRINGIZEX(check),                          \
                                   _STRINGIZEX(left),       \
-                                  _STRINGIZEX(right), ::simperf::make_array(__VA_ARGS__));         \
+                                  _STRINGIZEX(right), SIMPERF_ASSERTION_TAGS(__VA_ARGS__));        \
   if (a) {                                                                                        \
     SIMPERF_DEBUGBREAK();                                                                          \
   }}
@@ -51,7 +942,7 @@ void test_default_asserts() {
     auto a =                                                                                       \
         ::simperf::Assertion(check, left, right, _STRINGIZEX(check),                          \
                                   _STRINGIZEX(left),       \
-                                  _STRINGIZEX(right),::simperf::make_array(__VA_ARGS__));        \
+                                  _STRINGIZEX(right), SIMPERF_ASSERTION_TAGS(__VA_ARGS__));       \
     if (a) {                                                                                      \
       SIMPERF_DEBUGBREAK();                                                                        \
     }                                                                                              \
@@ -42,6 +42,7 @@ void register_static_example(const std::vector<spdlog::sink_ptr>& sinks)
 	::simperf::Log::LogIt("core", "{1}", 10);
 
 	int x = 0;
+	SIMPERF_ASSERT_WARGS(x == 0);
 	CORE_TRACE("hi from core {0}", x);
 	CORE_DEBUG("hi from core {0}", x);
 	CORE_INFO("hi from core {0}", x);
@@ -50,6 +51,33 @@ void register_static_example(const std::vector<spdlog::sink_ptr>& sinks)
 	CORE_CRITICAL("hi from core {0}", x);
 }
 
+// Renders a failing check the way SIMPERF_ASSERT_WARGS does, without the debug break.
+bool check_failed_expression_text()
+{
+	int x = 1;
+	int y = 3;
+	SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_BEGIN
+	auto expr = ::simperf::ExpressionDecomposer{} <= x + 1 == y * 2;
+	SIMPERF_SUPPRESS_PARENTHESES_WARNINGS_END
+	constexpr auto operands = ::simperf::SplitExpression("x + 1 == y * 2");
+	std::string text = expr.Describe(operands);
+	if (expr.Result() || text != "x + 1: 2\ny * 2: 6")
+	{
+		std::cout << "unexpected operand text:\n" << text << std::endl;
+		return false;
+	}
+
+	// `&&` must be parenthesised, which leaves a single operand.
+	auto both = ::simperf::ExpressionDecomposer{} <= (x == 1 && y == 2);
+	text = both.Describe(::simperf::SplitExpression("(x == 1 && y == 2)"));
+	if (both.Result() || text != "(x == 1 && y == 2): false")
+	{
+		std::cout << "unexpected operand text:\n" << text << std::endl;
+		return false;
+	}
+	return true;
+}
+
 int main()
 {
 	SIMPERF_PROFILE_BEGIN_SESSION("test", "simperf-test.json");
@@ -57,6 +85,8 @@ int main()
 	make_sinks(sinks);
 
 	register_static_example(sinks);
+	if (!check_failed_expression_text())
+		return 1;
 
 	std::cout << "end" << std::endl;
 	return 0;
@@ -0,0 +1,379 @@
+// simperf-merge: combines per-process simperf traces into one Chrome trace.
+//
+//   simperf-merge -o merged.json results.json results.4242.json ...
+//
+// Every session header carries the writing process' pid and a steady/realtime clock anchor.
+// Event timestamps are moved onto the wall clock with that anchor and rebased to the earliest
+// session, so a pre-forked worker pool shows up as one timeline with one track per process.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+#pragma region Json
+// Just enough JSON for trace files. Numbers keep their source text so 64 bit thread ids survive.
+struct JsonValue;
+using JsonObject = std::vector<std::pair<std::string, JsonValue>>;
+using JsonArray = std::vector<JsonValue>;
+
+struct JsonNumber {
+  std::string Text;
+};
+
+struct JsonValue {
+  std::variant<std::nullptr_t, bool, JsonNumber, std::string, JsonArray, JsonObject> Data;
+
+  const JsonValue *Find(std::string_view key) const {
+    if (auto object = std::get_if<JsonObject>(&Data)) {
+      for (const auto &[name, value] : *object) {
+        if (name == key)
+          return &value;
+      }
+    }
+    return nullptr;
+  }
+
+  JsonValue *Find(std::string_view key) {
+    return const_cast<JsonValue *>(std::as_const(*this).Find(key));
+  }
+
+  bool IsNumber(void) const { return std::holds_alternative<JsonNumber>(Data); }
+  double AsDouble(void) const { return std::stod(std::get<JsonNumber>(Data).Text); }
+  std::int64_t AsInteger(void) const { return std::stoll(std::get<JsonNumber>(Data).Text); }
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(std::string_view text) : m_Text(text) {}
+
+  JsonValue Parse(void) {
+    JsonValue value = ParseValue();
+    SkipSpace();
+    if (m_Pos != m_Text.size())
+      Fail("trailing characters");
+    return value;
+  }
+
+private:
+  JsonValue ParseValue(void) {
+    SkipSpace();
+    if (m_Pos >= m_Text.size())
+      Fail("unexpected end of input");
+    switch (m_Text[m_Pos]) {
+    case '{':
+      return {ParseObject()};
+    case '[':
+      return {ParseArray()};
+    case '"':
+      return {ParseString()};
+    case 't':
+      Expect("true");
+      return {true};
+    case 'f':
+      Expect("false");
+      return {false};
+    case 'n':
+      Expect("null");
+      return {nullptr};
+    default:
+      return {ParseNumber()};
+    }
+  }
+
+  JsonObject ParseObject(void) {
+    JsonObject object;
+    ++m_Pos;
+    SkipSpace();
+    if (Peek() == '}') {
+      ++m_Pos;
+      return object;
+    }
+    for (;;) {
+      SkipSpace();
+      std::string key = ParseString();
+      SkipSpace();
+      Consume(':');
+      object.emplace_back(std::move(key), ParseValue());
+      SkipSpace();
+      if (Peek() == ',') {
+        ++m_Pos;
+        continue;
+      }
+      Consume('}');
+      return object;
+    }
+  }
+
+  JsonArray ParseArray(void) {
+    JsonArray array;
+    ++m_Pos;
+    SkipSpace();
+    if (Peek() == ']') {
+      ++m_Pos;
+      return array;
+    }
+    for (;;) {
+      array.push_back(ParseValue());
+      SkipSpace();
+      if (Peek() == ',') {
+        ++m_Pos;
+        continue;
+      }
+      Consume(']');
+      return array;
+    }
+  }
+
+  std::string ParseString(void) {
+    Consume('"');
+    std::string result;
+    while (m_Pos < m_Text.size() && m_Text[m_Pos] != '"') {
+      char c = m_Text[m_Pos++];
+      if (c == '\\' && m_Pos < m_Text.size()) {
+        // Escapes are kept verbatim; they are written back out unchanged.
+        result += c;
+        c = m_Text[m_Pos++];
+      }
+      result += c;
+    }
+    Consume('"');
+    return result;
+  }
+
+  JsonNumber ParseNumber(void) {
+    std::size_t start = m_Pos;
+    while (m_Pos < m_Text.size() &&
+           std::string_view("+-0123456789.eE").find(m_Text[m_Pos]) != std::string_view::npos)
+      ++m_Pos;
+    if (start == m_Pos)
+      Fail("unexpected character");
+    return {std::string(m_Text.substr(start, m_Pos - start))};
+  }
+
+  void SkipSpace(void) {
+    while (m_Pos < m_Text.size() &&
+           (m_Text[m_Pos] == ' ' || m_Text[m_Pos] == '\n' || m_Text[m_Pos] == '\r' ||
+            m_Text[m_Pos] == '\t'))
+      ++m_Pos;
+  }
+
+  char Peek(void) const { return m_Pos < m_Text.size() ? m_Text[m_Pos] : '\0'; }
+
+  void Consume(char c) {
+    if (Peek() != c)
+      Fail(std::string("expected '") + c + "'");
+    ++m_Pos;
+  }
+
+  void Expect(std::string_view word) {
+    if (m_Text.substr(m_Pos, word.size()) != word)
+      Fail("unexpected token");
+    m_Pos += word.size();
+  }
+
+  [[noreturn]] void Fail(const std::string &what) const {
+    throw std::runtime_error(what + " at offset " + std::to_string(m_Pos));
+  }
+
+private:
+  std::string_view m_Text;
+  std::size_t m_Pos = 0;
+};
+
+void write_json(std::ostream &os, const JsonValue &value) {
+  std::visit(
+      [&](const auto &data) {
+        using T = std::decay_t<decltype(data)>;
+        if constexpr (std::is_same_v<T, std::nullptr_t>) {
+          os << "null";
+        } else if constexpr (std::is_same_v<T, bool>) {
+          os << (data ? "true" : "false");
+        } else if constexpr (std::is_same_v<T, JsonNumber>) {
+          os << data.Text;
+        } else if constexpr (std::is_same_v<T, std::string>) {
+          os << '"' << data << '"';
+        } else if constexpr (std::is_same_v<T, JsonArray>) {
+          os << '[';
+          for (std::size_t i = 0; i < data.size(); ++i) {
+            if (i)
+              os << ',';
+            write_json(os, data[i]);
+          }
+          os << ']';
+        } else {
+          os << '{';
+          for (std::size_t i = 0; i < data.size(); ++i) {
+            if (i)
+              os << ',';
+            os << '"' << data[i].first << "\":";
+            write_json(os, data[i].second);
+          }
+          os << '}';
+        }
+      },
+      value.Data);
+}
+
+JsonValue make_number(double value) {
+  std::ostringstream os;
+  os << std::setprecision(3) << std::fixed << value;
+  return {JsonNumber{os.str()}};
+}
+
+JsonValue make_number(std::int64_t value) { return {JsonNumber{std::to_string(value)}}; }
+#pragma endregion Json
+
+#pragma region Merge
+struct Trace {
+  std::string Path;
+  std::string Session;
+  std::int64_t ProcessID = 0;
+  std::int64_t ParentProcessID = 0;
+  std::int64_t ClockOffset = 0; // realtime_us - steady_us
+  bool Anchored = false;
+  JsonArray Events;
+};
+
+Trace load_trace(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    throw std::runtime_error("cannot open " + path);
+  std::stringstream buffer;
+  buffer << in.rdbuf();
+  std::string text = buffer.str();
+
+  // A session that was never ended lacks its footer; close it so it can still be merged.
+  auto last = text.find_last_not_of(" \r\n\t");
+  if (last != std::string::npos && !std::string_view(text).substr(0, last + 1).ends_with("]}"))
+    text = text.substr(0, last + 1) + "]}";
+
+  JsonValue root = JsonParser(text).Parse();
+  Trace trace;
+  trace.Path = path;
+  if (const JsonValue *other = root.Find("otherData")) {
+    if (auto session = other->Find("session"))
+      trace.Session = std::get<std::string>(session->Data);
+    if (auto pid = other->Find("pid"); pid && pid->IsNumber())
+      trace.ProcessID = pid->AsInteger();
+    if (auto ppid = other->Find("ppid"); ppid && ppid->IsNumber())
+      trace.ParentProcessID = ppid->AsInteger();
+    if (const JsonValue *anchor = other->Find("clock_anchor")) {
+      auto steady = anchor->Find("steady_us");
+      auto realtime = anchor->Find("realtime_us");
+      if (steady && realtime) {
+        trace.ClockOffset = realtime->AsInteger() - steady->AsInteger();
+        trace.Anchored = true;
+      }
+    }
+  }
+  if (JsonValue *events = root.Find("traceEvents")) {
+    for (auto &event : std::get<JsonArray>(events->Data)) {
+      auto object = std::get_if<JsonObject>(&event.Data);
+      if (object && !object->empty())
+        trace.Events.push_back(std::move(event));
+    }
+  }
+  return trace;
+}
+
+void set_member(JsonValue &object, std::string_view key, JsonValue value) {
+  if (JsonValue *existing = object.Find(key))
+    *existing = std::move(value);
+  else
+    std::get<JsonObject>(object.Data).emplace_back(std::string(key), std::move(value));
+}
+
+JsonValue process_name_event(const Trace &trace) {
+  std::string name = trace.Session.empty() ? trace.Path : trace.Session;
+  name += " [" + std::to_string(trace.ProcessID) + "]";
+  if (trace.ParentProcessID != 0)
+    name += " forked from " + std::to_string(trace.ParentProcessID);
+  JsonObject args{{"name", {name}}};
+  return {JsonObject{{"name", {std::string("process_name")}},
+                     {"ph", {std::string("M")}},
+                     {"pid", make_number(trace.ProcessID)},
+                     {"args", {std::move(args)}}}};
+}
+
+int merge(const std::vector<std::string> &inputs, const std::string &output) {
+  std::vector<Trace> traces;
+  for (const auto &path : inputs) {
+    traces.push_back(load_trace(path));
+    if (!traces.back().Anchored)
+      std::cerr << "simperf-merge: " << path << " has no clock anchor; timestamps left as is\n";
+  }
+
+  // Rebase everything to the earliest event on the common (wall clock) timeline. The shift is
+  // applied as one integer so wall clock magnitudes never eat into the microsecond fraction.
+  std::int64_t origin = std::numeric_limits<std::int64_t>::max();
+  for (const auto &trace : traces) {
+    for (const auto &event : trace.Events) {
+      if (auto ts = event.Find("ts"); ts && ts->IsNumber())
+        origin = std::min(origin, static_cast<std::int64_t>(ts->AsDouble()) + trace.ClockOffset);
+    }
+  }
+  if (origin == std::numeric_limits<std::int64_t>::max())
+    origin = 0;
+
+  JsonArray merged;
+  JsonArray sources;
+  for (auto &trace : traces) {
+    sources.push_back({trace.Path});
+    merged.push_back(process_name_event(trace));
+    for (auto &event : trace.Events) {
+      if (auto ts = event.Find("ts"); ts && ts->IsNumber())
+        *ts = make_number(ts->AsDouble() + static_cast<double>(trace.ClockOffset - origin));
+      // Traces written before pids were recorded all claim pid 0.
+      auto pid = event.Find("pid");
+      if (!pid || (pid->IsNumber() && pid->AsInteger() == 0))
+        set_member(event, "pid", make_number(trace.ProcessID));
+      merged.push_back(std::move(event));
+    }
+  }
+
+  JsonObject other{{"merged_from", {std::move(sources)}},
+                   {"realtime_origin_us", make_number(origin)}};
+  JsonValue root{JsonObject{{"otherData", {std::move(other)}}, {"traceEvents", {std::move(merged)}}}};
+
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("cannot write " + output);
+  write_json(out, root);
+  return 0;
+}
+#pragma endregion Merge
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output = "merged.json";
+  std::vector<std::string> inputs;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg(argv[i]);
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc)
+      output = argv[++i];
+    else
+      inputs.emplace_back(arg);
+  }
+  if (inputs.empty()) {
+    std::cerr << "usage: simperf-merge [-o merged.json] trace.json [trace.<pid>.json ...]\n";
+    return 2;
+  }
+  try {
+    return merge(inputs, output);
+  } catch (std::exception &e) {
+    std::cerr << "simperf-merge: " << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,301 @@
+// simperf-symbolize: names the functions recorded by -finstrument-functions in a Chrome trace.
+//
+//   simperf-symbolize [-m results.json.maps] [-o symbolized.json] results.json
+//
+// The hooks name each call by its raw address ("0x55d0c0a1b2c3"). Instrumentor::BeginSession saves
+// the process' /proc/self/maps next to the trace, which places every address in a module and file
+// offset; the symbol is then looked up in that module's ELF symbol tables and demangled. Modules
+// must still be at their recorded paths, and stripped ones only resolve exported symbols.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define SIMPERF_HAS_CXXABI 1
+#endif
+
+namespace {
+#pragma region Elf
+// Only what symbol lookup needs from 64 bit little endian ELF files, read by offset so the tool
+// does not depend on <elf.h>.
+static constexpr std::uint32_t PT_LOAD_SEGMENT = 1;
+static constexpr std::uint32_t SHT_SYMTAB_SECTION = 2;
+static constexpr std::uint32_t SHT_DYNSYM_SECTION = 11;
+static constexpr std::uint8_t STT_FUNC_SYMBOL = 2;
+
+template <typename T> T read_at(const std::string &image, std::uint64_t offset) {
+  if (offset + sizeof(T) > image.size())
+    throw std::runtime_error("truncated ELF file");
+  T value;
+  std::memcpy(&value, image.data() + offset, sizeof(T));
+  return value;
+}
+
+struct ElfSymbol {
+  std::uint64_t Value;
+  std::uint64_t Size;
+  std::string Name;
+};
+
+struct ElfSegment {
+  std::uint64_t Offset;
+  std::uint64_t VirtualAddress;
+  std::uint64_t FileSize;
+};
+
+class ElfModule {
+public:
+  explicit ElfModule(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return;
+    std::string image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    // 64 bit, little endian.
+    if (image.size() < 64 || image.compare(0, 4, "\177ELF") != 0 || image[4] != 2 || image[5] != 1)
+      return;
+
+    auto program_headers = read_at<std::uint64_t>(image, 32);
+    auto section_headers = read_at<std::uint64_t>(image, 40);
+    auto program_header_size = read_at<std::uint16_t>(image, 54);
+    auto program_header_count = read_at<std::uint16_t>(image, 56);
+    auto section_header_size = read_at<std::uint16_t>(image, 58);
+    auto section_header_count = read_at<std::uint16_t>(image, 60);
+
+    for (std::uint16_t i = 0; i < program_header_count; ++i) {
+      auto header = program_headers + std::uint64_t(i) * program_header_size;
+      if (read_at<std::uint32_t>(image, header) != PT_LOAD_SEGMENT)
+        continue;
+      m_Segments.push_back({read_at<std::uint64_t>(image, header + 8),
+                            read_at<std::uint64_t>(image, header + 16),
+                            read_at<std::uint64_t>(image, header + 32)});
+    }
+
+    // .symtab when the module is not stripped, .dynsym otherwise; both when present.
+    for (std::uint16_t i = 0; i < section_header_count; ++i) {
+      auto header = section_headers + std::uint64_t(i) * section_header_size;
+      auto type = read_at<std::uint32_t>(image, header + 4);
+      if (type != SHT_SYMTAB_SECTION && type != SHT_DYNSYM_SECTION)
+        continue;
+      auto offset = read_at<std::uint64_t>(image, header + 24);
+      auto size = read_at<std::uint64_t>(image, header + 32);
+      auto link = read_at<std::uint32_t>(image, header + 40);
+      auto entry_size = read_at<std::uint64_t>(image, header + 56);
+      if (entry_size == 0 || link >= section_header_count)
+        continue;
+      auto strings_header = section_headers + std::uint64_t(link) * section_header_size;
+      auto strings = read_at<std::uint64_t>(image, strings_header + 24);
+      auto strings_size = read_at<std::uint64_t>(image, strings_header + 32);
+
+      for (std::uint64_t symbol = offset; symbol + entry_size <= offset + size;
+           symbol += entry_size) {
+        auto info = read_at<std::uint8_t>(image, symbol + 4);
+        auto value = read_at<std::uint64_t>(image, symbol + 8);
+        if ((info & 0xf) != STT_FUNC_SYMBOL || value == 0)
+          continue;
+        auto name = read_at<std::uint32_t>(image, symbol);
+        if (name >= strings_size || strings + name >= image.size())
+          continue;
+        m_Symbols.push_back(
+            {value, read_at<std::uint64_t>(image, symbol + 16), image.c_str() + strings + name});
+      }
+    }
+    std::sort(m_Symbols.begin(), m_Symbols.end(),
+              [](const ElfSymbol &a, const ElfSymbol &b) { return a.Value < b.Value; });
+  }
+
+  // The function containing `file_offset`, or nullptr.
+  const ElfSymbol *Find(std::uint64_t file_offset) const {
+    auto segment = std::find_if(m_Segments.begin(), m_Segments.end(), [&](const ElfSegment &s) {
+      return file_offset >= s.Offset && file_offset < s.Offset + s.FileSize;
+    });
+    if (segment == m_Segments.end())
+      return nullptr;
+    auto address = file_offset - segment->Offset + segment->VirtualAddress;
+    auto next = std::upper_bound(m_Symbols.begin(), m_Symbols.end(), address,
+                                 [](std::uint64_t a, const ElfSymbol &s) { return a < s.Value; });
+    if (next == m_Symbols.begin())
+      return nullptr;
+    const ElfSymbol &symbol = *std::prev(next);
+    if (symbol.Size != 0 && address >= symbol.Value + symbol.Size)
+      return nullptr;
+    return &symbol;
+  }
+
+private:
+  std::vector<ElfSegment> m_Segments;
+  std::vector<ElfSymbol> m_Symbols;
+};
+#pragma endregion Elf
+
+#pragma region Symbolize
+struct Mapping {
+  std::uint64_t Start;
+  std::uint64_t End;
+  std::uint64_t Offset;
+  std::string Path;
+};
+
+std::vector<Mapping> load_maps(const std::string &path) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("cannot read " + path);
+  std::vector<Mapping> mappings;
+  std::string line;
+  while (std::getline(file, line)) {
+    // start-end perms offset dev inode path
+    std::istringstream fields(line);
+    std::string range, perms, offset, device, inode, module;
+    fields >> range >> perms >> offset >> device >> inode;
+    std::getline(fields >> std::ws, module);
+    auto dash = range.find('-');
+    if (dash == std::string::npos || module.empty() || module.front() != '/')
+      continue;
+    mappings.push_back({std::stoull(range.substr(0, dash), nullptr, 16),
+                        std::stoull(range.substr(dash + 1), nullptr, 16),
+                        std::stoull(offset, nullptr, 16), module});
+  }
+  return mappings;
+}
+
+std::string demangle(const std::string &name) {
+#if defined(SIMPERF_HAS_CXXABI)
+  int status = 0;
+  char *demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+  if (status == 0 && demangled) {
+    std::string result(demangled);
+    std::free(demangled);
+    return result;
+  }
+#endif
+  return name;
+}
+
+class Symbolizer {
+public:
+  explicit Symbolizer(std::vector<Mapping> mappings) : m_Mappings(std::move(mappings)) {}
+
+  std::string Name(std::uint64_t address) {
+    if (auto cached = m_Names.find(address); cached != m_Names.end())
+      return cached->second;
+    return m_Names[address] = Resolve(address);
+  }
+
+  std::size_t Resolved(void) const { return m_Resolved; }
+
+private:
+  std::string Resolve(std::uint64_t address) {
+    char fallback[32];
+    std::snprintf(fallback, sizeof(fallback), "0x%llx", static_cast<unsigned long long>(address));
+    auto mapping = std::find_if(m_Mappings.begin(), m_Mappings.end(), [&](const Mapping &m) {
+      return address >= m.Start && address < m.End;
+    });
+    if (mapping == m_Mappings.end())
+      return fallback;
+
+    auto &module = m_Modules[mapping->Path];
+    if (!module)
+      module = std::make_unique<ElfModule>(mapping->Path);
+    auto file_offset = address - mapping->Start + mapping->Offset;
+    if (const ElfSymbol *symbol = module->Find(file_offset)) {
+      ++m_Resolved;
+      return demangle(symbol->Name);
+    }
+    auto slash = mapping->Path.find_last_of('/');
+    std::snprintf(fallback, sizeof(fallback), "+0x%llx",
+                  static_cast<unsigned long long>(file_offset));
+    return mapping->Path.substr(slash + 1) + fallback;
+  }
+
+  std::vector<Mapping> m_Mappings;
+  std::map<std::string, std::unique_ptr<ElfModule>> m_Modules;
+  std::map<std::uint64_t, std::string> m_Names;
+  std::size_t m_Resolved = 0;
+};
+
+std::string escape_json(std::string_view text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+int symbolize(const std::string &input, const std::string &maps, const std::string &output) {
+  std::ifstream file(input, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("cannot read " + input);
+  std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (trace.empty() || trace.front() != '{')
+    throw std::runtime_error(input + " is not a Chrome JSON trace");
+
+  Symbolizer symbolizer(load_maps(maps));
+  static constexpr std::string_view marker = "\"name\":\"0x";
+  std::string result;
+  result.reserve(trace.size());
+  std::size_t copied = 0;
+  std::size_t calls = 0;
+  for (auto at = trace.find(marker); at != std::string::npos; at = trace.find(marker, at + 1)) {
+    auto digits = at + marker.size();
+    auto end = trace.find_first_not_of("0123456789abcdef", digits);
+    if (end == std::string::npos || end == digits || trace[end] != '"')
+      continue;
+    result.append(trace, copied, digits - 2 - copied);
+    result += escape_json(symbolizer.Name(std::stoull(trace.substr(digits, end - digits), nullptr,
+                                                      16)));
+    copied = end;
+    ++calls;
+  }
+  result.append(trace, copied);
+
+  std::ofstream out(output, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("cannot write " + output);
+  out << result;
+  std::cerr << "simperf-symbolize: " << calls << " calls, " << symbolizer.Resolved()
+            << " distinct functions resolved\n";
+  return 0;
+}
+#pragma endregion Symbolize
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output = "symbolized.json";
+  std::string maps;
+  std::string input;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg(argv[i]);
+    if ((arg == "-o" || arg == "--output") && i + 1 < argc)
+      output = argv[++i];
+    else if ((arg == "-m" || arg == "--maps") && i + 1 < argc)
+      maps = argv[++i];
+    else
+      input = arg;
+  }
+  if (input.empty()) {
+    std::cerr << "usage: simperf-symbolize [-m trace.json.maps] [-o symbolized.json] trace.json\n";
+    return 2;
+  }
+  if (maps.empty())
+    maps = input + ".maps";
+  try {
+    return symbolize(input, maps, output);
+  } catch (std::exception &e) {
+    std::cerr << "simperf-symbolize: " << e.what() << std::endl;
+    return 1;
+  }
+}